@@ -0,0 +1,98 @@
+// 键空间哈希表的微基准：对比std::unordered_map<std::string,V>和dict.h中的开放寻址表
+// 构建：cmake -DMYREDIS_BUILD_BENCH=ON，然后运行 ./bench_dict [key数量...]，默认1M 10M 50M
+#include "../include/dict.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace myredis;
+
+// value用一个和KeyObject差不多大的结构，测的是槽位布局而不是value本身
+struct Value
+{
+    int64_t _expireAtMs = -1;
+    std::string _str;
+};
+static std::vector<std::string> buildKeys(size_t count, const char *prefix)
+{
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        keys.push_back(prefix + std::to_string(i));
+    // 打乱顺序，避免按插入顺序访问时命中率虚高
+    for (size_t i = count; i > 1; i--)
+        std::swap(keys[i - 1], keys[static_cast<size_t>(std::rand()) % i]);
+    return keys;
+}
+template <class Fn>
+static void run(const char *name, size_t ops, Fn fn)
+{
+    auto begin = std::chrono::steady_clock::now();
+    size_t result = fn();
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - begin).count();
+    std::printf("  %-28s %8.1f ns/op  (%zu)\n", name, sec * 1e9 / static_cast<double>(ops), result);
+}
+static void benchStd(const std::vector<std::string> &keys, const std::vector<std::string> &misses)
+{
+    std::unordered_map<std::string, Value> map;
+    run("unordered_map insert", keys.size(), [&]
+        {
+        for (const auto &k : keys)
+            map[k]._expireAtMs = 0;
+        return map.size(); });
+    run("unordered_map lookup hit", keys.size(), [&]
+        {
+        size_t n = 0;
+        for (const auto &k : keys)
+            n += map.find(k) != map.end();
+        return n; });
+    run("unordered_map lookup miss", misses.size(), [&]
+        {
+        size_t n = 0;
+        for (const auto &k : misses)
+            n += map.find(k) != map.end();
+        return n; });
+}
+static void benchDict(const std::vector<std::string> &keys, const std::vector<std::string> &misses)
+{
+    Dict<Value> dict;
+    run("Dict insert", keys.size(), [&]
+        {
+        for (const auto &k : keys)
+            dict[k]._expireAtMs = 0;
+        return dict.size(); });
+    run("Dict lookup hit", keys.size(), [&]
+        {
+        size_t n = 0;
+        for (const auto &k : keys)
+            n += dict.find(k) != nullptr;
+        return n; });
+    run("Dict lookup miss", misses.size(), [&]
+        {
+        size_t n = 0;
+        for (const auto &k : misses)
+            n += dict.find(k) != nullptr;
+        return n; });
+}
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {1000000, 10000000, 50000000};
+    for (size_t n : sizes)
+    {
+        std::vector<std::string> keys = buildKeys(n, "key:");
+        // 不存在的key取n/4个就够了
+        std::vector<std::string> misses = buildKeys(n / 4, "miss:");
+        std::printf("%zu keys\n", n);
+        // 两个表分开构造和析构，避免同时占两份内存
+        benchStd(keys, misses);
+        benchDict(keys, misses);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// 定期删除的微基准：大量带过期时间的key，测一次expireScanStep的耗时和到期key被清理掉的速度
+// 构建：cmake -DMYREDIS_BUILD_BENCH=ON，然后运行 ./bench_expire [key数量...]，默认1M 5M
+#include "../include/kv.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+using namespace myredis;
+
+static double elapsedUs(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+}
+static void bench(size_t n)
+{
+    KeyValueStore store;
+    // 先让所有key都在一小时后过期，量一次没有key到期时的开销
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+        store.set("key:" + std::to_string(i), "v", int64_t{3600 * 1000});
+    std::printf("%zu keys with ttl, load %.0f ms\n", n, elapsedUs(begin) / 1000);
+    const int kCalls = 200;
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < kCalls; i++)
+        store.expireScanStep(64);
+    std::printf("  %-32s %10.1f us/call\n", "expireScanStep(64), none due", elapsedUs(begin) / kCalls);
+    // 再把一半的key改成立即过期
+    for (size_t i = 0; i < n; i += 2)
+        store.expire("key:" + std::to_string(i), 0);
+    // 按每次64个的步长清理到期的key，最多跑kMaxCalls次
+    const int kMaxCalls = 2000;
+    size_t removed = 0;
+    int calls = 0;
+    begin = std::chrono::steady_clock::now();
+    while (calls < kMaxCalls && removed < n / 2)
+    {
+        removed += static_cast<size_t>(store.expireScanStep(64));
+        ++calls;
+    }
+    double us = elapsedUs(begin);
+    std::printf("  %-32s %10.1f us/call  removed %zu of %zu due in %d calls\n", "expireScanStep(64), half due", us / calls, removed, n / 2, calls);
+}
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {1000000, 5000000};
+    for (size_t n : sizes)
+        bench(n);
+    return 0;
+}
@@ -0,0 +1,122 @@
+// 分隔符查找的微基准：对比std::string::find和scan.h中的向量化实现
+// 构建：cmake -DMYREDIS_BUILD_BENCH=ON，然后运行 ./bench_scan
+#include "../include/scan.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+using namespace myredis;
+
+static std::string encodeCommand(const std::vector<std::string> &parts)
+{
+    std::string out = "*" + std::to_string(parts.size()) + "\r\n";
+    for (const auto &p : parts)
+        out += "$" + std::to_string(p.size()) + "\r\n" + p + "\r\n";
+    return out;
+}
+// 生成count条SET命令首尾相连，模拟管道流量或者aof文件
+static std::string buildStream(size_t count, size_t valueLen)
+{
+    std::string out;
+    std::string value(valueLen, 'v');
+    for (size_t i = 0; i < count; i++)
+        out += encodeCommand({"SET", "key:" + std::to_string(i), value});
+    return out;
+}
+// 生成rdb那样的按'\n'分行的文本，每行一个长value
+static std::string buildLines(size_t count, size_t lineLen)
+{
+    std::string out;
+    std::string body(lineLen, 'x');
+    for (size_t i = 0; i < count; i++)
+    {
+        out += "STR key:" + std::to_string(i) + " " + body;
+        out.push_back('\n');
+    }
+    return out;
+}
+// 和RespParser/AofLogger::load一样的走法：读一行，遇到bulk长度行就按长度跳过数据体
+template <class Finder>
+static size_t walkResp(const std::string &buf, Finder find)
+{
+    size_t pos = 0, lines = 0;
+    while (pos < buf.size())
+    {
+        size_t e = find(buf, pos);
+        if (e == std::string::npos)
+            break;
+        lines++;
+        if (buf[pos] == '$')
+        {
+            size_t len = std::strtoull(buf.data() + pos + 1, nullptr, 10);
+            pos = e + 2 + len + 2;
+        }
+        else
+            pos = e + 2;
+    }
+    return lines;
+}
+template <class Finder>
+static size_t walkLines(const std::string &buf, Finder find)
+{
+    size_t pos = 0, lines = 0;
+    while (pos < buf.size())
+    {
+        size_t e = find(buf, pos);
+        if (e == std::string::npos)
+            break;
+        lines++;
+        pos = e + 1;
+    }
+    return lines;
+}
+template <class Fn>
+static void run(const char *name, const std::string &buf, int rounds, Fn fn)
+{
+    size_t result = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        result += fn();
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - begin).count();
+    double mb = static_cast<double>(buf.size()) * rounds / (1024.0 * 1024.0);
+    std::printf("  %-22s %9.1f MB/s  (%zu lines)\n", name, mb / sec, result / static_cast<size_t>(rounds));
+}
+static void benchResp(const char *title, const std::string &buf, int rounds)
+{
+    std::printf("%s: %.1f MB\n", title, static_cast<double>(buf.size()) / (1024.0 * 1024.0));
+    run("std::string::find", buf, rounds, [&]
+        { return walkResp(buf, [](const std::string &b, size_t pos)
+                          { return b.find("\r\n", pos); }); });
+    run("scalar loop", buf, rounds, [&]
+        { return walkResp(buf, [](const std::string &b, size_t pos)
+                          { size_t e = findCrlfScalar(b.data() + pos, b.size() - pos);
+                            return e == kScanNotFound ? e : e + pos; }); });
+    run(scanImplName(), buf, rounds, [&]
+        { return walkResp(buf, [](const std::string &b, size_t pos)
+                          { size_t e = findCrlf(b.data() + pos, b.size() - pos);
+                            return e == kScanNotFound ? e : e + pos; }); });
+}
+int main()
+{
+    std::printf("scan impl: %s\n", scanImplName());
+    benchResp("pipelined SET, 16B values", buildStream(200000, 16), 20);
+    benchResp("aof replay, 512B values", buildStream(100000, 512), 20);
+    // 较长的行才能体现向量化的优势，比如内联的长参数或者rdb中的一行
+    std::string longCrlf;
+    for (int i = 0; i < 20000; i++)
+        longCrlf += "+" + std::string(1024, 'a') + "\r\n";
+    benchResp("long CRLF lines, 1KB", longCrlf, 20);
+
+    std::string lines = buildLines(50000, 1024);
+    std::printf("rdb lines, 1KB: %.1f MB\n", static_cast<double>(lines.size()) / (1024.0 * 1024.0));
+    run("std::string::find", lines, 20, [&]
+        { return walkLines(lines, [](const std::string &b, size_t pos)
+                           { return b.find('\n', pos); }); });
+    run(scanImplName(), lines, 20, [&]
+        { return walkLines(lines, [](const std::string &b, size_t pos)
+                           { size_t e = findByte(b.data() + pos, b.size() - pos, '\n');
+                             return e == kScanNotFound ? e : e + pos; }); });
+    return 0;
+}
@@ -0,0 +1,101 @@
+// zset跳表的微基准：大zset上的插入(ZADD)、按排名取范围(ZRANGE)、整表遍历(快照)和计数器式的小幅加分(ZINCRBY)
+// 构建：cmake -DMYREDIS_BUILD_BENCH=ON，然后运行 ./bench_skiplist [元素个数...]，默认1M 2M
+#include "../include/kv.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+using namespace myredis;
+
+template <class Fn>
+static void run(const char *name, size_t ops, Fn fn)
+{
+    auto begin = std::chrono::steady_clock::now();
+    size_t result = fn();
+    auto end = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(end - begin).count();
+    std::printf("  %-24s %8.1f ns/op  (%zu)\n", name, sec * 1e9 / static_cast<double>(ops), result);
+}
+static void bench(size_t n)
+{
+    std::mt19937_64 rng(42);
+    // 排行榜那样的member：较短的玩家id，分数随机
+    std::vector<std::pair<double, std::string>> items;
+    items.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        items.emplace_back(static_cast<double>(rng() % 1000000), "player:" + std::to_string(i));
+    std::printf("%zu members\n", n);
+    Skiplist sl;
+    run("insert", n, [&]
+        {
+        size_t added = 0;
+        for (const auto &[score, member] : items)
+            added += sl.insert(score, member);
+        return added; });
+    const size_t kRanges = 200000;
+    run("rangeByRank 10", kRanges, [&]
+        {
+        std::vector<std::string> out;
+        size_t total = 0;
+        for (size_t i = 0; i < kRanges; i++)
+        {
+            out.clear();
+            int64_t start = static_cast<int64_t>(rng() % n);
+            sl.rangeByRank(start, start + 9, out);
+            total += out.size();
+        }
+        return total; });
+    run("full scan", n, [&]
+        {
+        std::vector<std::pair<double, std::string>> out;
+        sl.toVector(out);
+        return out.size(); });
+    // 排行榜上大多数写是给某个玩家加一点分，对比原地更新和先删后插
+    // 加0.001时新分数基本还在前后两个节点之间，加1时在这个分数密度下通常要越过相邻节点
+    const size_t kIncrs = 1000000;
+    std::vector<size_t> who(kIncrs);
+    for (auto &w : who)
+        w = static_cast<size_t>(rng() % n);
+    for (double delta : {0.001, 1.0})
+    {
+        std::string suffix = delta < 1 ? " +0.001" : " +1";
+        run(("updateScore" + suffix).c_str(), kIncrs, [&]
+            {
+            for (size_t w : who)
+            {
+                auto &[score, member] = items[w];
+                sl.updateScore(score, member, score + delta);
+                score += delta;
+            }
+            return sl.size(); });
+        run(("erase+insert" + suffix).c_str(), kIncrs, [&]
+            {
+            for (size_t w : who)
+            {
+                auto &[score, member] = items[w];
+                sl.erase(score, member);
+                sl.insert(score + delta, member);
+                score += delta;
+            }
+            return sl.size(); });
+    }
+    run("erase", n, [&]
+        {
+        size_t removed = 0;
+        for (const auto &[score, member] : items)
+            removed += sl.erase(score, member);
+        return removed; });
+}
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {1000000, 2000000};
+    for (size_t n : sizes)
+        bench(n);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include"config.h"
 #include<atomic>
 #include<string>
+#include<string_view>
 #include<thread>
 #include<mutex>
 #include<condition_variable>
@@ -17,7 +18,7 @@ namespace myredis{
         ~AofLogger();
         void shutdown();
         bool init(const AofOptions& opt,std::string& err);
-        bool appendRaw(const std::string& raw);
+        bool appendRaw(std::string_view raw);
         bool appendCommand(const std::vector<std::string>& command);
         bool isEnabled()const{return _opt._enabled;}
         bool bgRewrite(KeyValueStore& store,std::string& err);
@@ -45,13 +45,64 @@ namespace myredis
         uint16_t _masterPort = 0;     // 主节点port
     };
 
+    // 新连接分发给reactor线程的策略
+    enum IoDispatch
+    {
+        RoundRobin = 0, // 轮询分发
+        LeastConn       // 分发给当前连接数最少的reactor
+    };
+    // 网络I/O后端
+    enum IoBackend
+    {
+        Epoll = 0, // epoll + recv + writev
+        Uring      // io_uring，需要编译时打开MYREDIS_ENABLE_IO_URING
+    };
+    // 网络I/O选项参数
+    struct NetOptions
+    {
+        int _ioThreads = 1;                            // reactor线程数，1表示所有连接都在主线程的事件循环上处理
+        IoDispatch _dispatch = IoDispatch::RoundRobin; // 新连接的分发策略
+        bool _reusePort = false;                       // 每个reactor各开一个SO_REUSEPORT监听fd，由内核分发连接
+        IoBackend _backend = IoBackend::Epoll;         // 网络I/O后端
+        bool _pipeline = true;                         // 一次读事件里的命令全部执行完再统一回复，关闭后每条命令执行完立即发送
+    };
+
+    // 内存达到maxmemory之后的淘汰策略，和redis的maxmemory-policy一样
+    // allkeys-*在所有key中挑选，volatile-*只在设置了过期时间的key中挑选
+    enum MaxmemoryPolicy
+    {
+        NoEviction = 0, // 不淘汰，会增加内存的写命令直接返回OOM错误
+        AllKeysLru,     // 最久没有访问的
+        AllKeysLfu,     // 访问频率最低的
+        AllKeysRandom,
+        VolatileLru,
+        VolatileLfu,
+        VolatileRandom,
+        VolatileTtl // 最早过期的
+    };
+    // 键空间数据结构选项参数
+    struct StoreOptions
+    {
+        size_t _hashMaxListpackEntries = 128; // hash的字段数不超过这个值时使用紧凑的listpack编码
+        size_t _hashMaxListpackValue = 64;    // hash的field和value长度都不超过这个值时使用listpack编码
+        int _activeExpireCpuPercent = 25;     // 每个定时周期里定期删除最多占用周期时长的百分比
+        int _activeExpireStalePercent = 10;   // 一轮弹出的到期项不超过满额的这个百分比时结束本周期的定期删除
+        size_t _maxmemory = 0;                // 内存上限(字节)，0表示不限制
+        MaxmemoryPolicy _maxmemoryPolicy = MaxmemoryPolicy::NoEviction;
+        int _maxmemorySamples = 5;            // 每淘汰一个key之前取样的key数，越大越接近精确的LRU/LFU
+        bool _lazyfreeLazyExpire = false;     // 过期删除的大value交给后台线程释放，和redis的lazyfree-lazy-expire一样
+    };
+
     // 服务配置类
     struct ServerConfig
     {
         uint16_t _port = 6379;             // 服务端口号
         std::string _bindAddr = "0.0.0.0"; // 绑定地址
+        int _hz = 10;                      // 定时任务(定期删除、字典搬迁)每秒执行的次数
         AofOptions _aof;
         RdbOptions _rdb;
         ReplicaOptions _replica;
+        NetOptions _net;
+        StoreOptions _store;
     };
 }
@@ -2,4 +2,9 @@
 #include"config.h"
 namespace myredis{
     bool loadConfigFromFile(const std::string &path, ServerConfig &cfg, std::string &err);
+    //解析"100mb"、"1gb"、"4096"这样的内存大小，单位支持b、k、kb、m、mb、g、gb(不区分大小写，都按1024进位)
+    bool parseMemorySize(const std::string &val, size_t &out);
+    //maxmemory-policy的名字和枚举互相转换，名字和redis一样，比如"allkeys-lru"
+    bool parseMaxmemoryPolicy(const std::string &val, MaxmemoryPolicy &out);
+    const char *maxmemoryPolicyName(MaxmemoryPolicy policy);
 }
\ No newline at end of file
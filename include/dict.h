@@ -0,0 +1,326 @@
+#pragma once
+#include<cstddef>
+#include<cstdint>
+#include<cstring>
+#include<functional>
+#include<new>
+#include<string>
+#include<string_view>
+#include<utility>
+#if defined(__SSE2__)
+#include<emmintrin.h>
+#endif
+namespace myredis{
+    //键空间使用的开放寻址哈希表，布局和swiss table一样：
+    //每个槽位对应一个控制字节，空槽是kCtrlEmpty，删除过的槽是kCtrlDeleted，占用的槽保存哈希值的低7位(h2)
+    //控制字节按16个一组，查找时用SSE2一次比较一整组的h2，只有h2相同的槽才去比较key，整组里有空槽就说明key不存在
+    //槽位里只放一个指针，指向一块同时装着value和key字节的内存(Entry)，一个key只分配一次内存，
+    //value里能内嵌的短数据(比如短string)也就和key放在同一块内存里。槽位只有8字节，刚扩容后装载因子较低时浪费也很少
+    //查找可以直接用string_view，不需要先构造std::string；value的地址在扩容搬迁时不变
+    //扩容是渐进式的：装载因子超限时只分配新表，旧表里的元素由之后的每次插入、删除各搬迁kRehashGroupsPerOp组，
+    //定时器再通过rehashGroups()批量搬迁，和redis的dictRehashStep一样，任何一次操作都不会一次性搬迁整张表
+    //搬迁期间一个key只会在其中一张表里，查找依次看新旧两张表，新插入的key总是进新表
+    template<class V>
+    class Dict{
+    public:
+        Dict()=default;
+        ~Dict(){
+            release(_tables[0]);
+            release(_tables[1]);
+        }
+        Dict(const Dict&)=delete;
+        Dict& operator=(const Dict&)=delete;
+        //移动只交换表指针，O(1)，FLUSHALL ASYNC用它把整张表交给后台线程释放
+        Dict(Dict&& o)noexcept{steal(o);}
+        Dict& operator=(Dict&& o)noexcept{
+            if(this!=&o){
+                release(_tables[0]);
+                release(_tables[1]);
+                steal(o);
+            }
+            return *this;
+        }
+        static size_t hashOf(std::string_view key){return std::hash<std::string_view>{}(key);}
+        size_t size()const{return _tables[0]._size+_tables[1]._size;}
+        bool empty()const{return size()==0;}
+        size_t capacity()const{return _tables[0]._capacity+_tables[1]._capacity;}
+        bool isRehashing()const{return _tables[1]._ctrl!=nullptr;}
+        //槽位数组和控制字节占用的内存，搬迁中时包括两张表，不包括元素本身
+        size_t tableBytes()const{return capacity()*(sizeof(Entry*)+1);}
+        //找到返回value指针，找不到返回nullptr，指针在这个key被删除之前一直有效
+        V* find(std::string_view key){return find(key,hashOf(key));}
+        V* find(std::string_view key,size_t hash){
+            for(Table& t:_tables){
+                size_t idx=findIndex(t,key,hash);
+                if(idx!=kNotFound)
+                    return &t._slots[idx]->_value;
+            }
+            return nullptr;
+        }
+        //key不存在时插入一个默认构造的value，返回value指针和是否新插入
+        std::pair<V*,bool> tryEmplace(std::string_view key){return tryEmplace(key,hashOf(key));}
+        std::pair<V*,bool> tryEmplace(std::string_view key,size_t hash){
+            if(isRehashing())
+                rehashGroups(kRehashGroupsPerOp);
+            if(V* v=find(key,hash))
+                return {v,false};
+            if(!isRehashing()&&_tables[0]._size+_tables[0]._deleted+1>maxLoad(_tables[0]._capacity))
+                startRehash();
+            //搬迁中新表也满了(插入远快于搬迁时才会发生)，只能先把这一轮搬完再开始下一轮
+            Table* t=&_tables[isRehashing()?1:0];
+            if(isRehashing()&&t->_size+t->_deleted+1>maxLoad(t->_capacity)){
+                rehashGroups(~size_t{0});
+                startRehash();
+                t=&_tables[isRehashing()?1:0];
+            }
+            size_t idx=findInsertSlot(*t,hash);
+            if(t->_ctrl[idx]==kCtrlDeleted)
+                --t->_deleted;
+            t->_ctrl[idx]=h2(hash);
+            t->_slots[idx]=newEntry(key);
+            ++t->_size;
+            return {&t->_slots[idx]->_value,true};
+        }
+        V& operator[](std::string_view key){return *tryEmplace(key).first;}
+        bool erase(std::string_view key){return erase(key,hashOf(key));}
+        bool erase(std::string_view key,size_t hash){
+            if(isRehashing())
+                rehashGroups(kRehashGroupsPerOp);
+            for(Table& t:_tables){
+                size_t idx=findIndex(t,key,hash);
+                if(idx!=kNotFound){
+                    eraseAt(t,idx);
+                    return true;
+                }
+            }
+            return false;
+        }
+        //从旧表搬迁最多n组到新表，返回是否还在搬迁中，定时器用它在空闲时推进搬迁
+        bool rehashGroups(size_t n){
+            if(!isRehashing())
+                return false;
+            Table& from=_tables[0];
+            size_t groups=from._capacity/kGroupWidth;
+            for(;n>0&&_rehashGroup<groups;n--,_rehashGroup++){
+                size_t base=_rehashGroup*kGroupWidth;
+                for(size_t i=base;i<base+kGroupWidth;i++){
+                    if(!isFull(from._ctrl[i]))
+                        continue;
+                    moveSlot(from,i,_tables[1]);
+                }
+            }
+            if(_rehashGroup<groups)
+                return true;
+            //旧表已经搬空，新表成为主表
+            release(from);
+            from=_tables[1];
+            _tables[1]=Table{};
+            _rehashGroup=0;
+            return false;
+        }
+        void clear(){
+            release(_tables[0]);
+            release(_tables[1]);
+            _tables[0]=Table{};
+            _tables[1]=Table{};
+            _rehashGroup=0;
+        }
+        //遍历所有元素，fn(std::string_view key,V& value)，遍历过程中不能插入或删除
+        template<class Fn>
+        void forEach(Fn&& fn){
+            for(Table& t:_tables){
+                for(size_t i=0;i<t._capacity;i++){
+                    if(isFull(t._ctrl[i]))
+                        fn(t._slots[i]->key(),t._slots[i]->_value);
+                }
+            }
+        }
+        template<class Fn>
+        void forEach(Fn&& fn)const{
+            for(const Table& t:_tables){
+                for(size_t i=0;i<t._capacity;i++){
+                    if(isFull(t._ctrl[i]))
+                        fn(t._slots[i]->key(),static_cast<const V&>(t._slots[i]->_value));
+                }
+            }
+        }
+        //从第start个槽位(对总槽数取模)开始顺序往后看，把遇到的元素交给fn(std::string_view key,V& value)，最多count个
+        //槽位由哈希决定，相邻的槽位上就是随机的key，maxmemory淘汰用它取样；最多看count*16个槽位，很稀疏的表可能取不满
+        template<class Fn>
+        size_t sample(size_t start,size_t count,Fn&& fn){
+            size_t total=capacity();
+            if(total==0||size()==0)
+                return 0;
+            size_t found=0;
+            size_t pos=start%total;
+            for(size_t n=0;n<count*16&&n<total&&found<count;n++){
+                //搬迁中时把两张表首尾相接看成一张
+                Table& t=pos<_tables[0]._capacity?_tables[0]:_tables[1];
+                size_t i=pos<_tables[0]._capacity?pos:pos-_tables[0]._capacity;
+                if(isFull(t._ctrl[i])){
+                    fn(t._slots[i]->key(),t._slots[i]->_value);
+                    ++found;
+                }
+                if(++pos==total)
+                    pos=0;
+            }
+            return found;
+        }
+    private:
+        static constexpr size_t kGroupWidth=16;
+        //每次插入、删除顺带搬迁的组数，一组16个槽
+        static constexpr size_t kRehashGroupsPerOp=1;
+        static constexpr size_t kNotFound=~size_t{0};
+        static constexpr int8_t kCtrlEmpty=-128;//0b10000000
+        static constexpr int8_t kCtrlDeleted=-2;//0b11111110
+        //value在前，key的字节紧跟在结构体后面，和Entry一起分配
+        struct Entry{
+            V _value;
+            uint32_t _keyLen;
+            std::string_view key()const{return {reinterpret_cast<const char*>(this+1),_keyLen};}
+        };
+        //find返回的value指针就是元素内存块的首地址，统计内存时直接用它
+        static_assert(offsetof(Entry,_value)==0,"value must be the first member of Entry");
+        struct Table{
+            int8_t* _ctrl=nullptr;
+            Entry** _slots=nullptr;
+            size_t _capacity=0;//槽位数，总是kGroupWidth的2的幂倍
+            size_t _size=0;
+            size_t _deleted=0;//标记为删除的槽位数，同样占用装载因子
+        };
+        static bool isFull(int8_t c){return c>=0;}
+        static int8_t h2(size_t hash){return static_cast<int8_t>(hash&0x7f);}
+        static size_t h1(size_t hash){return hash>>7;}
+        //装载因子上限7/8，和swiss table一样，组内比较是并行的，较高的装载因子也不会让查找变慢很多
+        static size_t maxLoad(size_t capacity){return capacity-capacity/8;}
+        //一组16个控制字节里等于b的位置，第i位为1表示第i个槽匹配
+        static uint32_t matchByte(const int8_t* group,int8_t b){
+#if defined(__SSE2__)
+            __m128i ctrl=_mm_load_si128(reinterpret_cast<const __m128i*>(group));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl,_mm_set1_epi8(b))));
+#else
+            uint32_t mask=0;
+            for(size_t i=0;i<kGroupWidth;i++)
+                if(group[i]==b)mask|=1u<<i;
+            return mask;
+#endif
+        }
+        //空槽或删除过的槽，也就是控制字节最高位为1的槽
+        static uint32_t matchEmptyOrDeleted(const int8_t* group){
+#if defined(__SSE2__)
+            __m128i ctrl=_mm_load_si128(reinterpret_cast<const __m128i*>(group));
+            return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+            uint32_t mask=0;
+            for(size_t i=0;i<kGroupWidth;i++)
+                if(group[i]<0)mask|=1u<<i;
+            return mask;
+#endif
+        }
+        //按组做三角数探测：第0、1、3、6...组，组数是2的幂时能遍历到所有组
+        static size_t findIndex(const Table& t,std::string_view key,size_t hash){
+            if(t._capacity==0)
+                return kNotFound;
+            size_t groupMask=t._capacity/kGroupWidth-1;
+            size_t g=h1(hash)&groupMask;
+            int8_t tag=h2(hash);
+            for(size_t step=1;;step++){
+                const int8_t* group=t._ctrl+g*kGroupWidth;
+                for(uint32_t m=matchByte(group,tag);m;m&=m-1){
+                    size_t idx=g*kGroupWidth+static_cast<size_t>(__builtin_ctz(m));
+                    if(t._slots[idx]->key()==key)
+                        return idx;
+                }
+                if(matchByte(group,kCtrlEmpty))
+                    return kNotFound;
+                g=(g+step)&groupMask;
+            }
+        }
+        static size_t findInsertSlot(const Table& t,size_t hash){
+            size_t groupMask=t._capacity/kGroupWidth-1;
+            size_t g=h1(hash)&groupMask;
+            for(size_t step=1;;step++){
+                uint32_t m=matchEmptyOrDeleted(t._ctrl+g*kGroupWidth);
+                if(m)
+                    return g*kGroupWidth+static_cast<size_t>(__builtin_ctz(m));
+                g=(g+step)&groupMask;
+            }
+        }
+        static void eraseAt(Table& t,size_t idx){
+            deleteEntry(t._slots[idx]);
+            //所在组里还有空槽，说明从来没有key探测越过这一组，可以直接标成空槽，否则只能标成删除
+            const int8_t* group=t._ctrl+(idx&~(kGroupWidth-1));
+            if(matchByte(group,kCtrlEmpty))
+                t._ctrl[idx]=kCtrlEmpty;
+            else{
+                t._ctrl[idx]=kCtrlDeleted;
+                ++t._deleted;
+            }
+            --t._size;
+        }
+        //搬迁只移动Entry指针。旧表的槽位直接标成删除，旧表整组扫描完之后会被整体释放，不需要维护它的探测链
+        static void moveSlot(Table& from,size_t i,Table& to){
+            size_t hash=hashOf(from._slots[i]->key());
+            size_t idx=findInsertSlot(to,hash);
+            //搬迁期间新表上也会有删除，复用删除标记的槽位时和tryEmplace一样要把计数减回来
+            if(to._ctrl[idx]==kCtrlDeleted)
+                --to._deleted;
+            to._ctrl[idx]=h2(hash);
+            to._slots[idx]=from._slots[i];
+            ++to._size;
+            from._ctrl[i]=kCtrlDeleted;
+            ++from._deleted;
+            --from._size;
+        }
+        //删除标记较多时新表用原容量即可清掉它们，否则容量翻倍
+        void startRehash(){
+            const Table& t=_tables[0];
+            size_t newCap=t._capacity==0?kGroupWidth:(t._size*2>=t._capacity?t._capacity*2:t._capacity);
+            _tables[1]=allocate(newCap);
+            _rehashGroup=0;
+            //空表或很小的表直接搬完，免得一直留着两张表
+            if(t._size==0||newCap<=kGroupWidth*4)
+                rehashGroups(~size_t{0});
+        }
+        static Entry* newEntry(std::string_view key){
+            void* mem=::operator new(sizeof(Entry)+key.size());
+            Entry* e=new(mem) Entry{V{},static_cast<uint32_t>(key.size())};
+            std::memcpy(reinterpret_cast<char*>(e+1),key.data(),key.size());
+            return e;
+        }
+        static void deleteEntry(Entry* e){
+            e->~Entry();
+            ::operator delete(static_cast<void*>(e));
+        }
+        static Table allocate(size_t capacity){
+            Table t;
+            t._ctrl=static_cast<int8_t*>(::operator new(capacity,std::align_val_t{kGroupWidth}));
+            std::memset(t._ctrl,kCtrlEmpty,capacity);
+            t._slots=static_cast<Entry**>(::operator new(capacity*sizeof(Entry*)));
+            t._capacity=capacity;
+            return t;
+        }
+        static void release(Table& t){
+            if(!t._ctrl)
+                return;
+            //搬迁完的旧表已经没有元素，不用再扫一遍控制字节
+            for(size_t i=0;t._size>0&&i<t._capacity;i++){
+                if(isFull(t._ctrl[i]))
+                    deleteEntry(t._slots[i]);
+            }
+            ::operator delete(t._ctrl,std::align_val_t{kGroupWidth});
+            ::operator delete(static_cast<void*>(t._slots));
+        }
+        //_tables[0]是主表，_tables[1]只在搬迁期间存在
+        void steal(Dict& o){
+            _tables[0]=o._tables[0];
+            _tables[1]=o._tables[1];
+            _rehashGroup=o._rehashGroup;
+            o._tables[0]=Table{};
+            o._tables[1]=Table{};
+            o._rehashGroup=0;
+        }
+        Table _tables[2];
+        size_t _rehashGroup=0;//旧表中下一个要搬迁的组
+    };
+}
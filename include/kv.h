@@ -1,13 +1,24 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include<optional>
 #include <memory>
 #include <vector>
 #include<mutex>
+#include<array>
+#include<atomic>
+#include<cstdint>
+#include<cstring>
+#include<stdexcept>
+#include"config.h"
+#include"dict.h"
+#include"listpack.h"
+#include"lazyfree.h"
 namespace myredis
 {
     // key-value数据结构
+    // ValueRecord和HashRecord是快照导出的格式，rdb保存和aof重写使用
 
     struct ValueRecord
     {
@@ -19,51 +30,281 @@ namespace myredis
         std::unordered_map<std::string, std::string> _hashTable;
         int64_t _expireAtMs = -1;
     };
+    // 跳表节点只占一块内存：节点头后面紧跟_levelCount个Level，再后面是member的字节
+    // 查找时读完分数和下一跳就能顺着走，不需要再跳到单独分配的层数组和member字符串上
     struct SkiplistNode
     {
+        // 每一层的下一跳，以及沿这一层走到下一跳一共跨过几个第0层节点(span)，沿途把span加起来就是节点的排名
+        struct Level
+        {
+            SkiplistNode *_forward;
+            size_t _span;
+        };
         double _score;
-        std::string _member;
-        std::vector<SkiplistNode *> _forward;
-        SkiplistNode(int level, double sc, const std::string &mem) : _score{sc}, _member{mem}, _forward{static_cast<size_t>(level), nullptr} {}
+        uint32_t _memberLen;
+        uint8_t _levelCount;
+        Level &level(size_t i) { return reinterpret_cast<Level *>(this + 1)[i]; }
+        const Level &level(size_t i) const { return reinterpret_cast<const Level *>(this + 1)[i]; }
+        char *memberData() { return reinterpret_cast<char *>(this + 1) + _levelCount * sizeof(Level); }
+        std::string_view member() const { return {reinterpret_cast<const char *>(this + 1) + _levelCount * sizeof(Level), _memberLen}; }
+        static size_t allocSize(size_t levelCount, size_t memberLen) { return sizeof(SkiplistNode) + levelCount * sizeof(Level) + memberLen; }
+        size_t allocSize() const { return allocSize(_levelCount, _memberLen); }
+    };
+    // zset的分数区间，和redis一样端点前加'('表示开区间，支持-inf和+inf
+    struct ScoreRange
+    {
+        double _min = 0;
+        double _max = 0;
+        bool _minex = false;
+        bool _maxex = false;
+        bool aboveMin(double s) const { return _minex ? s > _min : s >= _min; }
+        bool belowMax(double s) const { return _maxex ? s < _max : s <= _max; }
+        bool empty() const { return _min > _max || (_min == _max && (_minex || _maxex)); }
+    };
+    // 解析ZRANGEBYSCORE等命令的min、max参数，格式不对返回false
+    bool parseScoreRange(std::string_view min, std::string_view max, ScoreRange &out);
+    // 解析一个分数，支持-inf、+inf，不接受NaN
+    bool parseScore(std::string_view s, double &out);
+    // 把分数格式化成能原样解析回同一个double的最短字符串，回复、RDB和AOF重写都用它，无穷大写成inf、-inf
+    std::string formatScore(double score);
+    // ZADD的选项，含义和redis一样
+    enum ZaddFlag : int
+    {
+        kZaddNx = 1 << 0,   // 只添加新member
+        kZaddXx = 1 << 1,   // 只更新已有member，key不存在时也不会创建
+        kZaddGt = 1 << 2,   // 新分数比原分数大才更新，不影响添加新member
+        kZaddLt = 1 << 3,   // 新分数比原分数小才更新
+        kZaddCh = 1 << 4,   // 回复新增加上分数有变化的个数，只影响回复
+        kZaddIncr = 1 << 5, // 给的是增量而不是分数，只能带一对score member，ZINCRBY就是ZADD INCR
+    };
+    // 解析ZADD key后面的参数(从args[pos]开始)：先是若干个选项，然后是score member对
+    // 成功返回nullptr，失败返回要回复给客户端的错误信息
+    const char *parseZaddArgs(const std::vector<std::string_view> &args, size_t pos, int &flags, std::vector<std::pair<double, std::string>> &items);
+    struct ZaddResult
+    {
+        int _added = 0;   // 新增的member个数
+        int _updated = 0; // 分数有变化的已有member个数
+        // 最后一个被处理的member的新分数，被NX、XX、GT、LT跳过时为空，INCR用它回复
+        std::optional<double> _score;
+        bool _nan = false; // INCR的结果是NaN(例如+inf加-inf)，这时不做修改
+    };
+    // 跳表节点的内存池，每个跳表一个：按块向系统申请内存，节点从块里顺序切出来，相邻插入的节点在内存里也相邻
+    // 释放的节点按kAlign对齐后的大小挂到对应的空闲链表上，之后同样大小的节点直接复用；超过kMaxSmall的节点直接向系统申请
+    // 块只在跳表销毁时整体归还
+    class SkiplistArena
+    {
+    public:
+        SkiplistArena() = default;
+        ~SkiplistArena();
+        SkiplistArena(const SkiplistArena &) = delete;
+        SkiplistArena &operator=(const SkiplistArena &) = delete;
+        void *allocate(size_t size);
+        void deallocate(void *p, size_t size);
+        // 向系统申请的内存：所有块加上单独申请的大节点，空闲链表上的节点也算在内
+        size_t bytes() const { return _bytes; }
+
+    private:
+        static constexpr size_t kAlign = 16;
+        static constexpr size_t kMaxSmall = 512;
+        static constexpr size_t kMinChunk = 4 * 1024;   // 刚转成跳表的zset只有一百多个元素，第一块不用太大
+        static constexpr size_t kMaxChunk = 256 * 1024; // 之后每块翻倍，直到这个上限
+        std::vector<char *> _chunks;
+        char *_cur = nullptr;
+        size_t _left = 0;
+        size_t _nextChunk = kMinChunk;
+        void *_free[kMaxSmall / kAlign + 1] = {}; // 空闲块的前8字节存链表的下一项
+        size_t _bytes = 0;
     };
     struct Skiplist
     {
     public:
         Skiplist();
-        ~Skiplist()=default;
+        ~Skiplist();
+        Skiplist(const Skiplist&)=delete;
+        Skiplist& operator=(const Skiplist&)=delete;
         void toVector(std::vector<std::pair<double,std::string>>& out)const;
-        bool insert(double score,const std::string& member);
-        bool erase(double score,const std::string& member);
+        bool insert(double score,std::string_view member);
+        bool erase(double score,std::string_view member);
+        //把{curScore,member}的分数改成newScore，节点不存在时返回false
+        //新分数不改变节点在前后节点之间的顺序时原地修改，否则摘下节点按新分数重新链接，两种情况都不重新分配节点
+        bool updateScore(double curScore,std::string_view member,double newScore);
         size_t size()const{return _length;}
+        //节点占用的内存，包括头节点
+        size_t memoryBytes()const{return _arena.bytes();}
         void rangeByRank(int64_t start,int64_t stop,std::vector<std::string>& out)const;
+        //{score,member}的排名，从1开始，不存在时返回0
+        size_t rankOf(double score,std::string_view member)const;
+        //第rank个节点(从1开始)，超出范围返回nullptr，和rankOf一样只需要O(log n)
+        const SkiplistNode* nodeByRank(size_t rank)const;
+        //分数小于score(inclusive为true时小于等于)的节点个数，O(log n)
+        size_t countLess(double score,bool inclusive)const;
+        //删除分数落在range内的所有节点，被删除的member追加到removed，返回删除个数
+        size_t eraseRangeByScore(const ScoreRange& range,std::vector<std::string>& removed);
     private:
         static constexpr int kMaxLevel = 32;//最大层数
         int randLevel();
+        SkiplistNode* createNode(int level,double score,std::string_view member);
+        void freeNode(SkiplistNode* node);
+        void unlinkNode(SkiplistNode* x,SkiplistNode** update);
+        void linkNode(SkiplistNode* x,SkiplistNode** update,size_t* rank);
+        //从顶层往下找到每一层最后一个小于{score,member}的节点和它的排名，返回第0层第一个不小于{score,member}的节点
+        SkiplistNode* findPredecessors(double score,std::string_view member,SkiplistNode** update,size_t* rank)const;
         static constexpr double kProbability = 0.25;
+        SkiplistArena _arena;//必须在_head之前构造
         SkiplistNode *_head;
         int _level;//当前层数
         size_t _length;//实际数据节点不包含头节点(跳表容器)
     };
 
-    // 这是zset的数据结构对外接口
+    // zset的数据部分，元素较少时用有序vector，超过kZsetVectorPeak个元素后转成跳表
     struct ZsetRecord
     {
-        // 是否使用跳表数据结构标志位
-        bool _useSkipList = false;
         std::vector<std::pair<double, std::string>> _items; // 当数据量较小时使用vector作为底层容器
 
         std::unique_ptr<Skiplist> _skiplist;                    // 跳表数据结构指针
         std::unordered_map<std::string, double> _memberToScore; // 根据member找到score
+    };
+    enum class ObjectType : uint8_t
+    {
+        String,
+        Hash,
+        Zset
+    };
+    enum class ObjectEncoding : uint8_t
+    {
+        Int,        // string：值是规范格式的int64，直接存8字节整数
+        Embstr,     // string：不超过kEmbstrMax字节的短值，直接存在对象里
+        Raw,        // string：较长的值，对象里存堆上std::string的指针
+        Listpack,   // hash：字段较少较短时使用的紧凑编码
+        HashTable,  // hash：unordered_map
+        ZsetVector, // zset：有序vector
+        Skiplist    // zset：跳表
+    };
+    using HashMap = std::unordered_map<std::string, std::string>;
+    // 键空间中的一个值：类型、编码、过期时间都放在这里，一个key只对应一个对象
+    // 对象固定48字节，和key一起放在字典的槽位里。数据区按编码解释：短string和整数直接放在数据区，
+    // 不需要为value再分配一次堆内存，长string、hash、zset在数据区里放堆指针
+    // _lru是maxmemory淘汰用的24位访问信息，从数据区里挪出3字节，对象大小不变
+    constexpr size_t kEmbstrMax = 34;
+    struct KeyObject
+    {
+        KeyObject() = default;
+        ~KeyObject() { release(); }
+        KeyObject(const KeyObject &) = delete;
+        KeyObject &operator=(const KeyObject &) = delete;
+        KeyObject(KeyObject &&other) noexcept;
+        KeyObject &operator=(KeyObject &&other) noexcept;
+        // 释放旧数据，按值选择Int、Embstr或Raw编码保存string
+        void setString(std::string_view value);
+        std::string stringValue() const;
+        // 释放旧数据，换成一个空的hash(listpack编码)或zset
+        void makeHash();
+        void makeZset();
+        // listpack编码的hash转成哈希表编码，只会单向转换
+        void convertHashToTable();
+        // 值在堆上占用的内存，不包括对象本身(它和key一起放在字典的元素里)
+        // hash和zset只统计前samples个元素，按平均值乘以元素个数估算，samples为0时逐个统计，和redis的MEMORY USAGE一样
+        size_t memoryUsage(size_t samples) const;
+        Listpack *listpack() const { return ptr<Listpack>(); }
+        HashMap *hash() const { return ptr<HashMap>(); }
+        ZsetRecord *zset() const { return ptr<ZsetRecord>(); }
+        // LRU策略下是最近一次访问的秒级时钟，LFU策略下高16位是上次衰减的分钟数，低8位是对数计数器
+        uint32_t lru() const { return uint32_t{_lru[0]} | uint32_t{_lru[1]} << 8 | uint32_t{_lru[2]} << 16; }
+        void setLru(uint32_t v)
+        {
+            _lru[0] = static_cast<uint8_t>(v);
+            _lru[1] = static_cast<uint8_t>(v >> 8);
+            _lru[2] = static_cast<uint8_t>(v >> 16);
+        }
+
         int64_t _expireAtMs = -1;
+        char _payload[kEmbstrMax];
+        uint8_t _lru[3] = {};
+        ObjectType _type = ObjectType::String;
+        ObjectEncoding _encoding = ObjectEncoding::Embstr;
+        uint8_t _embLen = 0; // Embstr编码时的长度
+
+    private:
+        // 数据区不保证指针对齐，统一用memcpy读写
+        template <class T>
+        T *ptr() const
+        {
+            T *p;
+            std::memcpy(&p, _payload, sizeof(p));
+            return p;
+        }
+        void setPtr(void *p) { std::memcpy(_payload, &p, sizeof(p)); }
+        // 释放堆上的数据，对象变回空string
+        void release();
+        void takeFrom(KeyObject &other);
+    };
+    static_assert(sizeof(KeyObject) == 48, "KeyObject layout");
+    // 对已存在的key执行类型不符的操作时抛出，比如对一个hash执行GET，由命令层统一回复WRONGTYPE错误
+    struct WrongTypeError : std::runtime_error
+    {
+        WrongTypeError() : std::runtime_error{"WRONGTYPE Operation against a key holding the wrong kind of value"} {}
+    };
+    // 过期删除的累计统计，INFO里展示
+    struct ExpireStats
+    {
+        uint64_t _expiredKeys = 0;    // 因过期被删除的key数，包括访问时发现已过期的
+        uint64_t _staleEntries = 0;   // 过期索引里弹出后发现已经失效(删除、PERSIST或延长过)的项数
+        uint64_t _timeCapReached = 0; // 用完时间预算还有key没删完的周期数
+        uint64_t _cycleUs = 0;        // 定期删除累计耗时
+    };
+    // MEMORY STATS用的键空间内存统计
+    struct KeyspaceMemory
+    {
+        size_t _keys = 0;
+        size_t _expires = 0;          // 带过期时间的key数
+        size_t _tableBytes = 0;       // 各分片字典的槽位数组和控制字节
+        size_t _expireIndexBytes = 0; // 各分片的过期索引
+        // 按ObjectType下标的key数和占用的内存(字典元素和值)，每个分片取样估算，小分片是精确值
+        size_t _typeKeys[3] = {};
+        size_t _typeBytes[3] = {};
     };
+    // performEvictions的结果
+    enum class EvictStatus : uint8_t
+    {
+        Ok,      // 没有超过maxmemory，或者已经淘汰到maxmemory以下
+        Running, // 用完了时间预算还没降下来，剩下的留给之后的命令和定时器
+        Fail     // 超过了maxmemory但没有可以淘汰的key(noeviction，或volatile-*策略下没有带过期时间的key)
+    };
+    //单个key的接口直接接收网络层解析出的string_view，只在真正需要存储或查找时才构造std::string
+    //所有类型共用一个键空间，每条命令只查一次字典，key的类型和命令不符时抛出WrongTypeError
     class KeyValueStore{
     public:
+        void setOptions(const StoreOptions& opt);
         int expireScanStep(int maxStep);
-        void clearAll();
+        //定时器每个周期调用一次的定期删除，最多花budgetUs微秒，到期的key较多时一轮接一轮地删
+        //删掉的key名追加到expired里，由调用方作为DEL写进AOF和复制流
+        void activeExpireCycle(int64_t budgetUs,std::vector<std::string>& expired);
+        ExpireStats expireStats()const;
+        //定时器调用，推进字典的渐进式搬迁，返回是否还有分片在搬迁中
+        bool rehashStep(int64_t budgetUs);
+        //async为true时是FLUSHALL ASYNC：每个分片只把整张字典和过期索引换成空的，旧的交给后台线程释放
+        void clearAll(bool async=false);
+        //maxmemory的三个参数可以用CONFIG SET在运行时修改
+        void setMaxmemory(size_t bytes){_maxmemory.store(bytes,std::memory_order_relaxed);}
+        void setMaxmemoryPolicy(MaxmemoryPolicy policy){_maxmemoryPolicy.store(policy,std::memory_order_relaxed);}
+        void setMaxmemorySamples(int samples){_maxmemorySamples.store(samples,std::memory_order_relaxed);}
+        size_t maxmemory()const{return _maxmemory.load(std::memory_order_relaxed);}
+        MaxmemoryPolicy maxmemoryPolicy()const{return _maxmemoryPolicy.load(std::memory_order_relaxed);}
+        int maxmemorySamples()const{return _maxmemorySamples.load(std::memory_order_relaxed);}
+        //已用内存超过maxmemory时按策略淘汰key，直到降到maxmemory以下或者用完budgetUs微秒
+        //被淘汰的key追加到evicted，由调用方作为DEL写aof和复制给从节点
+        EvictStatus performEvictions(int64_t budgetUs,std::vector<std::string>& evicted);
+        uint64_t evictedKeys()const{return _statEvictedKeys.load(std::memory_order_relaxed);}
+        //key和值占用的内存，包括字典里的元素和槽位，key不存在时返回空；不算作一次访问，不影响淘汰
+        std::optional<size_t> memoryUsage(std::string_view key,size_t samples);
+        //逐个分片短暂加锁统计，每个分片只取样固定个数的key，和键空间大小无关
+        KeyspaceMemory memoryStats();
         bool setWithExpireAtMs(const std::string& key,const std::string& value,int64_t expireAtMs);
-        bool exists(const std::string& key);
-        int64_t ttl(const std::string& key);
-        bool expire(const std::string& key,int64_t ttlSec);
+        //给已存在的任意类型的key设置绝对过期时间，rdb加载hash、zset时使用
+        bool setExpireAtMs(const std::string& key,int64_t expireAtMs);
+        bool exists(std::string_view key);
+        int64_t ttl(std::string_view key);
+        bool expire(std::string_view key,int64_t ttlSec);
         std::vector<std::pair<std::string,ValueRecord>> snapshot()const;
         std::vector<std::pair<std::string,HashRecord>> snapshotHash()const;
         struct ZsetFlat{
@@ -73,45 +314,112 @@ namespace myredis
         };
         std::vector<ZsetFlat> snapshotZset()const;
         std::vector<std::string> listKeys()const;
-        bool set(const std::string& key,const std::string& value,std::optional<int64_t> ttlMs=std::nullopt);
-        std::optional<std::string> get(const std::string& key);
-        int del(const std::vector<std::string>& keys);
+        bool set(std::string_view key,std::string_view value,std::optional<int64_t> ttlMs=std::nullopt);
+        std::optional<std::string> get(std::string_view key);
+        //lazy为true时是UNLINK：值较大的key只从字典里摘下来，由后台线程释放
+        int del(const std::vector<std::string>& keys,bool lazy=false);
+        size_t lazyfreePending()const{return _lazyfree.pending();}
+        uint64_t lazyfreedObjects()const{return _lazyfree.freed();}
 
         //hash
-        int hset(const std::string& key,const std::vector<std::string>& vec);
-        std::optional<std::string> hget(const std::string& key,const std::string& field);
-        int hdel(const std::string& key,const std::vector<std::string>& fields);
-        bool hexists(const std::string& key,const std::string& field);
-        std::vector<std::string> hgetAll(const std::string& key);
-        int hlen(const std::string& key);
-        bool setHashExpireAtMs(const std::string& key,int64_t expire);
+        int hset(std::string_view key,const std::vector<std::string>& vec);
+        std::optional<std::string> hget(std::string_view key,std::string_view field);
+        int hdel(std::string_view key,const std::vector<std::string>& fields);
+        bool hexists(std::string_view key,std::string_view field);
+        std::vector<std::string> hgetAll(std::string_view key);
+        int hlen(std::string_view key);
         //zset
-        int zadd(const std::string& key,const std::vector<std::pair<double,std::string>>& args);
-        int zrem(const std::string& key,const std::vector<std::string>& members);
-        std::vector<std::string> zrange(const std::string& key,int64_t start,int64_t stop);
-        std::optional<double> zscore(const std::string& key,const std::string& member);
-        bool setZsetExpireAtMs(const std::string& key,int64_t expire);
+        int zadd(std::string_view key,const std::vector<std::pair<double,std::string>>& args);
+        //带ZADD选项的版本，flags是ZaddFlag的组合
+        ZaddResult zadd(std::string_view key,const std::vector<std::pair<double,std::string>>& args,int flags);
+        int zrem(std::string_view key,const std::vector<std::string>& members);
+        std::vector<std::string> zrange(std::string_view key,int64_t start,int64_t stop);
+        std::optional<double> zscore(std::string_view key,std::string_view member);
+        //member的排名，从0开始，reverse为true时按分数从大到小排
+        std::optional<int64_t> zrank(std::string_view key,std::string_view member,bool reverse);
+        //按分数区间取元素，跳过前offset个，最多取count个(count为负数不限制)
+        std::vector<std::pair<double,std::string>> zrangeByScore(std::string_view key,const ScoreRange& range,int64_t offset,int64_t count);
+        int64_t zcount(std::string_view key,const ScoreRange& range);
+        int64_t zremRangeByScore(std::string_view key,const ScoreRange& range);
     private:
-        int zaddBasic(ZsetRecord& record,double score,const std::string& member);
+        //键空间按key的哈希分成kShardCount个分片，每个分片有自己的字典、过期索引和锁
+        //单key命令只锁key所在的分片，不同分片上的命令可以在多个io线程上并行执行，快照和aof重写也只是逐个分片短暂加锁
+        //分片用哈希值的最高几位选择，分片内的Dict用低位，两者互不相关
+        static constexpr size_t kShardBits=4;
+        static constexpr size_t kShardCount=size_t{1}<<kShardBits;
+        //过期索引中的一项，按_when排成最小堆，堆顶就是最早到期的key
+        struct ExpireEntry{
+            int64_t _when;
+            std::string _key;
+            bool operator>(const ExpireEntry& o)const{return _when>o._when;}
+        };
+        struct alignas(64) Shard{
+            Dict<KeyObject> _dict;
+            //过期索引：删除key、PERSIST时不去堆里找对应的项，弹出时再和字典里的_expireAtMs核对，对不上就丢掉
+            //延长过期时间也不插入新项，旧项到时间弹出时按key真正的过期时间放回去，所以每个带过期时间的key在堆里至少有一项不晚于它的过期时间
+            std::vector<ExpireEntry> _expireHeap;
+            size_t _expireCount=0;//带过期时间的key个数，堆里失效的项太多时用它判断要不要重建
+            mutable std::mutex _mutex;
+        };
+        Shard& shardFor(size_t hash){return _shards[hash>>(sizeof(size_t)*8-kShardBits)];}
+        //从分片的过期索引里弹出最多maxStep个到期的项，examined返回弹出的项数，返回真正删除的key数
+        int expireScanShard(Shard& sh,int maxStep,int& examined,std::vector<std::string>* expired);
+        //查找未过期的key，已过期的顺手删除，不存在时返回nullptr
+        KeyObject* lookup(Shard& sh,std::string_view key,size_t hash,int64_t nowMs);
+        //在lookup的基础上检查类型，类型不符时抛出WrongTypeError
+        KeyObject* lookupType(Shard& sh,std::string_view key,size_t hash,int64_t nowMs,ObjectType type);
+        //写命令使用：key不存在(或已过期)时就地创建一个type类型的空对象，只查一次字典
+        KeyObject& lookupOrCreate(Shard& sh,std::string_view key,size_t hash,int64_t nowMs,ObjectType type);
+        void eraseKey(Shard& sh,std::string_view key,size_t hash,bool lazy=false);
+        //key即将从字典里删除：lazy为true并且释放代价超过kLazyfreeThreshold时把值移交给后台线程，对象变成空string
+        void freeValue(KeyObject& obj,bool lazy);
+        //和redis的LAZYFREE_THRESHOLD一样，元素不超过这个数的值直接释放比投递给后台线程更快
+        static constexpr size_t kLazyfreeThreshold=64;
+        void setExpire(Shard& sh,std::string_view key,KeyObject& obj,int64_t expireAtMs);
+        void pushExpire(Shard& sh,std::string_view key,int64_t when);
+        static constexpr size_t kExpireHeapSlack=1024;//堆的大小超过2*_expireCount+kExpireHeapSlack时从字典重建
+        void zaddBasic(KeyObject& obj,double score,const std::string& member,int flags,ZaddResult& res);
+        //访问key时更新淘汰用的访问信息，created表示对象是刚创建的
+        void touch(KeyObject& obj,int64_t nowMs,bool created=false);
+        //淘汰池里的一项，和redis的evictionPoolEntry一样，_idle越大越应该先被淘汰
+        struct EvictCandidate{
+            uint64_t _idle;
+            size_t _shard;
+            std::string _key;
+        };
+        static constexpr size_t kEvictPoolSize=16;
+        static uint64_t evictScore(const KeyObject& obj,MaxmemoryPolicy policy,int64_t nowMs);
+        //从一个分片里取样，放进淘汰池，返回取到的key数
+        size_t evictionPoolPopulate(size_t shardIndex,MaxmemoryPolicy policy,int64_t nowMs);
+        void evictionPoolInsert(uint64_t idle,size_t shardIndex,std::string_view key);
+        //volatile-*策略的取样：从分片的过期索引里取最多count个还带着过期时间的key，交给fn(const std::string& key,const KeyObject& obj)
+        template<class Fn>
+        size_t sampleVolatile(Shard& sh,size_t count,Fn&& fn);
+        //按策略淘汰一个key，没有可以淘汰的key时返回false
+        bool evictOne(MaxmemoryPolicy policy,std::vector<std::string>& evicted);
+        uint64_t evictRandom();
+        static HashMap toHashMap(const KeyObject& obj);
         static int64_t nowMs();
-        void cleanIfExpired(const std::string& key,int64_t nowMs);
-        void cleanIfExpiredHash(const std::string& key,int64_t nowMs);
-        void cleanIfExpiredZset(const std::string& key,int64_t nowMs);
-        static bool isExpired(const ValueRecord& v,int64_t nowMs);
-        static bool isExpired(const HashRecord& v,int64_t nowMs);
-        static bool isExpired(const ZsetRecord& v,int64_t nowMs);
+        static bool isExpired(const KeyObject& v,int64_t nowMs);
         static constexpr size_t kZsetVectorPeak=128;//定义zset数据结构使用vector作为底层容器的最大数据容量
     private:
-        std::unordered_map<std::string,ValueRecord> _map;
-        std::unordered_map<std::string,ValueRecord>::iterator _scanIterator=_map.end();
-        std::unordered_map<std::string,HashRecord> _hmap;
-        std::unordered_map<std::string,HashRecord>::iterator _hscanIterator=_hmap.end();
-        std::unordered_map<std::string,ZsetRecord> _zmap;
-        std::unordered_map<std::string,ZsetRecord>::iterator _zcanIterator=_zmap.end();
-
-        std::unordered_map<std::string,int64_t> _expireIndex;//设置key过期值，比如说要将某一个key设置为定时key，那么使用这个存储key和对应的过期时间
-
-        mutable std::mutex _mutex;
+        std::array<Shard,kShardCount> _shards;
+        StoreOptions _opts;
+        std::atomic<size_t> _expireCursor{0};//定期删除下一次从哪个分片开始
+        std::atomic<uint64_t> _statExpiredKeys{0};
+        std::atomic<uint64_t> _statStaleEntries{0};
+        std::atomic<uint64_t> _statTimeCapReached{0};
+        std::atomic<uint64_t> _statCycleUs{0};
+        std::atomic<size_t> _maxmemory{0};
+        std::atomic<MaxmemoryPolicy> _maxmemoryPolicy{MaxmemoryPolicy::NoEviction};
+        std::atomic<int> _maxmemorySamples{5};
+        std::atomic<uint64_t> _statEvictedKeys{0};
+        //淘汰同一时间只在一个线程上进行，下面几项都只在_evictMutex里访问；加锁顺序是先_evictMutex再分片的锁
+        std::mutex _evictMutex;
+        std::vector<EvictCandidate> _evictPool;//按_idle从小到大排列，最多kEvictPoolSize项
+        size_t _evictCursor=0;//下一次从哪个分片取样
+        uint64_t _evictRandState=0x9E3779B97F4A7C15ull;
+        LazyFree _lazyfree;
     };
 
-}
\ No newline at end of file
+}
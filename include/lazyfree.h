@@ -0,0 +1,46 @@
+#pragma once
+#include<atomic>
+#include<cstddef>
+#include<cstdint>
+#include<mutex>
+#include<thread>
+#include<type_traits>
+#include<utility>
+namespace myredis{
+    //后台释放线程，和redis的lazyfree一样：命令只负责把大的值从键空间里摘下来，真正的析构放到这个线程上做
+    //投递是无锁的：任务挂到一个原子单链表的表头(多个io线程可以同时投递)，后台线程一次把整条链表取走再逐个析构
+    //链表从空变成非空时才写一次eventfd唤醒后台线程，连续投递时不会每次都进内核
+    class LazyFree{
+    public:
+        LazyFree()=default;
+        ~LazyFree();
+        LazyFree(const LazyFree&)=delete;
+        LazyFree& operator=(const LazyFree&)=delete;
+        //把value移进一个任务交给后台线程析构，第一次投递时才启动后台线程，eventfd创建失败时不启动线程，在调用线程上直接析构
+        template<class T>
+        void free(T&& value){enqueue(new Box<std::decay_t<T>>{std::forward<T>(value)});}
+        //已投递还没有析构完的任务数
+        size_t pending()const{return _pending.load(std::memory_order_relaxed);}
+        //已经析构完的任务数
+        uint64_t freed()const{return _freed.load(std::memory_order_relaxed);}
+    private:
+        struct Job{
+            Job* _next=nullptr;
+            virtual ~Job()=default;
+        };
+        template<class T>
+        struct Box:Job{
+            explicit Box(T&& v):_value(std::move(v)){}
+            T _value;
+        };
+        void enqueue(Job* job);
+        void run();
+        std::atomic<Job*> _head{nullptr};
+        std::atomic<size_t> _pending{0};
+        std::atomic<uint64_t> _freed{0};
+        std::atomic<bool> _stop{false};
+        std::once_flag _startOnce;
+        std::thread _thread;
+        int _wakeFd=-1;
+    };
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include<cstddef>
+#include<cstdint>
+#include<string>
+#include<string_view>
+namespace myredis{
+    //小hash使用的紧凑编码，思路和redis的listpack一样：所有field和value按顺序首尾相连放在一块连续内存里，
+    //每个元素前面是变长编码的长度(小于128字节的元素只占1字节)，field和value交替出现
+    //没有哈希桶和链表节点，几个字段的hash只有一次分配；查找是线性扫描，所以只用在字段数和值长度都较小的hash上
+    class Listpack{
+    public:
+        //field和value的对数
+        size_t size()const{return _count;}
+        bool empty()const{return _count==0;}
+        size_t bytes()const{return _buf.size();}
+        //缓冲区在堆上实际占用的内存，包括没用完的容量
+        size_t allocatedBytes()const;
+        //找到field时把对应的value写到value里，value指向内部内存，在下一次修改之前有效
+        bool find(std::string_view field,std::string_view& value)const;
+        //field不存在时追加，存在时原地替换value，返回是否新增
+        bool set(std::string_view field,std::string_view value);
+        bool erase(std::string_view field);
+        //按插入顺序遍历，fn(std::string_view field,std::string_view value)
+        template<class Fn>
+        void forEach(Fn&& fn)const{
+            size_t pos=0;
+            while(pos<_buf.size()){
+                std::string_view field=next(pos);
+                std::string_view value=next(pos);
+                fn(field,value);
+            }
+        }
+    private:
+        //读取pos处的一个元素，pos移到下一个元素的开头
+        std::string_view next(size_t& pos)const{
+            size_t len=0;
+            int shift=0;
+            uint8_t b;
+            do{
+                b=static_cast<uint8_t>(_buf[pos++]);
+                len|=static_cast<size_t>(b&0x7f)<<shift;
+                shift+=7;
+            }while(b&0x80);
+            std::string_view s{_buf.data()+pos,len};
+            pos+=len;
+            return s;
+        }
+        static void appendEntry(std::string& out,std::string_view s);
+        //返回field所在元素的起始位置，找不到返回npos
+        size_t locate(std::string_view field)const;
+        std::string _buf;
+        uint32_t _count=0;
+    };
+}
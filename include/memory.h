@@ -1,48 +1,16 @@
 #pragma once
 #include<cstddef>
-#include<iostream>
-#include<mutex>
+#include<string>
 namespace myredis{
-    #define MAX_CHUNKS 1024
-    #define MEM_SIZE 4096
-    #define MAX_FREE_NODE_COUNT 32
-    //首先思考我们的内存池如何配合我们的myredis项目来设计内存池分配
-    //我们要知道myredis中会有各种长度的内存申请且没有固定大小，那么我们可以强行预设多个桶，然后采用就近原则分配
-    //但是我们也可以按需分配这样就不会出现内存池内部碎片，但是新的问题就是不会重复利用内存块，那么迎刃而解的方式就是统计每一个大块内存的可用小块个数，如果可用个数为零就可以free整块内存
-
-    struct MemChunk{
-        MemChunk():_prev{nullptr},_next{nullptr},_availCntBytes{MEM_SIZE}{
-            _mem=::malloc(MEM_SIZE);
-            _ptr=_mem;
-        }
-        struct MemChunk* _prev;
-        struct MemChunk* _next;
-        void* _mem;//大块内存的起始地址
-        void* _ptr;//大块内存目前分配到的位置
-        int _availCntBytes;//可用字节数，如果可用字节数刚好等于MAX_MEM说明该块已经全部归还了，那么这块就可以视为新的可用块
-    };
-    class MemoryPool{
-    public:
-        static MemoryPool* getInstance(){
-            if(pool==nullptr){
-                MemoryPool* m=(MemoryPool*)malloc(sizeof(MemoryPool));
-                pool=new (m) MemoryPool{};
-            }
-            return pool;
-        }
-        ~MemoryPool();
-        void* allocate(size_t size);
-        void deallocate(void* ptr);
-    private:
-        MemoryPool();
-        static MemoryPool* pool;
-        struct MemChunk* _head;//使用中链表表头节点
-        struct MemChunk* _freeHead;//空闲块链表的表头节点
-        unsigned short _freeNodeCnt;//空闲链表节点个数
-        std::mutex _mtx;
-    };
-    
+    //进程通过operator new分配、还没有释放的字节数，和redis的used_memory一样按malloc_usable_size统计
+    //每个线程把增减记在自己的计数槽里，读取时把所有槽加起来，分配和释放路径上没有跨线程争用的原子操作
+    //maxmemory淘汰用它判断是否超限
+    size_t usedMemory();
+    //usedMemory()到目前为止的最大值，定时器每个周期和INFO、MEMORY STATS读取时刷新
+    size_t peakMemory();
+    void updatePeakMemory();
+    //一块operator new分配的内存实际占用的字节数，p为空时返回0
+    size_t allocationSize(const void* p);
+    //std::string在堆上的缓冲区占用的字节数，短字符串存在对象内部(SSO)时为0
+    size_t stringAllocation(const std::string& s);
 }
-
-void* operator new(size_t size);
-void operator delete(void* ptr);
\ No newline at end of file
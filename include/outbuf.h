@@ -0,0 +1,47 @@
+#pragma once
+#include<cstddef>
+#include<deque>
+#include<string>
+#include<string_view>
+#include<sys/uio.h>
+namespace myredis{
+    //发送缓冲区的块大小，小回复直接序列化进这种固定大小的块里，一个块可以装下几百条+OK/:1这样的回复
+    constexpr size_t kOutBlockSize=16*1024;
+    //不小于这个长度的std::string(一般是大value的bulk回复)不再拷贝，整个移动进来单独作为一块
+    constexpr size_t kOutRefMin=4*1024;
+    //连接的发送缓冲区：由若干块组成的队列，writev/sendmsg时每块对应一个iovec
+    //块有两种：从本线程块池里取出的定长块，回复顺序追加进队尾的块，写满了再取下一块；以及移动进来的大字符串
+    //用deque保存块，追加时已有块的地址不变，io_uring在途的sendmsg可以一直引用它们
+    //发送完的块立即归还块池，块池是线程局部的，连接只在所属reactor线程上读写，不需要加锁
+    class OutBuffer{
+    public:
+        OutBuffer()=default;
+        ~OutBuffer();
+        OutBuffer(const OutBuffer&)=delete;
+        OutBuffer& operator=(const OutBuffer&)=delete;
+        OutBuffer(OutBuffer&& other) noexcept;
+        OutBuffer& operator=(OutBuffer&& other) noexcept;
+        //把s拷贝进队尾的定长块
+        void append(std::string_view s);
+        //较长的s直接移动进来，较短的和append(string_view)一样拷贝
+        void append(std::string&& s);
+        bool empty()const{return _chunks.empty();}
+        //待发送的字节数
+        size_t size()const{return _bytes;}
+        //从当前发送位置开始最多填maxIov个iovec，返回填了几个
+        size_t fillIov(iovec* iov,size_t maxIov)const;
+        //n个字节已经发送出去，发送完的块归还块池
+        void consume(size_t n);
+        void clear();
+    private:
+        struct Chunk{
+            char* _block=nullptr;//定长块，为nullptr时数据在_owned里
+            size_t _len=0;
+            std::string _owned;
+            const char* data()const{return _block?_block:_owned.data();}
+        };
+        std::deque<Chunk> _chunks;
+        size_t _offset=0;//队首块已经发送的字节数
+        size_t _bytes=0;
+    };
+}
@@ -3,6 +3,8 @@
 #include<string_view>
 #include<optional>
 #include<vector>
+#include<cstdint>
+#include"outbuf.h"
 namespace myredis{
     enum RespType{
         SimpleString=0,//简单字符串
@@ -20,20 +22,41 @@ namespace myredis{
         std::string _bulk;
         std::vector<RespValue> _array;
     };
+    //零拷贝解析出的一条客户端命令，参数都是指向解析器内部缓冲区的string_view
+    //这些view在下一次append()之前一直有效，缓冲区只在append()时才会整理，所以一批命令要在下一次append之前处理完
+    struct RespCommand{
+        std::vector<std::string_view> _args;
+        std::string_view _raw;//整条命令的原始字节，aof直接记录它
+    };
     //resp协议解析器
+    //解析是可恢复的：一条命令没收全时，已经解析出的数组元素、正在等待的bulk长度都保存在解析器里，
+    //下一次append之后从上次停下的位置继续，而不是从命令开头重新扫描，大value分很多次recv到达时也是线性时间
     class RespParser{
     public:
+        enum class Status{Incomplete,Done,ProtocolError};
         void append(std::string_view data);
-        std::optional<std::pair<RespValue,std::string>> tryParseOneWithRaw();
+        //解析任意resp值，结果拷贝到RespValue中，从节点接收主节点数据时使用
         std::optional<RespValue> tryParseOne();
+        //只解析客户端命令(bulk string组成的数组)，参数不做拷贝，协议错误时会丢弃缓冲区中的数据
+        Status tryParseCommand(RespCommand& out);
     private:
-        bool parseLine(size_t& pos,std::string& outLine);
-        bool parseSimple(size_t& pos,RespType type,RespValue& out);
-        bool parseInteger(size_t& pos,int64_t& out);
-        bool parseBulkString(size_t& pos,RespValue& out);
-        bool parseArray(size_t& pos,RespValue& out);
+        //还没收齐元素的数组，嵌套数组每层一个
+        struct Frame{
+            RespValue _value;
+            size_t _remaining=0;
+        };
+        Status parseNext(RespValue& out);
+        bool parseLine(std::string_view& outLine);
+        void reset();
     private:
         std::string _buf;//接收到的网络数据全部放在这里
+        size_t _start=0;//当前命令在_buf中的起始位置，之前的数据都已经被解析走了
+        size_t _pos=0;//当前命令已经解析到的位置
+        size_t _scan=0;//上次找"\r\n"没找到时扫描到的位置，下次从这里接着找
+        int64_t _bulkLen=-1;//已经读到"$len\r\n"正在等待数据体的bulk长度，-1表示没有
+        std::vector<Frame> _stack;
+        int64_t _argc=-1;//tryParseCommand正在解析的命令的参数个数，-1表示还没读到"*n\r\n"
+        std::vector<std::pair<size_t,size_t>> _spans;//已经收全的参数相对_start的偏移和长度，缓冲区整理后依然有效
     };
 
     //响应回发数据封装
@@ -42,4 +65,35 @@ namespace myredis{
     std::string respBulkString(std::string_view s);
     std::string respNullBulk();
     std::string respInteger(int64_t val);
+
+    //共享的固定回复，进程内只有一份，回复时直接拷贝进发送缓冲区，不需要再拼接字符串
+    constexpr std::string_view kReplyOk="+OK\r\n";
+    constexpr std::string_view kReplyPong="+PONG\r\n";
+    constexpr std::string_view kReplyNullBulk="$-1\r\n";
+    constexpr std::string_view kReplyZero=":0\r\n";
+    constexpr std::string_view kReplyOne=":1\r\n";
+    //[0,kSharedIntegers)之间的整数回复预先生成好，和redis的shared.integers一样
+    constexpr int64_t kSharedIntegers=10000;
+    std::string_view sharedInteger(int64_t val);
+
+    //把回复直接序列化进连接的发送缓冲区：长度、整数用std::to_chars写在栈上再追加，不产生临时std::string
+    //命令处理函数通过它回复，一条命令可以调用多次(比如先写数组头再逐个写元素)
+    class RespWriter{
+    public:
+        explicit RespWriter(OutBuffer& out):_out{out}{}
+        void ok(){_out.append(kReplyOk);}
+        void simple(std::string_view s);
+        void error(std::string_view s);
+        void integer(int64_t val);
+        void bulk(std::string_view s);
+        //较长的value整个移动进发送缓冲区，不再拷贝
+        void bulk(std::string&& s);
+        void nullBulk(){_out.append(kReplyNullBulk);}
+        void arrayHeader(size_t n);
+        //已经是resp格式的数据原样追加
+        void raw(std::string_view s){_out.append(s);}
+    private:
+        void header(char prefix,int64_t val);
+        OutBuffer& _out;
+    };
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+#include<cstddef>
+#include<string>
+namespace myredis{
+    //resp协议、aof文件和rdb文件都是按分隔符切行的，这里提供向量化的分隔符查找
+    //x86上优先使用AVX2(运行时检测cpu是否支持)，其次SSE2，其他平台退回逐字节查找
+    //返回值和std::string::find一致，找不到时返回std::string::npos
+    constexpr size_t kScanNotFound=std::string::npos;
+    //在[data,data+len)中查找第一个"\r\n"，返回'\r'的下标
+    size_t findCrlf(const char* data,size_t len);
+    //在[data,data+len)中查找第一个字节ch
+    size_t findByte(const char* data,size_t len,char ch);
+    //逐字节查找的版本，基准测试用来对比
+    size_t findCrlfScalar(const char* data,size_t len);
+    //当前使用的实现名称："avx2"、"sse2"或"scalar"
+    const char* scanImplName();
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include"config.h"
+#include<memory>
+#include<vector>
 namespace myredis{
+    class Reactor;
     class Server{
     public:
         explicit Server(const ServerConfig& config);
@@ -12,8 +15,8 @@ namespace myredis{
         int loop();//开始循环监听
     private:
         const ServerConfig& _config;
-        int _epollFd=-1;
-        int _listenFd=-1;
+        std::vector<int> _listenFds;//共享监听模式只有一个，SO_REUSEPORT模式每个reactor一个
         int _timerFd=-1;//定时执行aof持久化(maybe)
+        std::vector<std::unique_ptr<Reactor>> _reactors;//每个reactor一个epoll实例，_reactors[0]跑在主线程上，共享监听模式下还负责accept
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifdef MYREDIS_WITH_IO_URING
+#include<cstdint>
+#include<cstddef>
+#include<linux/io_uring.h>
+namespace myredis{
+    //对io_uring系统调用的一层薄封装，不依赖liburing
+    //提交队列(SQ)和完成队列(CQ)都是和内核共享的环形缓冲区，用户态填好sqe后推进sq的tail，内核完成后推进cq的tail
+    class IoUring{
+    public:
+        IoUring()=default;
+        ~IoUring();
+        IoUring(const IoUring&)=delete;
+        IoUring& operator=(const IoUring&)=delete;
+        bool init(unsigned entries);
+        //取一个空闲的sqe，提交队列满了会先把已填好的sqe提交给内核再取
+        io_uring_sqe* getSqe();
+        //把所有已填好的sqe提交给内核，并且至少等到waitNr个完成事件，一次io_uring_enter完成提交和等待
+        int submitAndWait(unsigned waitNr);
+        //取出下一个完成事件，没有则返回nullptr，处理完后必须调用cqeSeen
+        io_uring_cqe* peekCqe();
+        void cqeSeen();
+        //通过IORING_OP_PROVIDE_BUFFERS给内核提供一组接收缓冲区，recv时由内核挑一块写入
+        //这里没有用较新的provided buffer ring，部分内核/头文件组合下注册成功后recv仍然一直返回ENOBUFS
+        bool setupBufs(uint16_t groupId,unsigned count,size_t bufSize);
+        //recv完成后把用掉的缓冲区还给内核，只是排进提交队列，随下一次submitAndWait一起提交，完成事件的user_data为0
+        void recycleBuf(uint16_t bid);
+        const char* bufAddr(uint16_t bid)const{return _bufBase+static_cast<size_t>(bid)*_bufSize;}
+        uint16_t bufGroup()const{return _bufGroup;}
+        int fd()const{return _ringFd;}
+    private:
+        int _ringFd=-1;
+        //提交队列
+        void* _sqPtr=nullptr;
+        size_t _sqMapSize=0;
+        unsigned* _sqHead=nullptr;
+        unsigned* _sqTail=nullptr;
+        unsigned* _sqMask=nullptr;
+        unsigned* _sqArray=nullptr;
+        unsigned _sqEntries=0;
+        io_uring_sqe* _sqes=nullptr;
+        size_t _sqesMapSize=0;
+        unsigned _sqeTail=0;//本地已经填好但还没有提交的sqe的尾部
+        unsigned _sqeHead=0;//本地已经提交过的sqe的尾部
+        //完成队列
+        void* _cqPtr=nullptr;
+        size_t _cqMapSize=0;
+        unsigned* _cqHead=nullptr;
+        unsigned* _cqTail=nullptr;
+        unsigned* _cqMask=nullptr;
+        io_uring_cqe* _cqes=nullptr;
+        //provided buffers
+        char* _bufBase=nullptr;
+        size_t _bufSize=0;
+        unsigned _bufCount=0;
+        uint16_t _bufGroup=0;
+    };
+}
+#endif
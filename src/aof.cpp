@@ -5,6 +5,7 @@
 #include <sys/uio.h>
 #include <iostream>
 #include "../include/kv.h"
+#include "../include/scan.h"
 namespace myredis
 {
     AofLogger::~AofLogger()
@@ -339,9 +340,12 @@ namespace myredis
         size_t pos = 0;
         auto readLine = [&](std::string &out) -> bool
         {
-            size_t e = data.find("\r\n", pos);
-            if (e == std::string::npos)
+            if (pos >= data.size())
                 return false;
+            size_t e = findCrlf(data.data() + pos, data.size() - pos);
+            if (e == kScanNotFound)
+                return false;
+            e += pos;
             out.assign(data.data() + pos, e - pos);
             pos = e + 2;
             return true;
@@ -383,55 +387,78 @@ namespace myredis
             cmd.reserve(parts[0].size());
             for (char c : parts[0])
                 cmd.push_back(static_cast<char>(::toupper(c)));
-            if (cmd == "SET" && parts.size() == 3)
-            {
-                store.set(parts[1], parts[2]);
-            }
-            else if (cmd == "DEL" && parts.size() >= 2)
-            {
-                std::vector<std::string> keys(parts.begin() + 1, parts.end());
-                store.del(keys);
-            }
-            else if (cmd == "EXPIRE" && parts.size() == 3)
-            {
-                int64_t sec = std::stoll(parts[2]);
-                store.expire(parts[1], sec);
-            }
-            else if (cmd == "FLUSHALL" && parts.size() == 1)
-            {
-                store.clearAll();
-            }
-            else if (cmd == "HSET" && parts.size() >= 4 && !(parts.size() % 2))
-            {
-                std::vector<std::string> args;
-                for (int i = 2; i < parts.size(); i++)
-                    args.push_back(parts[i]);
-                store.hset(parts[1], args);
-            }
-            else if (cmd == "HDEL" && parts.size() >= 3)
-            {
-                std::vector<std::string> fs;
-                for (size_t i = 2; i < parts.size(); ++i)
-                    fs.emplace_back(parts[i]);
-                store.hdel(parts[1], fs);
-            }
-            else if (cmd == "ZADD" && parts.size() >= 4 && !(parts.size() % 2))
+            // 类型不符的命令在命令层只会回复WRONGTYPE、不会修改数据，这里同样记一条日志跳过，不能让异常终止整个加载过程
+            try
             {
-                std::vector<std::pair<double, std::string>> args;
-                for (int i = 2; i < parts.size(); i += 2)
+                if (cmd == "SET" && parts.size() == 3)
+                {
+                    store.set(parts[1], parts[2]);
+                }
+                else if ((cmd == "DEL" || cmd == "UNLINK") && parts.size() >= 2)
+                {
+                    std::vector<std::string> keys(parts.begin() + 1, parts.end());
+                    store.del(keys, cmd == "UNLINK");
+                }
+                else if (cmd == "EXPIRE" && parts.size() == 3)
+                {
+                    int64_t sec = std::stoll(parts[2]);
+                    store.expire(parts[1], sec);
+                }
+                else if (cmd == "FLUSHALL" && parts.size() <= 2)
+                {
+                    // FLUSHALL ASYNC重放时同样交给后台线程释放
+                    std::string mode;
+                    for (size_t i = 1; i < parts.size(); i++)
+                        for (char c : parts[i])
+                            mode.push_back(static_cast<char>(::toupper(c)));
+                    store.clearAll(mode == "ASYNC");
+                }
+                else if (cmd == "HSET" && parts.size() >= 4 && !(parts.size() % 2))
+                {
+                    std::vector<std::string> args;
+                    for (int i = 2; i < parts.size(); i++)
+                        args.push_back(parts[i]);
+                    store.hset(parts[1], args);
+                }
+                else if (cmd == "HDEL" && parts.size() >= 3)
+                {
+                    std::vector<std::string> fs;
+                    for (size_t i = 2; i < parts.size(); ++i)
+                        fs.emplace_back(parts[i]);
+                    store.hdel(parts[1], fs);
+                }
+                else if (cmd == "ZADD" && parts.size() >= 4)
+                {
+                    // 选项和命令处理时一样解析，NX/XX/GT/LT/INCR在回放时得到相同的结果
+                    std::vector<std::string_view> view(parts.begin(), parts.end());
+                    int flags = 0;
+                    std::vector<std::pair<double, std::string>> args;
+                    if (!parseZaddArgs(view, 2, flags, args))
+                        store.zadd(parts[1], args, flags);
+                }
+                else if (cmd == "ZINCRBY" && parts.size() == 4)
+                {
+                    double incr;
+                    if (parseScore(parts[2], incr))
+                        store.zadd(parts[1], {{incr, parts[3]}}, kZaddIncr);
+                }
+                else if (cmd == "ZREM" &&parts.size() >= 3)
+                {
+                    std::vector<std::string> ms;
+                    for (size_t i = 2; i < parts.size(); ++i)
+                        ms.emplace_back(parts[i]);
+                    store.zrem(parts[1], ms);
+                }
+                else if (cmd == "ZREMRANGEBYSCORE" && parts.size() == 4)
                 {
-                    double sc = std::stod(parts[i]);
-                    std::string member = parts[i + 1];
-                    args.push_back({sc, member});
+                    ScoreRange range;
+                    if (parseScoreRange(parts[2], parts[3], range))
+                        store.zremRangeByScore(parts[1], range);
                 }
-                store.zadd(parts[1], args);
             }
-            else if (cmd == "ZREM" &&parts.size() >= 3)
+            catch (const WrongTypeError &e)
             {
-                std::vector<std::string> ms;
-                for (size_t i = 2; i < parts.size(); ++i)
-                    ms.emplace_back(parts[i]);
-                store.zrem(parts[1], ms);
+                std::cerr << "aof load: skip " << cmd << ": " << e.what() << "\n";
             }
         }
         return true;
@@ -448,7 +475,7 @@ namespace myredis
         return out;
     }
     // 会对_pendBytes，_seqGenerator，_queue，_increaseCmds进行写操作，这是由主线程在handleCommand时调用的
-    bool AofLogger::appendRaw(const std::string &raw)
+    bool AofLogger::appendRaw(std::string_view raw)
     {
         //std::cout << "enter appendRaw\n";
         if (!_opt._enabled || _fd < 0)
@@ -456,7 +483,7 @@ namespace myredis
         std::string lineCopy{};
         bool needIncrease = _rewriting.load();
         if (needIncrease)
-            lineCopy = raw;
+            lineCopy.assign(raw.data(), raw.size());
         int64_t seq = 0;
         {
             std::lock_guard<std::mutex> lock(_mutex);
@@ -619,7 +646,7 @@ namespace myredis
             {
                 for (const auto &it : flat._value)
                 {
-                    std::vector<std::string> parts{"ZADD", flat._key, std::to_string(it.first), it.second};
+                    std::vector<std::string> parts{"ZADD", flat._key, formatScore(it.first), it.second};
                     std::string line = toRespArray(parts);
                     writeAllFd(wfd, line.c_str(), line.size());
                 }
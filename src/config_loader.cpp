@@ -1,5 +1,8 @@
 #include "../include/config_loader.h"
+#include <cctype>
+#include <cstdint>
 #include <fstream>
+#include <utility>
 namespace myredis
 {
     static std::string trim(const std::string &s)
@@ -11,6 +14,70 @@ namespace myredis
             --j;
         return s.substr(i, j - i);
     }
+    static const std::pair<const char *, MaxmemoryPolicy> kPolicyNames[] = {
+        {"noeviction", MaxmemoryPolicy::NoEviction},
+        {"allkeys-lru", MaxmemoryPolicy::AllKeysLru},
+        {"allkeys-lfu", MaxmemoryPolicy::AllKeysLfu},
+        {"allkeys-random", MaxmemoryPolicy::AllKeysRandom},
+        {"volatile-lru", MaxmemoryPolicy::VolatileLru},
+        {"volatile-lfu", MaxmemoryPolicy::VolatileLfu},
+        {"volatile-random", MaxmemoryPolicy::VolatileRandom},
+        {"volatile-ttl", MaxmemoryPolicy::VolatileTtl},
+    };
+    bool parseMaxmemoryPolicy(const std::string &val, MaxmemoryPolicy &out)
+    {
+        for (const auto &[name, policy] : kPolicyNames)
+        {
+            if (val == name)
+            {
+                out = policy;
+                return true;
+            }
+        }
+        return false;
+    }
+    const char *maxmemoryPolicyName(MaxmemoryPolicy policy)
+    {
+        for (const auto &[name, p] : kPolicyNames)
+        {
+            if (p == policy)
+                return name;
+        }
+        return "noeviction";
+    }
+    bool parseMemorySize(const std::string &val, size_t &out)
+    {
+        size_t pos = 0;
+        while (pos < val.size() && std::isdigit(static_cast<unsigned char>(val[pos])))
+            ++pos;
+        if (pos == 0)
+            return false;
+        std::string unit;
+        for (size_t i = pos; i < val.size(); i++)
+            unit.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(val[i]))));
+        size_t mul = 1;
+        if (unit == "k" || unit == "kb")
+            mul = size_t{1} << 10;
+        else if (unit == "m" || unit == "mb")
+            mul = size_t{1} << 20;
+        else if (unit == "g" || unit == "gb")
+            mul = size_t{1} << 30;
+        else if (!unit.empty() && unit != "b")
+            return false;
+        try
+        {
+            unsigned long long n = std::stoull(val.substr(0, pos));
+            // 乘上单位之后溢出会回绕成一个很小的上限，服务一启动就开始淘汰，直接当成非法值拒绝
+            if (n > SIZE_MAX / mul)
+                return false;
+            out = static_cast<size_t>(n) * mul;
+        }
+        catch (...)
+        {
+            return false;
+        }
+        return true;
+    }
     //根据path将文件内容解析出来填写传入的ServerConfig引用变量
     bool loadConfigFromFile(const std::string &path, ServerConfig &cfg, std::string &err)
     {
@@ -48,6 +115,24 @@ namespace myredis
                     return false;
                 }
             }
+            else if (key == "hz")
+            {
+                int v = 0;
+                try
+                {
+                    v = std::stoi(val);
+                }
+                catch (...)
+                {
+                    v = 0;
+                }
+                if (v < 1 || v > 500)
+                {
+                    err = "invalid hz at line " + std::to_string(lineno);
+                    return false;
+                }
+                cfg._hz = v;
+            }
             else if (key == "bind_address")
             {
                 cfg._bindAddr = val;
@@ -178,6 +263,153 @@ namespace myredis
                     return false;
                 }
             }
+            else if (key == "io.threads")
+            {
+                try
+                {
+                    cfg._net._ioThreads = std::stoi(val);
+                }
+                catch (...)
+                {
+                    err = "invalid io.threads at line " + std::to_string(lineno);
+                    return false;
+                }
+                if (cfg._net._ioThreads < 1)
+                {
+                    err = "invalid io.threads at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "io.dispatch")
+            {
+                if (val == "roundrobin")
+                    cfg._net._dispatch = IoDispatch::RoundRobin;
+                else if (val == "leastconn")
+                    cfg._net._dispatch = IoDispatch::LeastConn;
+                else
+                {
+                    err = "invalid io.dispatch at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "io.reuseport")
+            {
+                cfg._net._reusePort = (val == "1" || val == "true" || val == "yes");
+            }
+            else if (key == "io.pipeline")
+            {
+                cfg._net._pipeline = (val == "1" || val == "true" || val == "yes");
+            }
+            else if (key == "io.backend")
+            {
+                if (val == "epoll")
+                    cfg._net._backend = IoBackend::Epoll;
+                else if (val == "uring")
+                    cfg._net._backend = IoBackend::Uring;
+                else
+                {
+                    err = "invalid io.backend at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "store.hash_max_listpack_entries")
+            {
+                try
+                {
+                    cfg._store._hashMaxListpackEntries = static_cast<size_t>(std::stoull(val));
+                }
+                catch (...)
+                {
+                    err = "invalid store.hash_max_listpack_entries at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "store.hash_max_listpack_value")
+            {
+                try
+                {
+                    cfg._store._hashMaxListpackValue = static_cast<size_t>(std::stoull(val));
+                }
+                catch (...)
+                {
+                    err = "invalid store.hash_max_listpack_value at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "store.active_expire_cpu_percent")
+            {
+                int v = 0;
+                try
+                {
+                    v = std::stoi(val);
+                }
+                catch (...)
+                {
+                    v = 0;
+                }
+                if (v < 1 || v > 100)
+                {
+                    err = "invalid store.active_expire_cpu_percent at line " + std::to_string(lineno);
+                    return false;
+                }
+                cfg._store._activeExpireCpuPercent = v;
+            }
+            else if (key == "store.active_expire_stale_percent")
+            {
+                int v = 0;
+                try
+                {
+                    v = std::stoi(val);
+                }
+                catch (...)
+                {
+                    v = 0;
+                }
+                if (v < 1 || v > 100)
+                {
+                    err = "invalid store.active_expire_stale_percent at line " + std::to_string(lineno);
+                    return false;
+                }
+                cfg._store._activeExpireStalePercent = v;
+            }
+            else if (key == "store.maxmemory")
+            {
+                if (!parseMemorySize(val, cfg._store._maxmemory))
+                {
+                    err = "invalid store.maxmemory at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "store.maxmemory_policy")
+            {
+                if (!parseMaxmemoryPolicy(val, cfg._store._maxmemoryPolicy))
+                {
+                    err = "invalid store.maxmemory_policy at line " + std::to_string(lineno);
+                    return false;
+                }
+            }
+            else if (key == "store.maxmemory_samples")
+            {
+                int v = 0;
+                try
+                {
+                    v = std::stoi(val);
+                }
+                catch (...)
+                {
+                    v = 0;
+                }
+                if (v < 1 || v > 64)
+                {
+                    err = "invalid store.maxmemory_samples at line " + std::to_string(lineno);
+                    return false;
+                }
+                cfg._store._maxmemorySamples = v;
+            }
+            else if (key == "store.lazyfree_lazy_expire")
+            {
+                cfg._store._lazyfreeLazyExpire = (val == "1" || val == "true" || val == "yes");
+            }
             else
             {
                 // ignore unknown keys for forward compatibility
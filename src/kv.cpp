@@ -1,207 +1,868 @@
 #include "../include/kv.h"
+#include "../include/memory.h"
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
 #include <chrono>
+#include <cstring>
 #include <algorithm>
+#include <functional>
 #include<iostream>
 #include <random>
 namespace myredis
 {
-    Skiplist::Skiplist() : _head{new SkiplistNode{kMaxLevel, 0.0, ""}}, _level{1}, _length{0} {}
+    SkiplistArena::~SkiplistArena()
+    {
+        for (char *c : _chunks)
+            delete[] c;
+    }
+    void *SkiplistArena::allocate(size_t size)
+    {
+        size = (size + kAlign - 1) & ~(kAlign - 1);
+        if (size > kMaxSmall)
+        {
+            _bytes += size;
+            return ::operator new(size);
+        }
+        void *&head = _free[size / kAlign];
+        if (head)
+        {
+            void *p = head;
+            std::memcpy(&head, p, sizeof(void *));
+            return p;
+        }
+        if (_left < size)
+        {
+            // 当前块剩下的零头不到一个节点，直接丢弃，浪费不超过kMaxSmall
+            _cur = new char[_nextChunk];
+            _chunks.push_back(_cur);
+            _bytes += _nextChunk;
+            _left = _nextChunk;
+            _nextChunk = std::min(_nextChunk * 2, kMaxChunk);
+        }
+        void *p = _cur;
+        _cur += size;
+        _left -= size;
+        return p;
+    }
+    void SkiplistArena::deallocate(void *p, size_t size)
+    {
+        size = (size + kAlign - 1) & ~(kAlign - 1);
+        if (size > kMaxSmall)
+        {
+            _bytes -= size;
+            ::operator delete(p);
+            return;
+        }
+        void *&head = _free[size / kAlign];
+        std::memcpy(p, &head, sizeof(void *));
+        head = p;
+    }
+    Skiplist::Skiplist() : _head{createNode(kMaxLevel, 0.0, "")}, _level{1}, _length{0} {}
+    Skiplist::~Skiplist()
+    {
+        // 小节点随_arena的块一起释放，这里只需要逐个归还直接向系统申请的大节点
+        SkiplistNode *x = _head;
+        while (x)
+        {
+            SkiplistNode *next = x->level(0)._forward;
+            freeNode(x);
+            x = next;
+        }
+    }
+    SkiplistNode *Skiplist::createNode(int level, double score, std::string_view member)
+    {
+        size_t levelCount = static_cast<size_t>(level);
+        auto *node = static_cast<SkiplistNode *>(_arena.allocate(SkiplistNode::allocSize(levelCount, member.size())));
+        node->_score = score;
+        node->_memberLen = static_cast<uint32_t>(member.size());
+        node->_levelCount = static_cast<uint8_t>(level);
+        for (size_t i = 0; i < levelCount; i++)
+            node->level(i) = SkiplistNode::Level{nullptr, 0};
+        std::memcpy(node->memberData(), member.data(), member.size());
+        return node;
+    }
+    void Skiplist::freeNode(SkiplistNode *node)
+    {
+        _arena.deallocate(node, node->allocSize());
+    }
     void Skiplist::toVector(std::vector<std::pair<double, std::string>> &out) const
     {
         out.clear();
         out.reserve(_length);
-        SkiplistNode *p = _head->_forward[0];
+        SkiplistNode *p = _head->level(0)._forward;
         while (p)
         {
-            out.emplace_back(p->_score, p->_member);
-            p = p->_forward[0];
+            out.emplace_back(p->_score, p->member());
+            p = p->level(0)._forward;
+        }
+    }
+    void KeyObject::release()
+    {
+        if (_type == ObjectType::Hash && _encoding == ObjectEncoding::Listpack)
+            delete listpack();
+        else if (_type == ObjectType::Hash)
+            delete hash();
+        else if (_type == ObjectType::Zset)
+            delete zset();
+        else if (_encoding == ObjectEncoding::Raw)
+            delete ptr<std::string>();
+        _type = ObjectType::String;
+        _encoding = ObjectEncoding::Embstr;
+        _embLen = 0;
+    }
+    // 数据区里要么是值本身要么是堆指针，按字节拷过来就完成了所有权转移，other变成空string
+    void KeyObject::takeFrom(KeyObject &other)
+    {
+        _expireAtMs = other._expireAtMs;
+        std::memcpy(_payload, other._payload, kEmbstrMax);
+        std::memcpy(_lru, other._lru, sizeof(_lru));
+        _type = other._type;
+        _encoding = other._encoding;
+        _embLen = other._embLen;
+        other._type = ObjectType::String;
+        other._encoding = ObjectEncoding::Embstr;
+        other._embLen = 0;
+    }
+    KeyObject::KeyObject(KeyObject &&other) noexcept
+    {
+        takeFrom(other);
+    }
+    KeyObject &KeyObject::operator=(KeyObject &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            takeFrom(other);
+        }
+        return *this;
+    }
+    // 和redis的string2ll一样只接受规范格式：没有前导0、没有'+'和空白，转回字符串必须和原值完全一致
+    static bool parseCanonicalInt(std::string_view value, int64_t &out)
+    {
+        if (value.empty() || value.size() > 20)
+            return false;
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+        if (ec != std::errc{} || end != value.data() + value.size())
+            return false;
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), out);
+        return std::string_view(buf, static_cast<size_t>(res.ptr - buf)) == value;
+    }
+    void KeyObject::setString(std::string_view value)
+    {
+        release();
+        int64_t n;
+        if (parseCanonicalInt(value, n))
+        {
+            _encoding = ObjectEncoding::Int;
+            std::memcpy(_payload, &n, sizeof(n));
+        }
+        else if (value.size() <= kEmbstrMax)
+        {
+            _encoding = ObjectEncoding::Embstr;
+            _embLen = static_cast<uint8_t>(value.size());
+            std::memcpy(_payload, value.data(), value.size());
+        }
+        else
+        {
+            _encoding = ObjectEncoding::Raw;
+            setPtr(new std::string{value});
+        }
+    }
+    std::string KeyObject::stringValue() const
+    {
+        if (_encoding == ObjectEncoding::Int)
+        {
+            int64_t n;
+            std::memcpy(&n, _payload, sizeof(n));
+            char buf[24];
+            auto res = std::to_chars(buf, buf + sizeof(buf), n);
+            return std::string(buf, static_cast<size_t>(res.ptr - buf));
+        }
+        if (_encoding == ObjectEncoding::Embstr)
+            return std::string(_payload, _embLen);
+        return *ptr<std::string>();
+    }
+    void KeyObject::makeHash()
+    {
+        release();
+        _type = ObjectType::Hash;
+        _encoding = ObjectEncoding::Listpack;
+        setPtr(new Listpack{});
+    }
+    void KeyObject::convertHashToTable()
+    {
+        Listpack *lp = listpack();
+        auto *table = new HashMap{};
+        table->reserve(lp->size());
+        lp->forEach([&](std::string_view f, std::string_view v)
+                    { table->emplace(f, v); });
+        delete lp;
+        _encoding = ObjectEncoding::HashTable;
+        setPtr(table);
+    }
+    void KeyObject::makeZset()
+    {
+        release();
+        _type = ObjectType::Zset;
+        _encoding = ObjectEncoding::ZsetVector;
+        setPtr(new ZsetRecord{});
+    }
+    // 按前samples个元素的平均值估算count个元素一共占用的内存，samples为0时逐个统计
+    template <class Container, class Fn>
+    static size_t sampledBytes(const Container &c, size_t samples, Fn bytesOf)
+    {
+        size_t n = 0;
+        size_t sum = 0;
+        for (auto it = c.begin(); it != c.end() && (samples == 0 || n < samples); ++it, ++n)
+            sum += bytesOf(*it);
+        return n == 0 || n == c.size() ? sum : sum * c.size() / n;
+    }
+    // unordered_map的节点：下一项指针、键值对，std::string做key时libstdc++还会在节点里缓存哈希值
+    template <class Map>
+    static size_t mapBytes(const Map &m, size_t samples, size_t (*extra)(const typename Map::value_type &))
+    {
+        constexpr size_t kNodeBytes = sizeof(void *) + sizeof(typename Map::value_type) + sizeof(size_t);
+        return m.bucket_count() * sizeof(void *) + sampledBytes(m, samples, [&](const typename Map::value_type &kv)
+                                                                { return kNodeBytes + extra(kv); });
+    }
+    size_t KeyObject::memoryUsage(size_t samples) const
+    {
+        switch (_encoding)
+        {
+        case ObjectEncoding::Int:
+        case ObjectEncoding::Embstr:
+            return 0;
+        case ObjectEncoding::Raw:
+            return allocationSize(ptr<std::string>()) + stringAllocation(*ptr<std::string>());
+        case ObjectEncoding::Listpack:
+            return allocationSize(listpack()) + listpack()->allocatedBytes();
+        case ObjectEncoding::HashTable:
+            return allocationSize(hash()) + mapBytes(*hash(), samples, [](const HashMap::value_type &kv)
+                                                     { return stringAllocation(kv.first) + stringAllocation(kv.second); });
+        case ObjectEncoding::ZsetVector:
+        case ObjectEncoding::Skiplist:
+        {
+            const ZsetRecord *z = zset();
+            size_t bytes = allocationSize(z) + allocationSize(z->_items.data()) +
+                           sampledBytes(z->_items, samples, [](const std::pair<double, std::string> &item)
+                                        { return stringAllocation(item.second); });
+            if (z->_skiplist)
+                bytes += allocationSize(z->_skiplist.get()) + z->_skiplist->memoryBytes();
+            return bytes + mapBytes(z->_memberToScore, samples, [](const std::pair<const std::string, double> &kv)
+                                    { return stringAllocation(kv.first); });
+        }
+        }
+        return 0;
+    }
+    int64_t KeyValueStore::nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    bool KeyValueStore::isExpired(const KeyObject &v, int64_t nowMs)
+    {
+        return v._expireAtMs >= 0 && v._expireAtMs <= nowMs;
+    }
+    // 淘汰用的访问信息，编码和redis的robj.lru一样
+    // LRU：最近一次访问的秒数，24位大约194天回绕一次，回绕之后空闲时间按模计算
+    // LFU：高16位是计数器上次衰减的分钟数，低8位是对数计数器，访问越多计数器增加的概率越低，每过kLfuDecayMinutes分钟减1
+    static constexpr uint32_t kLruClockMax = (1u << 24) - 1;
+    static constexpr uint32_t kLfuInitVal = 5; // 新key的计数器初值，避免刚写入的key马上被淘汰
+    static constexpr double kLfuLogFactor = 10;
+    static constexpr uint32_t kLfuDecayMinutes = 1;
+    static uint32_t lruClock(int64_t nowMs)
+    {
+        return static_cast<uint32_t>(nowMs / 1000) & kLruClockMax;
+    }
+    static uint32_t lfuMinutes(int64_t nowMs)
+    {
+        return static_cast<uint32_t>(nowMs / 60000) & 0xFFFF;
+    }
+    static bool isLfuPolicy(MaxmemoryPolicy policy)
+    {
+        return policy == MaxmemoryPolicy::AllKeysLfu || policy == MaxmemoryPolicy::VolatileLfu;
+    }
+    // 按距离上次衰减过去的时间衰减之后的计数器
+    static uint32_t lfuDecr(uint32_t lru, int64_t nowMs)
+    {
+        uint32_t elapsed = (lfuMinutes(nowMs) - (lru >> 8)) & 0xFFFF;
+        uint32_t counter = lru & 0xFF;
+        uint32_t periods = elapsed / kLfuDecayMinutes;
+        return periods > counter ? 0 : counter - periods;
+    }
+    static uint32_t lfuLogIncr(uint32_t counter)
+    {
+        if (counter == 255)
+            return counter;
+        // 多个io线程同时访问不同分片上的key，随机数生成器每个线程一个
+        thread_local std::minstd_rand rng{std::random_device{}()};
+        double r = static_cast<double>(rng() - rng.min()) / static_cast<double>(rng.max() - rng.min());
+        double base = counter > kLfuInitVal ? counter - kLfuInitVal : 0;
+        if (r < 1.0 / (base * kLfuLogFactor + 1))
+            ++counter;
+        return counter;
+    }
+    void KeyValueStore::touch(KeyObject &obj, int64_t nowMs, bool created)
+    {
+        if (!isLfuPolicy(_maxmemoryPolicy.load(std::memory_order_relaxed)))
+            return obj.setLru(lruClock(nowMs));
+        uint32_t counter = created ? kLfuInitVal : lfuLogIncr(lfuDecr(obj.lru(), nowMs));
+        obj.setLru(lfuMinutes(nowMs) << 8 | counter);
+    }
+    KeyObject *KeyValueStore::lookup(Shard &sh, std::string_view key, size_t hash, int64_t nowMs)
+    {
+        KeyObject *obj = sh._dict.find(key, hash);
+        if (!obj)
+            return nullptr;
+        // 访问到已过期的key时顺手删除(惰性删除)
+        if (isExpired(*obj, nowMs))
+        {
+            _statExpiredKeys.fetch_add(1, std::memory_order_relaxed);
+            eraseKey(sh, key, hash, _opts._lazyfreeLazyExpire);
+            return nullptr;
+        }
+        touch(*obj, nowMs);
+        return obj;
+    }
+    KeyObject *KeyValueStore::lookupType(Shard &sh, std::string_view key, size_t hash, int64_t nowMs, ObjectType type)
+    {
+        KeyObject *obj = lookup(sh, key, hash, nowMs);
+        if (obj && obj->_type != type)
+            throw WrongTypeError{};
+        return obj;
+    }
+    KeyObject &KeyValueStore::lookupOrCreate(Shard &sh, std::string_view key, size_t hash, int64_t nowMs, ObjectType type)
+    {
+        auto [objPtr, inserted] = sh._dict.tryEmplace(key, hash);
+        KeyObject &obj = *objPtr;
+        if (!inserted)
+        {
+            if (!isExpired(obj, nowMs))
+            {
+                if (obj._type != type)
+                    throw WrongTypeError{};
+                touch(obj, nowMs);
+                return obj;
+            }
+            // 已过期的旧对象直接原地换成新对象，堆里对应的项之后弹出时会被丢掉
+            _statExpiredKeys.fetch_add(1, std::memory_order_relaxed);
+            --sh._expireCount;
+            freeValue(obj, _opts._lazyfreeLazyExpire);
+            obj._expireAtMs = -1;
         }
+        if (type == ObjectType::Hash)
+            obj.makeHash();
+        else if (type == ObjectType::Zset)
+            obj.makeZset();
+        touch(obj, nowMs, true);
+        return obj;
+    }
+    // 释放一个值要逐个析构的元素数，和redis的lazyfreeGetFreeEffort一样，string和listpack都只有一次free
+    static size_t freeEffort(const KeyObject &obj)
+    {
+        if (obj._encoding == ObjectEncoding::HashTable)
+            return obj.hash()->size();
+        if (obj._type == ObjectType::Zset)
+            return obj.zset()->_skiplist ? obj.zset()->_skiplist->size() : obj.zset()->_items.size();
+        return 1;
+    }
+    void KeyValueStore::freeValue(KeyObject &obj, bool lazy)
+    {
+        // 移动只拷贝数据区里的指针，O(1)，原对象变成空string，之后从字典里删除它不会再释放什么
+        if (lazy && freeEffort(obj) > kLazyfreeThreshold)
+            _lazyfree.free(std::move(obj));
+    }
+    void KeyValueStore::eraseKey(Shard &sh, std::string_view key, size_t hash, bool lazy)
+    {
+        KeyObject *obj = sh._dict.find(key, hash);
+        if (!obj)
+            return;
+        // 过期索引里的项留在堆里，弹出时发现key已经不在了再丢掉
+        if (obj->_expireAtMs >= 0)
+            --sh._expireCount;
+        freeValue(*obj, lazy);
+        sh._dict.erase(key, hash);
+    }
+    // 设置或清除key的过期时间，同时维护过期索引
+    void KeyValueStore::setExpire(Shard &sh, std::string_view key, KeyObject &obj, int64_t expireAtMs)
+    {
+        int64_t old = obj._expireAtMs;
+        obj._expireAtMs = expireAtMs;
+        if (expireAtMs < 0)
+        {
+            if (old >= 0)
+                --sh._expireCount;
+            return;
+        }
+        if (old < 0)
+            ++sh._expireCount;
+        // 原来就有过期时间并且这次是延长，堆里已有的项会在到期弹出时被重新安排，不用再插入
+        if (old < 0 || expireAtMs < old)
+            pushExpire(sh, key, expireAtMs);
+    }
+    void KeyValueStore::pushExpire(Shard &sh, std::string_view key, int64_t when)
+    {
+        auto &heap = sh._expireHeap;
+        if (heap.size() < 2 * sh._expireCount + kExpireHeapSlack)
+        {
+            heap.push_back(ExpireEntry{when, std::string{key}});
+            std::push_heap(heap.begin(), heap.end(), std::greater<>{});
+            return;
+        }
+        // 失效的项(已删除、PERSIST、被缩短过过期时间的key留下的)超过一半，按字典重建，每个key正好一项
+        // 重建是O(n)的，但距离上一次重建至少又插入了_expireCount+kExpireHeapSlack项，均摊到每次插入是常数
+        // 调用方已经把新的过期时间写进了对象，重建时会一起放进去
+        heap.clear();
+        sh._dict.forEach([&](std::string_view k, const KeyObject &v)
+                         {
+            if (v._expireAtMs >= 0)
+                heap.push_back(ExpireEntry{v._expireAtMs, std::string{k}}); });
+        std::make_heap(heap.begin(), heap.end(), std::greater<>{});
+        if (heap.capacity() > 2 * heap.size() + kExpireHeapSlack)
+            heap.shrink_to_fit();
     }
     std::vector<std::string> KeyValueStore::listKeys() const
     {
-        std::lock_guard<std::mutex> lock(_mutex);
         std::vector<std::string> out;
-        out.reserve(_map.size() + _hmap.size() + _zmap.size());
-        for (const auto &[k, v] : _map)
-            out.push_back(k);
-        for (const auto &[k, v] : _hmap)
-            out.push_back(k);
-        for (const auto &[k, v] : _zmap)
-            out.push_back(k);
-        // 排序去重
+        int64_t now = nowMs();
+        // 逐个分片加锁收集，不会同时持有两把分片锁
+        for (const Shard &sh : _shards)
+        {
+            std::lock_guard<std::mutex> lock(sh._mutex);
+            sh._dict.forEach([&](std::string_view k, const KeyObject &v)
+                             {
+                if (!isExpired(v, now))
+                    out.emplace_back(k); });
+        }
         std::sort(out.begin(), out.end());
-        out.erase(std::unique(out.begin(), out.end()), out.end());
         return out;
     }
-    int64_t KeyValueStore::ttl(const std::string &key)
+    int64_t KeyValueStore::ttl(std::string_view key)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
         int64_t now = nowMs();
-        cleanIfExpired(key, now);
-        auto it = _map.find(key);
-        if (it == _map.end())
+        KeyObject *obj = lookup(sh, key, hash, now);
+        if (!obj)
             return -2; // key does not exist
-        if (it->second._expireAtMs < 0)
+        if (obj->_expireAtMs < 0)
             return -1; // no expire
-        int64_t ms_left = it->second._expireAtMs - now;
+        int64_t ms_left = obj->_expireAtMs - now;
         if (ms_left <= 0)
             return -2;
         return ms_left / 1000; // seconds (floor)
     }
-    // 设置key的time to live剩余存活时间
-    bool KeyValueStore::expire(const std::string &key, int64_t ttlSec)
+    // 设置key的time to live剩余存活时间，对所有类型的key都有效
+    bool KeyValueStore::expire(std::string_view key, int64_t ttlSec)
     {
-        // 这个expire命令只针对string类型值
-        std::lock_guard<std::mutex> lock(_mutex);
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
         // 如果key值不存在或者已过期，那么不做任何操作
         int64_t now = nowMs();
-        cleanIfExpired(key, now);
-        auto it = _map.find(key);
-        if (it == _map.end())
+        KeyObject *obj = lookup(sh, key, hash, now);
+        if (!obj)
             return false;
         // 如果key存在且未过期，那么更新key的过期时间
-        if (ttlSec < 0)
-        {
-            it->second._expireAtMs = -1;
-            _expireIndex.erase(key);
-            return true;
-        }
-        it->second._expireAtMs = now + 1000 * ttlSec;
-        _expireIndex[key] = it->second._expireAtMs;
+        setExpire(sh, key, *obj, ttlSec < 0 ? -1 : now + 1000 * ttlSec);
         return true;
     }
-    //如果字符串类型的map没有存在key-value记录，那么直接在map中插入新的记录，如果已经存在则更新
+    //如果key不存在，那么直接插入新的string对象，如果已经存在(无论什么类型)则覆盖
     bool KeyValueStore::setWithExpireAtMs(const std::string &key, const std::string &value, int64_t expireAtMs)
     {
-        std::lock_guard<std::mutex> lk(_mutex);
-        _map[key] = ValueRecord{value, expireAtMs};
-        if (expireAtMs >= 0)
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        auto [objPtr, inserted] = sh._dict.tryEmplace(key, hash);
+        KeyObject &obj = *objPtr;
+        obj.setString(value);
+        touch(obj, nowMs(), inserted);
+        setExpire(sh, key, obj, expireAtMs);
+        return true;
+    }
+    //当需要从磁盘中读取hash、zset的数据时，提供这个函数为所有原本有过期时间的key值设置过期时间
+    bool KeyValueStore::setExpireAtMs(const std::string &key, int64_t expireAtMs)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = sh._dict.find(key, hash);
+        if (!obj)
+            return false;
+        setExpire(sh, key, *obj, expireAtMs);
+        return true;
+    }
+    std::optional<std::string> KeyValueStore::get(std::string_view key)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::String); // 在获取值之前检查是否过期，过期就执行删除操作
+        if (obj)
+            return obj->stringValue();
+        return std::nullopt;
+    }
+    // 从各分片的过期索引里弹出已经到期的key并删除，maxStep是所有分片加起来最多弹出的项数
+    // 每次从上次停下的分片接着往后，每个分片只在自己的锁里弹出一部分，不会长时间挡住其他分片上的读写
+    int KeyValueStore::expireScanStep(int maxStep)
+    {
+        if (maxStep <= 0)
+            return 0;
+        int perShard = std::max(1, maxStep / static_cast<int>(kShardCount));
+        int removed = 0;
+        for (size_t n = 0; n < kShardCount && maxStep > 0; n++)
         {
-            _expireIndex[key] = expireAtMs;
+            Shard &sh = _shards[_expireCursor.fetch_add(1, std::memory_order_relaxed) & (kShardCount - 1)];
+            int step = std::min(perShard, maxStep);
+            maxStep -= step;
+            int examined = 0;
+            removed += expireScanShard(sh, step, examined, nullptr);
         }
-        return true;
+        return removed;
     }
-    int64_t KeyValueStore::nowMs()
+    // 和redis的activeExpireCycle一样按轮进行：每轮从每个分片弹出最多kBatch个到期项
+    // redis是随机抽样，抽到的过期key比例超过阈值才继续下一轮；这里索引按到期时间有序，弹出的都是到期项，
+    // 所以用一轮弹出的项数占满额的比例来判断：超过_activeExpireStalePercent说明还有成批的key到期，接着删，
+    // 否则剩下零星的到期项留给下一个周期；每轮结束检查一次时间，用完预算就停
+    void KeyValueStore::activeExpireCycle(int64_t budgetUs, std::vector<std::string> &expired)
     {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        const int kBatch = 20;
+        auto begin = std::chrono::steady_clock::now();
+        auto deadline = begin + std::chrono::microseconds(budgetUs);
+        int threshold = static_cast<int>(kShardCount) * kBatch * _opts._activeExpireStalePercent / 100;
+        while (true)
+        {
+            int examined = 0;
+            for (Shard &sh : _shards)
+            {
+                int n = 0;
+                expireScanShard(sh, kBatch, n, &expired);
+                examined += n;
+            }
+            if (examined <= threshold)
+                break;
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                _statTimeCapReached.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+        _statCycleUs.fetch_add(static_cast<uint64_t>(us), std::memory_order_relaxed);
     }
-    bool KeyValueStore::isExpired(const ValueRecord &v, int64_t nowMs)
+    ExpireStats KeyValueStore::expireStats() const
     {
-        return v._expireAtMs >= 0 && v._expireAtMs <= nowMs;
+        ExpireStats st;
+        st._expiredKeys = _statExpiredKeys.load(std::memory_order_relaxed);
+        st._staleEntries = _statStaleEntries.load(std::memory_order_relaxed);
+        st._timeCapReached = _statTimeCapReached.load(std::memory_order_relaxed);
+        st._cycleUs = _statCycleUs.load(std::memory_order_relaxed);
+        return st;
     }
-    bool KeyValueStore::isExpired(const HashRecord &v, int64_t nowMs)
+    int KeyValueStore::expireScanShard(Shard &sh, int maxStep, int &examined, std::vector<std::string> *expired)
     {
-        return v._expireAtMs >= 0 && v._expireAtMs <= nowMs;
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        auto &heap = sh._expireHeap;
+        int64_t now = nowMs();
+        int removed = 0;
+        examined = 0;
+        // 堆顶还没到期就说明这个分片没有到期的key，不需要看其他项
+        for (; examined < maxStep && !heap.empty() && heap.front()._when <= now; examined++)
+        {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>{});
+            ExpireEntry &e = heap.back();
+            size_t hash = Dict<KeyObject>::hashOf(e._key);
+            KeyObject *obj = sh._dict.find(e._key, hash);
+            if (obj && obj->_expireAtMs > now)
+            {
+                // 过期时间被延长过，按新的时间放回堆里，key字符串原样复用
+                e._when = obj->_expireAtMs;
+                std::push_heap(heap.begin(), heap.end(), std::greater<>{});
+                continue;
+            }
+            if (obj && obj->_expireAtMs >= 0)
+            {
+                --sh._expireCount;
+                freeValue(*obj, _opts._lazyfreeLazyExpire);
+                sh._dict.erase(e._key, hash);
+                ++removed;
+                // 这一项马上要丢掉，key字符串直接移给调用方
+                if (expired)
+                    expired->push_back(std::move(e._key));
+            }
+            // key已经被删除或者PERSIST过，这一项直接丢掉
+            heap.pop_back();
+        }
+        _statExpiredKeys.fetch_add(static_cast<uint64_t>(removed), std::memory_order_relaxed);
+        _statStaleEntries.fetch_add(static_cast<uint64_t>(examined - removed), std::memory_order_relaxed);
+        return removed;
     }
-    bool KeyValueStore::isExpired(const ZsetRecord &v, int64_t nowMs)
+    // 推进各分片字典的渐进式搬迁，总共最多花budgetUs微秒，和redis定时任务里的incrementallyRehash一样
+    // 每次加锁只搬迁kRehashGroupsPerLock组，不会长时间挡住同一分片上的读写
+    bool KeyValueStore::rehashStep(int64_t budgetUs)
     {
-        return v._expireAtMs >= 0 && v._expireAtMs <= nowMs;
+        const size_t kRehashGroupsPerLock = 64;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budgetUs);
+        for (Shard &sh : _shards)
+        {
+            bool more = true;
+            while (more)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sh._mutex);
+                    more = sh._dict.rehashGroups(kRehashGroupsPerLock);
+                }
+                if (more && std::chrono::steady_clock::now() >= deadline)
+                    return true;
+            }
+        }
+        return false;
     }
-    void KeyValueStore::cleanIfExpired(const std::string &key, int64_t nowMs)
+    void KeyValueStore::clearAll(bool async)
     {
-        auto it = _map.find(key);
-        if (it == _map.end())
-            return;
-        if (isExpired(it->second, nowMs))
+        for (Shard &sh : _shards)
         {
-            _map.erase(key);
-            _expireIndex.erase(key);
+            std::lock_guard<std::mutex> lock(sh._mutex);
+            if (async && !sh._dict.empty())
+            {
+                _lazyfree.free(std::move(sh._dict));
+                _lazyfree.free(std::move(sh._expireHeap));
+            }
+            sh._dict.clear();
+            std::vector<ExpireEntry>().swap(sh._expireHeap);
+            sh._expireCount = 0;
         }
     }
-    void KeyValueStore::cleanIfExpiredHash(const std::string &key, int64_t nowMs)
+    void KeyValueStore::setOptions(const StoreOptions &opt)
     {
-        auto it = _hmap.find(key);
-        if (it == _hmap.end())
-            return;
-        if (isExpired(it->second, nowMs))
+        _opts = opt;
+        setMaxmemory(opt._maxmemory);
+        setMaxmemoryPolicy(opt._maxmemoryPolicy);
+        setMaxmemorySamples(opt._maxmemorySamples);
+    }
+    uint64_t KeyValueStore::evictRandom()
+    {
+        // xorshift64，只在_evictMutex里调用
+        uint64_t x = _evictRandState;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return _evictRandState = x;
+    }
+    uint64_t KeyValueStore::evictScore(const KeyObject &obj, MaxmemoryPolicy policy, int64_t nowMs)
+    {
+        switch (policy)
         {
-            _hmap.erase(key);
-            _expireIndex.erase(key);
+        case MaxmemoryPolicy::AllKeysLru:
+        case MaxmemoryPolicy::VolatileLru:
+            return (lruClock(nowMs) - obj.lru()) & kLruClockMax;
+        case MaxmemoryPolicy::AllKeysLfu:
+        case MaxmemoryPolicy::VolatileLfu:
+            return 255 - lfuDecr(obj.lru(), nowMs);
+        case MaxmemoryPolicy::VolatileTtl:
+            // 越早过期分数越高
+            return UINT64_MAX - static_cast<uint64_t>(obj._expireAtMs);
+        default:
+            return 0;
         }
     }
-    void KeyValueStore::cleanIfExpiredZset(const std::string &key, int64_t nowMs)
+    // 和redis的evictionPoolPopulate一样：池满时比池里最小的还小就不放，否则挤掉最小的那项
+    void KeyValueStore::evictionPoolInsert(uint64_t idle, size_t shardIndex, std::string_view key)
     {
-        auto it = _zmap.find(key);
-        if (it == _zmap.end())
+        auto &pool = _evictPool;
+        if (pool.size() == kEvictPoolSize && idle <= pool.front()._idle)
             return;
-        if (isExpired(it->second, nowMs))
+        for (const EvictCandidate &c : pool)
         {
-            _zmap.erase(key);
-            _expireIndex.erase(key);
+            if (c._shard == shardIndex && c._key == key)
+                return;
         }
+        if (pool.size() == kEvictPoolSize)
+            pool.erase(pool.begin());
+        auto pos = std::upper_bound(pool.begin(), pool.end(), idle, [](uint64_t v, const EvictCandidate &c)
+                                    { return v < c._idle; });
+        pool.insert(pos, EvictCandidate{idle, shardIndex, std::string{key}});
     }
-    std::optional<std::string> KeyValueStore::get(const std::string &key)
+    // 过期索引里可能有大量已经删除或PERSIST过的key留下的项(最多是有效项的两倍再加kExpireHeapSlack)，
+    // 随机取不到有效项时按顺序扫一遍，避免明明有带过期时间的key却报告没有可以淘汰的key
+    template <class Fn>
+    size_t KeyValueStore::sampleVolatile(Shard &sh, size_t count, Fn &&fn)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpired(key, nowMs()); // 在获取值之前检查是否过期，过期就执行删除操作
-        auto it = _map.find(key);
-        if (it != _map.end())
-            return it->second._value;
-        return std::nullopt;
+        auto &heap = sh._expireHeap;
+        if (sh._expireCount == 0 || heap.empty())
+            return 0;
+        auto valid = [&](const ExpireEntry &e)
+        {
+            const KeyObject *obj = sh._dict.find(e._key, Dict<KeyObject>::hashOf(e._key));
+            if (!obj || obj->_expireAtMs < 0)
+                return false;
+            fn(e._key, *obj);
+            return true;
+        };
+        size_t found = 0;
+        for (size_t i = 0; i < count * 4 && found < count; i++)
+            found += valid(heap[evictRandom() % heap.size()]);
+        for (size_t i = 0; found == 0 && i < heap.size(); i++)
+            found += valid(heap[i]);
+        return found;
     }
-    // 全表扫描移除过期key
-    int KeyValueStore::expireScanStep(int maxStep)
+    size_t KeyValueStore::evictionPoolPopulate(size_t shardIndex, MaxmemoryPolicy policy, int64_t nowMs)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        if (maxStep <= 0 || _expireIndex.empty())
-            return 0;
-        int64_t now = nowMs();
-        int removed = 0;
-        auto it = _expireIndex.begin();
-        // 迭代器随机移动，第二个参数为+向前移动，为-向后移动
-        std::advance(it, static_cast<long>(std::rand() % _expireIndex.size()));
-        for (int i = 0; i < maxStep && !_expireIndex.empty(); i++)
-        {
-            if (it == _expireIndex.end())
-                it = _expireIndex.begin();
-            const std::string key = it->first;
-            int64_t when = it->second;
-            if (when >= 0 && now >= when)
+        Shard &sh = _shards[shardIndex];
+        size_t samples = static_cast<size_t>(_maxmemorySamples.load(std::memory_order_relaxed));
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        if (policy == MaxmemoryPolicy::AllKeysLru || policy == MaxmemoryPolicy::AllKeysLfu)
+        {
+            return sh._dict.sample(evictRandom(), samples, [&](std::string_view key, const KeyObject &obj)
+                                   { evictionPoolInsert(evictScore(obj, policy, nowMs), shardIndex, key); });
+        }
+        // volatile-*只在带过期时间的key里取样，过期索引本身就是这些key的列表，随机取堆里的项再到字典里核对
+        return sampleVolatile(sh, samples, [&](const std::string &key, const KeyObject &obj)
+                              { evictionPoolInsert(evictScore(obj, policy, nowMs), shardIndex, key); });
+    }
+    bool KeyValueStore::evictOne(MaxmemoryPolicy policy, std::vector<std::string> &evicted)
+    {
+        bool volatileOnly = policy >= MaxmemoryPolicy::VolatileLru;
+        auto evictKey = [&](Shard &sh, std::string key)
+        {
+            eraseKey(sh, key, Dict<KeyObject>::hashOf(key));
+            evicted.push_back(std::move(key));
+            _statEvictedKeys.fetch_add(1, std::memory_order_relaxed);
+        };
+        if (policy == MaxmemoryPolicy::AllKeysRandom || policy == MaxmemoryPolicy::VolatileRandom)
+        {
+            // 随机策略不需要淘汰池，从下一个非空的分片里随便取一个
+            for (size_t n = 0; n < kShardCount; n++)
             {
-                // 如果这个过期时间正确且已过期,移除所有map中该key值
-                // 按key值删除即便不存在该key也是安全的，返回0
-                _map.erase(key);
-                _hmap.erase(key);
-                _zmap.erase(key);
-                // 按iterator删除，必须要iterator有效，返回删除位置下一个迭代器
-                it = _expireIndex.erase(it);
-                ++removed;
+                Shard &sh = _shards[_evictCursor++ & (kShardCount - 1)];
+                std::lock_guard<std::mutex> lock(sh._mutex);
+                std::string key;
+                size_t picked = 0;
+                if (!volatileOnly)
+                    picked = sh._dict.sample(evictRandom(), 1, [&](std::string_view k, const KeyObject &)
+                                             { key = k; });
+                else
+                    picked = sampleVolatile(sh, 1, [&](const std::string &k, const KeyObject &)
+                                            { key = k; });
+                if (picked > 0)
+                {
+                    evictKey(sh, std::move(key));
+                    return true;
+                }
             }
-            else
+            return false;
+        }
+        int64_t now = nowMs();
+        while (true)
+        {
+            // 每淘汰一个key只从一个分片取样，池里留下的候选项来自之前取样过的分片，跨分片比较
+            size_t sampled = 0;
+            for (size_t n = 0; n < kShardCount && sampled == 0; n++)
+                sampled = evictionPoolPopulate(_evictCursor++ & (kShardCount - 1), policy, now);
+            // 从分数最高的候选项开始，取样之后key可能已经被删除或者PERSIST，重新核对
+            while (!_evictPool.empty())
             {
-                ++it;
+                EvictCandidate c = std::move(_evictPool.back());
+                _evictPool.pop_back();
+                Shard &sh = _shards[c._shard];
+                std::lock_guard<std::mutex> lock(sh._mutex);
+                const KeyObject *obj = sh._dict.find(c._key, Dict<KeyObject>::hashOf(c._key));
+                if (obj && (!volatileOnly || obj->_expireAtMs >= 0))
+                {
+                    evictKey(sh, std::move(c._key));
+                    return true;
+                }
             }
+            if (sampled == 0)
+                return false;
         }
-        return removed;
     }
-    void KeyValueStore::clearAll()
+    EvictStatus KeyValueStore::performEvictions(int64_t budgetUs, std::vector<std::string> &evicted)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        _map.clear();
-        _hmap.clear();
-        _zmap.clear();
-        _expireIndex.clear();
+        size_t limit = _maxmemory.load(std::memory_order_relaxed);
+        if (limit == 0 || usedMemory() <= limit)
+            return EvictStatus::Ok;
+        MaxmemoryPolicy policy = _maxmemoryPolicy.load(std::memory_order_relaxed);
+        if (policy == MaxmemoryPolicy::NoEviction)
+            return EvictStatus::Fail;
+        std::lock_guard<std::mutex> lock(_evictMutex);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budgetUs);
+        // 拿到锁之前别的线程可能已经淘汰过了，循环条件会重新检查
+        for (size_t n = 1; usedMemory() > limit; n++)
+        {
+            if (!evictOne(policy, evicted))
+                return EvictStatus::Fail;
+            // 每淘汰16个key看一次时间
+            if ((n & 15) == 0 && std::chrono::steady_clock::now() >= deadline)
+                return usedMemory() > limit ? EvictStatus::Running : EvictStatus::Ok;
+        }
+        return EvictStatus::Ok;
     }
-    bool KeyValueStore::exists(const std::string &key)
+    std::optional<size_t> KeyValueStore::memoryUsage(std::string_view key, size_t samples)
     {
-        // 这个exists命令是string类型值专用
-        std::lock_guard<std::mutex> lock(_mutex);
-        int64_t now = nowMs();
-        cleanIfExpired(key, now);
-        return _map.find(key) != _map.end();
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        const KeyObject *obj = sh._dict.find(key, hash);
+        if (!obj || isExpired(*obj, nowMs()))
+            return std::nullopt;
+        // 对象是字典元素的第一个成员，它的地址就是元素(对象和key一起分配)的内存块；槽位数组里的一个指针和一个控制字节也算在这个key上
+        return allocationSize(obj) + sizeof(void *) + 1 + obj->memoryUsage(samples);
     }
-    int KeyValueStore::del(const std::vector<std::string> &keys)
+    KeyspaceMemory KeyValueStore::memoryStats()
+    {
+        const size_t kShardSamples = 64;
+        const size_t kValueSamples = 5;
+        thread_local std::minstd_rand rng{std::random_device{}()};
+        KeyspaceMemory st;
+        for (Shard &sh : _shards)
+        {
+            std::lock_guard<std::mutex> lock(sh._mutex);
+            size_t keys = sh._dict.size();
+            st._keys += keys;
+            st._expires += sh._expireCount;
+            st._tableBytes += sh._dict.tableBytes();
+            st._expireIndexBytes += sh._expireHeap.capacity() * sizeof(ExpireEntry) +
+                                    sampledBytes(sh._expireHeap, kShardSamples, [](const ExpireEntry &e)
+                                                 { return stringAllocation(e._key); });
+            size_t typeKeys[3] = {};
+            size_t typeBytes[3] = {};
+            size_t sampled = sh._dict.sample(rng(), kShardSamples, [&](std::string_view, const KeyObject &obj)
+                                             {
+                size_t t = static_cast<size_t>(obj._type);
+                ++typeKeys[t];
+                typeBytes[t] += allocationSize(&obj) + obj.memoryUsage(kValueSamples); });
+            for (size_t t = 0; sampled > 0 && t < 3; t++)
+            {
+                st._typeKeys[t] += typeKeys[t] * keys / sampled;
+                st._typeBytes[t] += typeBytes[t] * keys / sampled;
+            }
+        }
+        return st;
+    }
+    bool KeyValueStore::exists(std::string_view key)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        return lookup(sh, key, hash, nowMs()) != nullptr;
+    }
+    int KeyValueStore::del(const std::vector<std::string> &keys, bool lazy)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
         int removed = 0;
         int64_t now = nowMs();
+        // 多个key可能落在不同分片上，每个key只锁它自己的分片
         for (const auto &k : keys)
         {
-            auto it = _map.find(k);
-            if (it != _map.end())
+            size_t hash = Dict<KeyObject>::hashOf(k);
+            Shard &sh = shardFor(hash);
+            std::lock_guard<std::mutex> lock(sh._mutex);
+            if (lookup(sh, k, hash, now))
             {
-                _map.erase(k);
-                _expireIndex.erase(k);
+                eraseKey(sh, k, hash, lazy);
                 ++removed;
             }
         }
@@ -209,158 +870,229 @@ namespace myredis
     }
     std::vector<std::pair<std::string, ValueRecord>> KeyValueStore::snapshot() const
     {
-        std::lock_guard<std::mutex> lock{_mutex};
         std::vector<std::pair<std::string, ValueRecord>> out;
-        out.reserve(_map.size());
-        for (const auto &[k, v] : _map)
+        // 快照逐个分片拷贝，每个分片内部是一致的，拷贝某个分片时其他分片上的读写照常进行
+        for (const Shard &sh : _shards)
         {
-            out.emplace_back(k, v);
+            std::lock_guard<std::mutex> lock{sh._mutex};
+            sh._dict.forEach([&](std::string_view k, const KeyObject &v)
+                             {
+                if (v._type == ObjectType::String)
+                    out.emplace_back(k, ValueRecord{v.stringValue(), v._expireAtMs}); });
         }
         // c++17即以后，返回局部对象可以做到零成本，函数调用的接收方的内存与这个函数的返回值的内存在编译阶段就是同一块内存，所以没有任何的拷贝和移动操作
         return out;
     }
     std::vector<std::pair<std::string, HashRecord>> KeyValueStore::snapshotHash() const
     {
-        std::lock_guard<std::mutex> lock{_mutex};
         std::vector<std::pair<std::string, HashRecord>> out;
-        out.reserve(_hmap.size());
-        for (const auto &[k, v] : _hmap)
+        for (const Shard &sh : _shards)
         {
-            out.emplace_back(k, v);
+            std::lock_guard<std::mutex> lock{sh._mutex};
+            sh._dict.forEach([&](std::string_view k, const KeyObject &v)
+                             {
+                if (v._type == ObjectType::Hash)
+                    out.emplace_back(k, HashRecord{toHashMap(v), v._expireAtMs}); });
         }
         return out;
     }
     std::vector<KeyValueStore::ZsetFlat> KeyValueStore::snapshotZset() const
     {
-        std::lock_guard<std::mutex> lock{_mutex};
         std::vector<ZsetFlat> out;
-        out.reserve(_zmap.size());
-        for (const auto &[k, v] : _zmap)
-        {
-            ZsetFlat flat;
-            flat._key = k;
-            flat._expireAtMs = v._expireAtMs;
-            if (!v._useSkipList)
-                flat._value = v._items;
-            else
-                v._skiplist->toVector(flat._value);
-            out.emplace_back(std::move(flat));
+        for (const Shard &sh : _shards)
+        {
+            std::lock_guard<std::mutex> lock{sh._mutex};
+            sh._dict.forEach([&](std::string_view k, const KeyObject &v)
+                             {
+                if (v._type != ObjectType::Zset)
+                    return;
+                ZsetFlat flat;
+                flat._key = std::string{k};
+                flat._expireAtMs = v._expireAtMs;
+                if (v._encoding == ObjectEncoding::ZsetVector)
+                    flat._value = v.zset()->_items;
+                else
+                    v.zset()->_skiplist->toVector(flat._value);
+                out.emplace_back(std::move(flat)); });
         }
         return out;
     }
-    bool KeyValueStore::set(const std::string &key, const std::string &value, std::optional<int64_t> ttlMs)
+    // SET会覆盖任意类型的旧值
+    bool KeyValueStore::set(std::string_view key, std::string_view value, std::optional<int64_t> ttlMs)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        int64_t now = nowMs();
         int64_t expireAt = -1;
         if (ttlMs.has_value())
         {
-            expireAt = nowMs() + *ttlMs;
+            expireAt = now + *ttlMs;
         }
-        _map[key] = ValueRecord{value, expireAt};
-        if (expireAt >= 0)
-            _expireIndex[key] = expireAt;
-        else
-            _expireIndex.erase(key);
+        auto [objPtr, inserted] = sh._dict.tryEmplace(key, hash);
+        KeyObject &obj = *objPtr;
+        obj.setString(value);
+        touch(obj, now, inserted);
+        setExpire(sh, key, obj, expireAt);
         return true;
     }
     //这里的hset不会设置过期时间
-    int KeyValueStore::hset(const std::string &key, const std::vector<std::string> &vec)
-    {
-        //std::cout<<"enter hset\n";
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredHash(key, nowMs());
-        //std::cout<<"expirehash complete\n";
-        // 如果key存在则返回value的引用，如果key不存在则unordered_map默认构造一个value然后返回value的引用
-        HashRecord &record = _hmap[key];
+    int KeyValueStore::hset(std::string_view key, const std::vector<std::string> &vec)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        // key不存在时创建一个空的hash对象，存在但不是hash时抛出WrongTypeError
+        KeyObject &obj = lookupOrCreate(sh, key, hash, nowMs(), ObjectType::Hash);
         int cnt = 0;
-        //std::cout<<"size:"<<vec.size()<<'\n';
-        for (size_t i = 0; i < vec.size(); i += 2)
+        size_t i = 0;
+        if (obj._encoding == ObjectEncoding::Listpack)
         {
-            //std::cout<<"loop i:"<<i<<'\n';
-            // 如果在_hashTable中找不到对应的key，那么插入这条key,value信息
-            auto it = record._hashTable.find(vec[i]);
-            if (it == record._hashTable.end())
+            Listpack &lp = *obj.listpack();
+            for (; i < vec.size(); i += 2)
             {
-                //std::cout<<"can not find\n";
-                record._hashTable.insert(std::make_pair(vec[i], vec[i + 1]));
+                // 和redis一样，出现过长的field或value，或者字段数超过阈值，就转成哈希表编码，剩下的字段写进哈希表
+                if (vec[i].size() > _opts._hashMaxListpackValue || vec[i + 1].size() > _opts._hashMaxListpackValue)
+                    break;
+                cnt += lp.set(vec[i], vec[i + 1]);
+                if (lp.size() > _opts._hashMaxListpackEntries)
+                {
+                    i += 2;
+                    break;
+                }
+            }
+            if (i >= vec.size() && lp.size() <= _opts._hashMaxListpackEntries)
+                return cnt;
+            obj.convertHashToTable();
+        }
+        auto &table = *obj.hash();
+        for (; i < vec.size(); i += 2)
+        {
+            // 如果在table中找不到对应的key，那么插入这条key,value信息
+            auto it = table.find(vec[i]);
+            if (it == table.end())
+            {
+                table.insert(std::make_pair(vec[i], vec[i + 1]));
                 cnt++;
                 continue;
             }
             // 如果找到了key，那么更新即可
             it->second = vec[i + 1];
-            //<<"loop over i:"<<i<<'\n';
         }
-        //std::cout<<"out hset\n";
         return cnt;
     }
-    std::optional<std::string> KeyValueStore::hget(const std::string &key, const std::string &field)
+    std::optional<std::string> KeyValueStore::hget(std::string_view key, std::string_view field)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredHash(key, nowMs());
-        auto it = _hmap.find(key);
-        if (it == _hmap.end())
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Hash);
+        if (!obj)
             return std::nullopt;
-        auto itf = it->second._hashTable.find(field);
-        if (itf == it->second._hashTable.end())
+        if (obj->_encoding == ObjectEncoding::Listpack)
+        {
+            std::string_view v;
+            if (!obj->listpack()->find(field, v))
+                return std::nullopt;
+            return std::string{v};
+        }
+        auto itf = obj->hash()->find(std::string{field});
+        if (itf == obj->hash()->end())
             return std::nullopt;
         return itf->second;
     }
-    int KeyValueStore::hdel(const std::string &key, const std::vector<std::string> &fields)
+    int KeyValueStore::hdel(std::string_view key, const std::vector<std::string> &fields)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredHash(key, nowMs());
-        auto it = _hmap.find(key);
-        if (it == _hmap.end())
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Hash);
+        if (!obj)
             return 0;
         int removed = 0;
-        for (const auto &f : fields)
+        bool empty;
+        if (obj->_encoding == ObjectEncoding::Listpack)
         {
-            auto itf = it->second._hashTable.find(f);
-            if (itf != it->second._hashTable.end())
-            {
-                removed += it->second._hashTable.erase(itf->first);
-            }
+            for (const auto &f : fields)
+                removed += obj->listpack()->erase(f);
+            empty = obj->listpack()->empty();
+        }
+        else
+        {
+            for (const auto &f : fields)
+                removed += static_cast<int>(obj->hash()->erase(f));
+            empty = obj->hash()->empty();
         }
-        // 如果删除完hashTable中的key-value键值对之后发现这张表都空了，那么在hmap中也需要删除掉这个hashRecord
-        if (it->second._hashTable.empty())
-            _hmap.erase(it);
+        // 如果删除完之后发现这张表都空了，那么这个key也需要删除
+        if (empty)
+            eraseKey(sh, key, hash);
         return removed;
     }
-    bool KeyValueStore::hexists(const std::string &key, const std::string &field)
+    bool KeyValueStore::hexists(std::string_view key, std::string_view field)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredHash(key, nowMs());
-        auto it = _hmap.find(key);
-        if (it == _hmap.end())
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Hash);
+        if (!obj)
             return false;
-        return it->second._hashTable.find(field) != it->second._hashTable.end();
+        if (obj->_encoding == ObjectEncoding::Listpack)
+        {
+            std::string_view v;
+            return obj->listpack()->find(field, v);
+        }
+        return obj->hash()->find(std::string{field}) != obj->hash()->end();
     }
-    std::vector<std::string> KeyValueStore::hgetAll(const std::string &key)
+    std::vector<std::string> KeyValueStore::hgetAll(std::string_view key)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredHash(key, nowMs());
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
         std::vector<std::string> out;
-        auto it = _hmap.find(key);
-        if (it == _hmap.end())
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Hash);
+        if (!obj)
             return out;
-        out.reserve(2 * it->second._hashTable.size());
-        for (const auto &[k, v] : it->second._hashTable)
+        if (obj->_encoding == ObjectEncoding::Listpack)
         {
-            out.push_back(k);
+            out.reserve(2 * obj->listpack()->size());
+            obj->listpack()->forEach([&](std::string_view f, std::string_view v)
+                                     {
+                out.emplace_back(f);
+                out.emplace_back(v); });
+            return out;
+        }
+        out.reserve(2 * obj->hash()->size());
+        for (const auto &[k, v] : *obj->hash())
+        {
+            out.emplace_back(k);
             out.push_back(v);
         }
         return out;
     }
-    int KeyValueStore::hlen(const std::string &key)
+    int KeyValueStore::hlen(std::string_view key)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredHash(key, nowMs());
-        auto it = _hmap.find(key);
-        if (it == _hmap.end())
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Hash);
+        if (!obj)
             return 0;
-        return static_cast<int>(it->second._hashTable.size());
+        if (obj->_encoding == ObjectEncoding::Listpack)
+            return static_cast<int>(obj->listpack()->size());
+        return static_cast<int>(obj->hash()->size());
+    }
+    // 快照导出统一成哈希表格式，rdb和aof重写不需要关心编码
+    HashMap KeyValueStore::toHashMap(const KeyObject &obj)
+    {
+        if (obj._encoding == ObjectEncoding::HashTable)
+            return *obj.hash();
+        HashMap out;
+        out.reserve(obj.listpack()->size());
+        obj.listpack()->forEach([&](std::string_view f, std::string_view v)
+                                { out.emplace(f, v); });
+        return out;
     }
-    static inline bool lessScoreMember(double aSc, const std::string &aMem, double bSc, const std::string &bMem)
+    static inline bool lessScoreMember(double aSc, std::string_view aMem, double bSc, std::string_view bMem)
     {
         if (aSc != bSc)
             return aSc < bSc;
@@ -377,79 +1109,216 @@ namespace myredis
         return level;
     }
 
-    bool Skiplist::insert(double score, const std::string &member)
+    SkiplistNode *Skiplist::findPredecessors(double score, std::string_view member, SkiplistNode **update, size_t *rank) const
     {
-        std::vector<SkiplistNode *> update{static_cast<size_t>(kMaxLevel)}; // 为vector数组预分配kMaxLevel个格子
-        SkiplistNode *x = _head;                                            // 复制一份当前_head指针，接下来当作游标指针使用
+        SkiplistNode *x = _head; // 复制一份当前_head指针，接下来当作游标指针使用
         // 从当前最顶层开始遍历寻找，直到找到第0层的插入位置，并且将每一层的最后一个小于{score,member}的节点记录到update数组中，以备后续的该节点更新指针使用
         for (int i = _level - 1; i >= 0; --i)
         {
-            while (x->_forward[static_cast<size_t>(i)] && lessScoreMember(x->_forward[static_cast<size_t>(i)]->_score, x->_forward[static_cast<size_t>(i)]->_member, score, member))
+            size_t li = static_cast<size_t>(i);
+            rank[li] = i == _level - 1 ? 0 : rank[li + 1];
+            while (x->level(li)._forward && lessScoreMember(x->level(li)._forward->_score, x->level(li)._forward->member(), score, member))
             {
-                x = x->_forward[static_cast<size_t>(i)];
+                rank[li] += x->level(li)._span;
+                x = x->level(li)._forward;
             }
-            update[static_cast<size_t>(i)] = x;
+            update[li] = x;
         }
-        // 只有当x的当前层的forward[i]大于插入节点才会停止x=x->_forward[static_cast<size_t>(i)]这一步也就是停止该层下一跳，所以x就是第0层最后一个比插入节点小的节点
-        x = x->_forward[0]; // x从最后一个比插入节点小的节点变为第一个比插入节点大的节点（在第0层）
-        if (x && x->_score == score && x->_member == member)
+        // 只有当x的当前层的下一跳大于{score,member}才会停止前进，所以返回的是第0层第一个不小于它的节点
+        return x->level(0)._forward;
+    }
+    bool Skiplist::insert(double score, std::string_view member)
+    {
+        SkiplistNode *update[kMaxLevel]; // 每一层最后一个小于{score,member}的节点
+        size_t rank[kMaxLevel];          // 走到update[i]时经过的排名
+        SkiplistNode *x = findPredecessors(score, member, update, rank);
+        if (x && x->_score == score && x->member() == member)
         {
-            // 由于之前只是判断x节点小于插入节点就更新x，只过滤了小于条件，如果插入节点和x的下一跳节点完全相同，那么在zset中两个完全相同的节点可以视作同一个节点，所以忽略插入节点
+            // 在zset中两个完全相同的节点可以视作同一个节点，所以忽略插入节点
             return false;
         }
-        int level = randLevel(); // 得到插入节点的随机层数
-        //_head节点和其他普通节点的结构是一样的，区别就是没有数据部分，但是指针数组还是有的，所以_head节点可以作为每一层的头节点
+        // 构造出插入节点，层数随机
+        linkNode(createNode(randLevel(), score, member), update, rank);
+        return true;
+    }
+    // 把节点x挂到update、rank记录的位置上，x的层数由节点自己决定
+    void Skiplist::linkNode(SkiplistNode *x, SkiplistNode **update, size_t *rank)
+    {
+        int level = x->_levelCount;
+        //_head节点和其他普通节点的结构是一样的，区别就是没有数据部分，但是每一层的下一跳还是有的，所以_head节点可以作为每一层的头节点
         if (level > _level)
         {
-            // 如果插入节点的层数比原跳表的层数还要高,那么更新跳表的最高层数
+            // 新增的层上还没有节点，head直接跨到末尾，span就是整个跳表的长度
             for (int i = _level; i < level; i++)
-                update[static_cast<size_t>(i)] = _head; // 将高于_level层的所有层的update数组全部填充_head指针
+            {
+                size_t li = static_cast<size_t>(i);
+                rank[li] = 0;
+                update[li] = _head;
+                update[li]->level(li)._span = _length;
+            }
             _level = level;
         }
-        // 构造出插入节点
-        SkiplistNode *next = new SkiplistNode(level, score, member);
-        // 从第0层开始到最高层更新插入节点的前节点的下一跳和插入节点的下一跳
+        // 从第0层开始到插入节点的最高层更新前节点和插入节点的下一跳，原来的span被插入节点一分为二
         for (int i = 0; i < level; i++)
         {
-            next->_forward[static_cast<size_t>(i)] = update[static_cast<size_t>(i)]->_forward[static_cast<size_t>(i)];
-            update[static_cast<size_t>(i)]->_forward[static_cast<size_t>(i)] = next;
+            size_t li = static_cast<size_t>(i);
+            x->level(li)._forward = update[li]->level(li)._forward;
+            update[li]->level(li)._forward = x;
+            x->level(li)._span = update[li]->level(li)._span - (rank[0] - rank[li]);
+            update[li]->level(li)._span = (rank[0] - rank[li]) + 1;
         }
+        // 比插入节点更高的层上，前节点跨过的节点数多了一个
+        for (int i = level; i < _level; i++)
+            update[static_cast<size_t>(i)]->level(static_cast<size_t>(i))._span++;
         ++_length;
+    }
+    bool Skiplist::updateScore(double curScore, std::string_view member, double newScore)
+    {
+        SkiplistNode *update[kMaxLevel];
+        size_t rank[kMaxLevel];
+        SkiplistNode *x = findPredecessors(curScore, member, update, rank);
+        if (!x || x->_score != curScore || x->member() != member)
+            return false;
+        // 新分数仍然排在前后两个节点之间时顺序不变，改掉节点里的分数就行，计数器式的小幅加分基本都走这里
+        SkiplistNode *prev = update[0];
+        SkiplistNode *next = x->level(0)._forward;
+        if ((prev == _head || lessScoreMember(prev->_score, prev->member(), newScore, member)) &&
+            (!next || lessScoreMember(newScore, member, next->_score, next->member())))
+        {
+            x->_score = newScore;
+            return true;
+        }
+        // 位置变了就把节点摘下来再按新分数挂回去，节点保留原来的层数和member，不重新分配内存
+        unlinkNode(x, update);
+        findPredecessors(newScore, member, update, rank);
+        x->_score = newScore;
+        linkNode(x, update, rank);
         return true;
     }
-    bool Skiplist::erase(double score, const std::string &member)
+    bool Skiplist::erase(double score, std::string_view member)
     {
-        // 从上往下找到第0层的目标节点并且在这个过程中记录下每一层最后一个比目标节点小的节点，然后更新这些节点的下一跳指针就行了
-        std::vector<SkiplistNode *> update{static_cast<size_t>(kMaxLevel)}; // 为vector数组预分配kMaxLevel个格子
-        SkiplistNode *x = _head;                                            // 复制一份当前_head指针，接下来当作游标指针使用
-        // 从当前最顶层开始遍历寻找，直到找到第0层的插入位置，并且将每一层的最后一个小于{score,member}的节点记录到update数组中，以备后续的该节点更新指针使用
+        // 从上往下找到第0层的目标节点并且在这个过程中记录下每一层最后一个比目标节点小的节点，然后更新这些节点的下一跳和span就行了
+        SkiplistNode *update[kMaxLevel];
+        SkiplistNode *x = _head;
         for (int i = _level - 1; i >= 0; --i)
         {
-            while (x->_forward[static_cast<size_t>(i)] && lessScoreMember(x->_forward[static_cast<size_t>(i)]->_score, x->_forward[static_cast<size_t>(i)]->_member, score, member))
+            size_t li = static_cast<size_t>(i);
+            while (x->level(li)._forward && lessScoreMember(x->level(li)._forward->_score, x->level(li)._forward->member(), score, member))
             {
-                x = x->_forward[static_cast<size_t>(i)];
+                x = x->level(li)._forward;
             }
-            update[static_cast<size_t>(i)] = x;
+            update[li] = x;
         }
-        x = x->_forward[0];
+        x = x->level(0)._forward;
         // 找到要删除位置但是如果数据对不上就会放弃删除
-        if (!x || x->_member != member || x->_score != score)
+        if (!x || x->member() != member || x->_score != score)
             return false;
+        unlinkNode(x, update);
+        freeNode(x); // 利用完x给update中指针更新其下一跳之后就归还内存池
+        return true;
+    }
+    // update[i]是第i层上x的前一个节点，和redis的zslDeleteNode一样
+    void Skiplist::unlinkNode(SkiplistNode *x, SkiplistNode **update)
+    {
         for (int i = 0; i < _level; i++)
         {
-            // 这里的判断是因为我们从0到当前最高层_level循环给update中存储的节点的下一跳指针赋值，但是我们找到的要删除的这个节点的层数可能小于_level，所以会有一部分层是不用更新update存储指针的下一跳指针的
-            if (update[static_cast<size_t>(i)]->_forward[static_cast<size_t>(i)] == x)
+            size_t li = static_cast<size_t>(i);
+            // 删除节点所在的层把两段span合并，删除节点之上的层只是少跨过一个节点
+            if (update[li]->level(li)._forward == x)
+            {
+                update[li]->level(li)._span += x->level(li)._span - 1;
+                update[li]->level(li)._forward = x->level(li)._forward;
+            }
+            else
             {
-                update[static_cast<size_t>(i)]->_forward[static_cast<size_t>(i)] = x->_forward[static_cast<size_t>(i)];
+                update[li]->level(li)._span--;
             }
         }
-        delete x; // 利用完x给update中指针更新其下一跳之后就释放堆空间
-        // 接下来就更新skiplist中的_level,_length字段
-        //_level是层数字段，但是forward[]下标是从0到_level-1的，所以这里使用_level-1作为数组索引
-        while (_level > 1 && _head->_forward[static_cast<size_t>(_level - 1)] != nullptr)
+        // 最高层上已经没有节点时降低层数
+        while (_level > 1 && _head->level(static_cast<size_t>(_level - 1))._forward == nullptr)
+        {
+            _head->level(static_cast<size_t>(_level - 1))._span = 0;
             --_level;
+        }
         --_length;
-        return true;
+    }
+    size_t Skiplist::eraseRangeByScore(const ScoreRange &range, std::vector<std::string> &removed)
+    {
+        SkiplistNode *update[kMaxLevel];
+        SkiplistNode *x = _head;
+        // 找到每一层最后一个低于区间下界的节点，之后在第0层上连续删除，update在整个过程中保持不变
+        for (int i = _level - 1; i >= 0; --i)
+        {
+            size_t li = static_cast<size_t>(i);
+            while (x->level(li)._forward && !range.aboveMin(x->level(li)._forward->_score))
+                x = x->level(li)._forward;
+            update[li] = x;
+        }
+        x = x->level(0)._forward;
+        size_t n = 0;
+        while (x && range.belowMax(x->_score))
+        {
+            SkiplistNode *next = x->level(0)._forward;
+            unlinkNode(x, update);
+            removed.emplace_back(x->member());
+            freeNode(x);
+            x = next;
+            ++n;
+        }
+        return n;
+    }
+    size_t Skiplist::countLess(double score, bool inclusive) const
+    {
+        size_t rank = 0;
+        const SkiplistNode *x = _head;
+        for (int i = _level - 1; i >= 0; --i)
+        {
+            size_t li = static_cast<size_t>(i);
+            while (x->level(li)._forward && (x->level(li)._forward->_score < score || (inclusive && x->level(li)._forward->_score == score)))
+            {
+                rank += x->level(li)._span;
+                x = x->level(li)._forward;
+            }
+        }
+        return rank;
+    }
+    size_t Skiplist::rankOf(double score, std::string_view member) const
+    {
+        size_t rank = 0;
+        const SkiplistNode *x = _head;
+        for (int i = _level - 1; i >= 0; --i)
+        {
+            size_t li = static_cast<size_t>(i);
+            // 和查找插入位置一样往前走，只是条件换成小于等于，停下来时x可能正好是目标节点
+            while (x->level(li)._forward && !lessScoreMember(score, member, x->level(li)._forward->_score, x->level(li)._forward->member()))
+            {
+                rank += x->level(li)._span;
+                x = x->level(li)._forward;
+            }
+            if (x != _head && x->_score == score && x->member() == member)
+                return rank;
+        }
+        return 0;
+    }
+    const SkiplistNode *Skiplist::nodeByRank(size_t rank) const
+    {
+        if (rank == 0 || rank > _length)
+            return nullptr;
+        size_t traversed = 0;
+        const SkiplistNode *x = _head;
+        for (int i = _level - 1; i >= 0; --i)
+        {
+            size_t li = static_cast<size_t>(i);
+            // 高层一次能跨过很多节点，跨过去不超过rank就前进，否则下降一层
+            while (x->level(li)._forward && traversed + x->level(li)._span <= rank)
+            {
+                traversed += x->level(li)._span;
+                x = x->level(li)._forward;
+            }
+            if (traversed == rank)
+                return x;
+        }
+        return nullptr;
     }
     // 将skiplist的start,stop范围内的元素放入out数组中
     void Skiplist::rangeByRank(int64_t start, int64_t stop, std::vector<std::string> &out) const
@@ -472,30 +1341,27 @@ namespace myredis
         int64_t e = norm(stop);
         if (s > e)
             return;
-        SkiplistNode *x = _head->_forward[0];
-        int64_t rank = 0;
-        while (x && rank < s)
+        // 借助span直接定位到第start个元素，不再从头沿第0层一个个数过去
+        const SkiplistNode *x = nodeByRank(static_cast<size_t>(s) + 1);
+        out.reserve(out.size() + static_cast<size_t>(e - s + 1));
+        for (int64_t rank = s; x && rank <= e; ++rank)
         {
-            x = x->_forward[0];
-            ++rank;
-        }
-        // 来到第start个元素位置,开始将start到stop的元素全部放入out这个数组中
-        while (x && rank <= e)
-        {
-            out.push_back(x->_member);
-            x = x->_forward[0];
-            ++rank;
+            out.emplace_back(x->member());
+            x = x->level(0)._forward;
         }
     }
-    int KeyValueStore::zaddBasic(ZsetRecord &record, double score, const std::string &member)
+    void KeyValueStore::zaddBasic(KeyObject &obj, double score, const std::string &member, int flags, ZaddResult &res)
     {
+        ZsetRecord &record = *obj.zset();
         auto mit = record._memberToScore.find(member);
         // ZsetRecord的_memberToScore中没有找到member这个key,那么就是插入新的score，member
         if (mit == record._memberToScore.end())
         {
+            if (flags & kZaddXx)
+                return;
             // 先判断ZsetRecord使用的是哪一种容器
             // 如果不用跳表数据结构作为底层容器，而是vector<std::pair<double, std::string>>作为底层容器，那么
-            if (!record._useSkipList)
+            if (obj._encoding == ObjectEncoding::ZsetVector)
             {
                 auto &vec = record._items;
                 auto it = std::lower_bound(vec.begin(), vec.end(), std::make_pair(score, member), [](const auto &a, const auto &b)
@@ -505,7 +1371,7 @@ namespace myredis
                 vec.insert(it, std::make_pair(score, member));
                 if (vec.size() > kZsetVectorPeak)
                 {
-                    record._useSkipList = true;
+                    obj._encoding = ObjectEncoding::Skiplist;
                     record._skiplist = std::make_unique<Skiplist>(); // make_unique这是一个模板函数
                     // 将vector中的数据转移到skiplist中
                     for (const auto &[s, m] : vec)
@@ -521,107 +1387,104 @@ namespace myredis
                 record._skiplist->insert(score, member);
             }
             record._memberToScore.emplace(member, score);
-            return 1;
+            ++res._added;
+            res._score = score;
+            return;
         }
-        else
+        // ZsetRecord的_memberToScore中找到了member这条数据,那么就是更新该member的score
+        if (flags & kZaddNx)
+            return;
+        double oldScore = mit->second;
+        if (flags & kZaddIncr)
         {
-            // ZsetRecord的_memberToScore中找到了member这条数据,那么就是更新该member的score就行了
-            double oldScore = mit->second;
-            // 如果说member已经存在并且score也存在那么什么也不做
-            if (oldScore == score)
-                return 0;
-            // 那么这个更新score不是简单的改节点的score而是先删除节点再构造新节点插入
-            if (!record._useSkipList)
+            score += oldScore;
+            if (std::isnan(score))
             {
-                auto &vec = record._items;
-                // 找到items中的原节点删除
-                for (auto it = vec.begin(); it != vec.end(); it++)
-                {
-                    if (it->first == oldScore && it->second == member)
-                    {
-                        vec.erase(it);
-                        break;
-                    }
-                }
-                auto it = std::lower_bound(vec.begin(), vec.end(), std::make_pair(score, member), [](const auto &a, const auto &b)
-                                           {
-                    if(a.first!=b.first)return a.first<b.first;
-                    return a.second<b.second; });
-                vec.insert(it, std::make_pair(score, member));
-                if (vec.size() > kZsetVectorPeak)
-                {
-                    record._useSkipList = true;
-                    record._skiplist = std::make_unique<Skiplist>(); // make_unique这是一个模板函数
-                    // 将vector中的数据转移到skiplist中
-                    for (const auto &[s, m] : vec)
-                        record._skiplist->insert(s, m);
-                    // 数据全部从items中转移到skiplist,那么就需要将原来的items的数据全部销毁
-                    // 这里是通过构造一个临时变量与items交换，这样items的数据就清空了并且内存也被释放了
-                    std::vector<std::pair<double, std::string>>().swap(record._items);
-                }
+                res._nan = true;
+                return;
             }
-            else
+        }
+        if (((flags & kZaddGt) && score <= oldScore) || ((flags & kZaddLt) && score >= oldScore))
+            return;
+        res._score = score;
+        // 如果说member已经存在并且score也相同那么什么也不做
+        if (oldScore == score)
+            return;
+        if (obj._encoding == ObjectEncoding::ZsetVector)
+        {
+            auto &vec = record._items;
+            auto less = [](const auto &a, const auto &b)
             {
-                // 先删除跳表中的原节点再插入新节点
-                record._skiplist->erase(oldScore, member);
-                record._skiplist->insert(score, member);
+                if (a.first != b.first)
+                    return a.first < b.first;
+                return a.second < b.second;
+            };
+            // 二分找到原来的元素，改掉分数之后如果顺序被打乱，就用rotate把它挪到新位置，member字符串不用重新构造
+            auto it = std::lower_bound(vec.begin(), vec.end(), std::make_pair(oldScore, member), less);
+            it->first = score;
+            if (it + 1 != vec.end() && less(*(it + 1), *it))
+            {
+                auto pos = std::lower_bound(it + 1, vec.end(), *it, less);
+                std::rotate(it, it + 1, pos);
+            }
+            else if (it != vec.begin() && less(*it, *(it - 1)))
+            {
+                auto pos = std::upper_bound(vec.begin(), it, *it, less);
+                std::rotate(pos, it, it + 1);
             }
-            // 更新_memberToScore中的score
-            mit->second = score;
-            return 0;
         }
-    }
-    //当需要从磁盘中读取hmap的数据时，提供这个函数为所有原本有过期时间的key值设置过期时间
-    bool KeyValueStore::setHashExpireAtMs(const std::string& key,int64_t expire){
-        std::lock_guard<std::mutex> lock(_mutex);
-        auto it=_hmap.find(key);
-        if(it==_hmap.end())return false;
-        it->second._expireAtMs=expire;
-        if(expire>=0)_expireIndex[key]=expire;
-        else _expireIndex.erase(key);
-        return true;
+        else
+        {
+            // 跳表上分数不影响前后顺序时原地修改，否则重新链接同一个节点
+            record._skiplist->updateScore(oldScore, member, score);
+        }
+        // 更新_memberToScore中的score
+        mit->second = score;
+        ++res._updated;
     }
     //同样的，zadd在添加键值对的时候也是没有设置过期时间这个功能
-    int KeyValueStore::zadd(const std::string &key, const std::vector<std::pair<double, std::string>> &args)
+    int KeyValueStore::zadd(std::string_view key, const std::vector<std::pair<double, std::string>> &args)
+    {
+        return zadd(key, args, 0)._added;
+    }
+    ZaddResult KeyValueStore::zadd(std::string_view key, const std::vector<std::pair<double, std::string>> &args, int flags)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredZset(key, nowMs());
-        auto &record = _zmap[key];
-        int cnt=0;
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        ZaddResult res;
+        // XX只更新已有member，key不存在时不能创建一个空的zset
+        KeyObject *obj = (flags & kZaddXx) ? lookupType(sh, key, hash, nowMs(), ObjectType::Zset)
+                                           : &lookupOrCreate(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj)
+            return res;
         for (auto it = args.begin(); it != args.end(); it++)
         {
-            cnt+=zaddBasic(record, it->first, it->second);
+            zaddBasic(*obj, it->first, it->second, flags, res);
         }
-        return cnt;
-    }
-    bool KeyValueStore::setZsetExpireAtMs(const std::string& key,int64_t expire){
-        std::lock_guard<std::mutex> lock(_mutex);
-        auto it=_hmap.find(key);
-        if(it==_hmap.end())return false;
-        it->second._expireAtMs=expire;
-        if(expire>=0)_expireIndex[key]=expire;
-        else _expireIndex.erase(key);
-        return true;
+        return res;
     }
-    int KeyValueStore::zrem(const std::string &key, const std::vector<std::string> &members)
+    int KeyValueStore::zrem(std::string_view key, const std::vector<std::string> &members)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredZset(key, nowMs());
-        auto it = _zmap.find(key);
-        if (it == _zmap.end())
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj)
             return 0;
+        ZsetRecord &z = *obj->zset();
         int removed = 0;
         for (const auto &m : members)
         {
-            auto mit = it->second._memberToScore.find(m);
-            if (mit == it->second._memberToScore.end())
+            auto mit = z._memberToScore.find(m);
+            if (mit == z._memberToScore.end())
                 continue;
             double sc = mit->second;
-            it->second._memberToScore.erase(mit);
-            if (!it->second._useSkipList)
+            z._memberToScore.erase(mit);
+            if (obj->_encoding == ObjectEncoding::ZsetVector)
             {
                 // 如果zset底层容器没有使用跳表,那么就是使用vector,然后对vector容器进行元素删除操作
-                auto &vec = it->second._items;
+                auto &vec = z._items;
                 for (auto vit = vec.begin(); vit != vec.end(); vit++)
                 {
                     if (vit->first == sc && vit->second == m)
@@ -635,35 +1498,28 @@ namespace myredis
             else
             {
                 // zset底层使用的是跳表，那么就是删除跳表中的元素
-                if (it->second._skiplist->erase(sc, m))
+                if (z._skiplist->erase(sc, m))
                     ++removed;
             }
         }
-        // 删除完指定元素后还需要查看底层容器是否没有数据了，如果完全没有数据那么就将这个zset中的key-zrecord也删除
-        if (!it->second._useSkipList)
-        {
-            if (it->second._items.empty())
-                _zmap.erase(it);
-        }
-        else
-        {
-            if (it->second._skiplist->size() == 0)
-                _zmap.erase(it);
-        }
+        // 删除完指定元素后如果zset已经没有元素了，那么这个key也删除
+        if (z._memberToScore.empty())
+            eraseKey(sh, key, hash);
         return removed;
     }
-    std::vector<std::string> KeyValueStore::zrange(const std::string &key, int64_t start, int64_t stop)
+    std::vector<std::string> KeyValueStore::zrange(std::string_view key, int64_t start, int64_t stop)
     {
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredZset(key, nowMs());
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
         std::vector<std::string> out;
-        auto it = _zmap.find(key);
-        if (it == _zmap.end())
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj)
             return out;
-        if (!it->second._useSkipList)
+        if (obj->_encoding == ObjectEncoding::ZsetVector)
         {
             // vector作为容器
-            const auto &vec = it->second._items;
+            const auto &vec = obj->zset()->_items;
             int64_t n = static_cast<int64_t>(vec.size());
             if (n == 0)
                 return out;
@@ -687,20 +1543,199 @@ namespace myredis
         else
         {
             // skiplist作为容器
-            it->second._skiplist->rangeByRank(start, stop, out);
+            obj->zset()->_skiplist->rangeByRank(start, stop, out);
         }
         return out;
     }
-    std::optional<double> KeyValueStore::zscore(const std::string &key, const std::string &member)
+    // min、max可以是"-inf"、"+inf"，前面加'('表示不包含这个端点
+    bool parseScore(std::string_view s, double &out)
+    {
+        if (s.empty())
+            return false;
+        std::string buf{s};
+        char *end = nullptr;
+        out = std::strtod(buf.c_str(), &end);
+        return end == buf.c_str() + buf.size() && !std::isnan(out);
+    }
+    std::string formatScore(double score)
+    {
+        // std::to_string固定保留6位小数，0.1+0.2这样的分数存盘再读回来就变了，to_chars给的是最短的精确表示
+        char buf[32];
+        auto res = std::to_chars(buf, buf + sizeof(buf), score);
+        return std::string{buf, res.ptr};
+    }
+    static bool parseScoreBound(std::string_view s, double &out, bool &exclusive)
+    {
+        exclusive = !s.empty() && s[0] == '(';
+        if (exclusive)
+            s.remove_prefix(1);
+        return parseScore(s, out);
+    }
+    bool parseScoreRange(std::string_view min, std::string_view max, ScoreRange &out)
+    {
+        return parseScoreBound(min, out._min, out._minex) && parseScoreBound(max, out._max, out._maxex);
+    }
+    const char *parseZaddArgs(const std::vector<std::string_view> &args, size_t pos, int &flags, std::vector<std::pair<double, std::string>> &items)
+    {
+        static constexpr std::pair<std::string_view, int> kOptions[] = {
+            {"nx", kZaddNx}, {"xx", kZaddXx}, {"gt", kZaddGt}, {"lt", kZaddLt}, {"ch", kZaddCh}, {"incr", kZaddIncr}};
+        flags = 0;
+        for (; pos < args.size(); ++pos)
+        {
+            int flag = 0;
+            for (const auto &[name, f] : kOptions)
+            {
+                if (name.size() == args[pos].size() && std::equal(name.begin(), name.end(), args[pos].begin(), [](char a, char b)
+                                                                  { return a == std::tolower(static_cast<unsigned char>(b)); }))
+                    flag = f;
+            }
+            if (!flag)
+                break;
+            flags |= flag;
+        }
+        size_t rest = args.size() - pos;
+        if (rest == 0 || rest % 2)
+            return "ERR syntax error";
+        if ((flags & kZaddNx) && (flags & kZaddXx))
+            return "ERR XX and NX options at the same time are not compatible";
+        if (((flags & kZaddNx) && (flags & (kZaddGt | kZaddLt))) || ((flags & kZaddGt) && (flags & kZaddLt)))
+            return "ERR GT, LT, and/or NX options at the same time are not compatible";
+        if ((flags & kZaddIncr) && rest != 2)
+            return "ERR INCR option supports a single increment-element pair";
+        items.clear();
+        items.reserve(rest / 2);
+        for (; pos < args.size(); pos += 2)
+        {
+            double score;
+            if (!parseScore(args[pos], score))
+                return "ERR value is not a valid float";
+            items.emplace_back(score, std::string{args[pos + 1]});
+        }
+        return nullptr;
+    }
+    // 有序vector中落在区间内的元素是连续的一段，两次二分就能找到
+    static std::pair<size_t, size_t> vectorScoreSpan(const std::vector<std::pair<double, std::string>> &vec, const ScoreRange &range)
+    {
+        auto first = std::partition_point(vec.begin(), vec.end(), [&](const auto &p)
+                                          { return !range.aboveMin(p.first); });
+        auto last = std::partition_point(first, vec.end(), [&](const auto &p)
+                                         { return range.belowMax(p.first); });
+        return {static_cast<size_t>(first - vec.begin()), static_cast<size_t>(last - vec.begin())};
+    }
+    std::vector<std::pair<double, std::string>> KeyValueStore::zrangeByScore(std::string_view key, const ScoreRange &range, int64_t offset, int64_t count)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        std::vector<std::pair<double, std::string>> out;
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj || range.empty() || offset < 0)
+            return out;
+        // count为负数表示不限制个数
+        size_t limit = count < 0 ? SIZE_MAX : static_cast<size_t>(count);
+        const ZsetRecord &z = *obj->zset();
+        if (obj->_encoding == ObjectEncoding::ZsetVector)
+        {
+            auto [first, last] = vectorScoreSpan(z._items, range);
+            for (size_t i = first + static_cast<size_t>(offset); i < last && out.size() < limit; i++)
+                out.push_back(z._items[i]);
+            return out;
+        }
+        // 下界之前有多少个元素就是区间第一个元素的排名，offset也直接加在排名上，不需要逐个跳过
+        size_t below = z._skiplist->countLess(range._min, range._minex);
+        const SkiplistNode *x = z._skiplist->nodeByRank(below + static_cast<size_t>(offset) + 1);
+        for (; x && range.belowMax(x->_score) && out.size() < limit; x = x->level(0)._forward)
+            out.emplace_back(x->_score, x->member());
+        return out;
+    }
+    int64_t KeyValueStore::zcount(std::string_view key, const ScoreRange &range)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj || range.empty())
+            return 0;
+        const ZsetRecord &z = *obj->zset();
+        if (obj->_encoding == ObjectEncoding::ZsetVector)
+        {
+            auto [first, last] = vectorScoreSpan(z._items, range);
+            return static_cast<int64_t>(last - first);
+        }
+        // 两次排名查询相减，不需要遍历区间内的元素
+        size_t below = z._skiplist->countLess(range._min, range._minex);
+        size_t upTo = z._skiplist->countLess(range._max, !range._maxex);
+        return upTo > below ? static_cast<int64_t>(upTo - below) : 0;
+    }
+    int64_t KeyValueStore::zremRangeByScore(std::string_view key, const ScoreRange &range)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj || range.empty())
+            return 0;
+        ZsetRecord &z = *obj->zset();
+        size_t removed = 0;
+        if (obj->_encoding == ObjectEncoding::ZsetVector)
+        {
+            auto [first, last] = vectorScoreSpan(z._items, range);
+            for (size_t i = first; i < last; i++)
+                z._memberToScore.erase(z._items[i].second);
+            z._items.erase(z._items.begin() + static_cast<std::ptrdiff_t>(first), z._items.begin() + static_cast<std::ptrdiff_t>(last));
+            removed = last - first;
+        }
+        else
+        {
+            // 跳表上一次定位之后连续摘除整段节点，而不是对每个member单独查找删除
+            std::vector<std::string> members;
+            removed = z._skiplist->eraseRangeByScore(range, members);
+            for (const auto &m : members)
+                z._memberToScore.erase(m);
+        }
+        if (z._memberToScore.empty())
+            eraseKey(sh, key, hash);
+        return static_cast<int64_t>(removed);
+    }
+    std::optional<int64_t> KeyValueStore::zrank(std::string_view key, std::string_view member, bool reverse)
+    {
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj)
+            return std::nullopt;
+        const ZsetRecord &z = *obj->zset();
+        auto mit = z._memberToScore.find(std::string{member});
+        if (mit == z._memberToScore.end())
+            return std::nullopt;
+        int64_t rank;
+        if (obj->_encoding == ObjectEncoding::ZsetVector)
+        {
+            // 有序vector直接二分查找位置
+            auto it = std::lower_bound(z._items.begin(), z._items.end(), *mit, [](const auto &a, const auto &b)
+                                       { return lessScoreMember(a.first, a.second, b.second, b.first); });
+            rank = it - z._items.begin();
+        }
+        else
+        {
+            rank = static_cast<int64_t>(z._skiplist->rankOf(mit->second, mit->first)) - 1;
+        }
+        if (reverse)
+            rank = static_cast<int64_t>(z._memberToScore.size()) - 1 - rank;
+        return rank;
+    }
+    std::optional<double> KeyValueStore::zscore(std::string_view key, std::string_view member)
     {
-        // 由于zsetrecord中有一个专门记录member与score的map，所以查询分数这种操作是不需要去底层查找，直接使用这个专门的map获取
-        std::lock_guard<std::mutex> lock(_mutex);
-        cleanIfExpiredZset(key, nowMs());
-        auto it = _zmap.find(key);
-        if (it == _zmap.end())
+        // 由于zset中有一个专门记录member与score的map，所以查询分数这种操作是不需要去底层查找，直接使用这个专门的map获取
+        size_t hash = Dict<KeyObject>::hashOf(key);
+        Shard &sh = shardFor(hash);
+        std::lock_guard<std::mutex> lock(sh._mutex);
+        KeyObject *obj = lookupType(sh, key, hash, nowMs(), ObjectType::Zset);
+        if (!obj)
             return std::nullopt;
-        auto mit = it->second._memberToScore.find(member);
-        if (mit == it->second._memberToScore.end())
+        auto mit = obj->zset()->_memberToScore.find(std::string{member});
+        if (mit == obj->zset()->_memberToScore.end())
             return std::nullopt;
         return mit->second;
     }
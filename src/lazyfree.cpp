@@ -0,0 +1,76 @@
+#include "../include/lazyfree.h"
+#include <cstdio>
+#include <sys/eventfd.h>
+#include <unistd.h>
+namespace myredis
+{
+    LazyFree::~LazyFree()
+    {
+        if (!_thread.joinable())
+            return;
+        // 后台线程把已经投递的任务全部析构完才退出
+        _stop.store(true, std::memory_order_release);
+        uint64_t one = 1;
+        if (::write(_wakeFd, &one, sizeof(one)) < 0)
+            std::perror("failed to wake lazyfree thread");
+        _thread.join();
+        ::close(_wakeFd);
+    }
+    void LazyFree::enqueue(Job *job)
+    {
+        std::call_once(_startOnce, [this]
+                       {
+            _wakeFd = ::eventfd(0, EFD_CLOEXEC);
+            if (_wakeFd < 0)
+            {
+                std::perror("failed to create lazyfree eventfd");
+                return;
+            }
+            _thread = std::thread(&LazyFree::run, this); });
+        // 没有eventfd就唤不醒后台线程，投递进去的值永远不会被析构，这时退回到在调用线程上直接释放
+        if (_wakeFd < 0)
+        {
+            delete job;
+            _freed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        _pending.fetch_add(1, std::memory_order_relaxed);
+        Job *old = _head.load(std::memory_order_relaxed);
+        do
+        {
+            job->_next = old;
+        } while (!_head.compare_exchange_weak(old, job, std::memory_order_release, std::memory_order_relaxed));
+        // 链表原来不为空说明后台线程还没取走上一批，取的时候会把这一项一起取走
+        if (!old)
+        {
+            uint64_t one = 1;
+            if (::write(_wakeFd, &one, sizeof(one)) < 0)
+                std::perror("failed to wake lazyfree thread");
+        }
+    }
+    void LazyFree::run()
+    {
+        while (true)
+        {
+            Job *list = _head.exchange(nullptr, std::memory_order_acquire);
+            if (!list)
+            {
+                if (_stop.load(std::memory_order_acquire))
+                    break;
+                // 取空之后才阻塞，取空和阻塞之间投递进来的任务会写eventfd，read不会睡过头
+                uint64_t n;
+                if (::read(_wakeFd, &n, sizeof(n)) < 0)
+                    std::perror("failed to read lazyfree eventfd");
+                continue;
+            }
+            while (list)
+            {
+                Job *next = list->_next;
+                delete list;
+                list = next;
+                _pending.fetch_sub(1, std::memory_order_relaxed);
+                _freed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
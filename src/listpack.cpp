@@ -0,0 +1,76 @@
+#include "../include/listpack.h"
+#include "../include/memory.h"
+namespace myredis
+{
+    void Listpack::appendEntry(std::string &out, std::string_view s)
+    {
+        size_t len = s.size();
+        while (len >= 0x80)
+        {
+            out.push_back(static_cast<char>((len & 0x7f) | 0x80));
+            len >>= 7;
+        }
+        out.push_back(static_cast<char>(len));
+        out.append(s.data(), s.size());
+    }
+    size_t Listpack::allocatedBytes() const
+    {
+        return stringAllocation(_buf);
+    }
+    size_t Listpack::locate(std::string_view field) const
+    {
+        size_t pos = 0;
+        while (pos < _buf.size())
+        {
+            size_t begin = pos;
+            std::string_view f = next(pos);
+            if (f == field)
+                return begin;
+            next(pos);
+        }
+        return std::string::npos;
+    }
+    bool Listpack::find(std::string_view field, std::string_view &value) const
+    {
+        size_t pos = locate(field);
+        if (pos == std::string::npos)
+            return false;
+        next(pos);
+        value = next(pos);
+        return true;
+    }
+    bool Listpack::set(std::string_view field, std::string_view value)
+    {
+        size_t pos = locate(field);
+        if (pos == std::string::npos)
+        {
+            appendEntry(_buf, field);
+            appendEntry(_buf, value);
+            ++_count;
+            return true;
+        }
+        // 只替换value这一个元素，后面的元素整体前移或后移
+        next(pos);
+        size_t valueBegin = pos;
+        next(pos);
+        std::string encoded;
+        appendEntry(encoded, value);
+        _buf.replace(valueBegin, pos - valueBegin, encoded);
+        return false;
+    }
+    bool Listpack::erase(std::string_view field)
+    {
+        size_t begin = locate(field);
+        if (begin == std::string::npos)
+            return false;
+        size_t pos = begin;
+        next(pos);
+        next(pos);
+        _buf.erase(begin, pos - begin);
+        --_count;
+        // 删除较多之后把多余的容量还回去
+        if (_buf.capacity() > 2 * _buf.size() + 64)
+            _buf.shrink_to_fit();
+        return true;
+    }
+}
@@ -1,196 +1,130 @@
 #include "../include/memory.h"
-#include <thread>
-/*
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+// 替换全局的operator new/delete，所有经过operator new的分配(std::string、容器、字典、跳表内存池等)都会被计入
 namespace myredis
 {
-    MemoryPool *MemoryPool::pool = nullptr;
-    MemoryPool::MemoryPool() : _head{nullptr}, _freeHead{nullptr}, _freeNodeCnt{0}
+    namespace
     {
-    }
-    MemoryPool::~MemoryPool()
-    {
-        std::cout<<"~MemoryPool\n";
-        // 释放所有使用中链表节点
-        struct MemChunk *current = _head;
-        while (current != nullptr)
+        constexpr size_t kCounterSlots = 16;
+        // 每个槽独占一个缓存行，线程数超过槽数时几个线程共用一个槽，原子加保证结果仍然正确
+        struct alignas(64) Counter
         {
-            struct MemChunk *next = current->_next;
-            ::free(current->_mem);
-            ::free(current);
-            current = next;
-        }
-
-        // 释放所有空闲链表节点
-        current = _freeHead;
-        while (current != nullptr)
+            std::atomic<int64_t> _bytes{0};
+        };
+        Counter gCounters[kCounterSlots];
+        std::atomic<size_t> gNextSlot{0};
+        inline void account(void *p, int64_t sign)
         {
-            struct MemChunk *next = current->_next;
-            ::free(current->_mem);
-            ::free(current);
-            current = next;
+            thread_local Counter &local = gCounters[gNextSlot.fetch_add(1, std::memory_order_relaxed) % kCounterSlots];
+            local._bytes.fetch_add(sign * static_cast<int64_t>(malloc_usable_size(p)), std::memory_order_relaxed);
         }
-
-        _head = nullptr;
-        _freeHead = nullptr;
-    }
-    // 链表分为使用中链表和空闲链表，也就是说归还的大块可以入空闲链表，当使用中链表不足时需要申请新的大块内存，这时可以先检查空闲链表是否有节点可用，
-    // 如果有那么可以复用空闲链表的节点并且移动到使用中链表的头节点，后续还会在deallocate时检测空闲链表是否超过节点个数阈值从而主动free掉空闲链表的多余节点
-    // 分配的每一个小块头部包含长度信息，这个长度指长度本身内存长度加上要分配的内存长度
-    void *MemoryPool::allocate(size_t size)
-    {
-        //std::lock_guard<std::mutex> lock{_mtx};
-        
-        std::cout << "enter allocate\n";
-        if (size == 0)
-            throw std::bad_alloc();
-        if (size > MEM_SIZE)
-            return ::malloc(size);
-        // 如果头节点为null，那么新增一个块并且置为_head
-        if (!_head)
+        inline void *countedAlloc(size_t size) noexcept
         {
-            void *mem = malloc(sizeof(struct MemChunk));
-            if (!mem)
-                throw std::bad_alloc();
-            _head = new (mem) MemChunk();
+            void *p = std::malloc(size ? size : 1);
+            if (p)
+                account(p, 1);
+            return p;
         }
-        // 找头节点但是没有空闲内存可使用，那么优先考虑从空闲链表中拿取节点，如果没有节点，那么就需要malloc到head上了
-        if (_head && (char *)(_head->_mem) + MEM_SIZE < (char *)(_head->_ptr) + size)
+        inline void *countedAlignedAlloc(size_t size, std::align_val_t align) noexcept
         {
-            if (_freeHead)
-            {
-                struct MemChunk *tmp = _freeHead;
-                _freeHead = _freeHead->_next;
-                tmp->_next = _head;
-                _head->_prev = tmp;
-                _head = tmp;
-                tmp->_ptr = tmp->_mem;
-                _freeNodeCnt--;
-            }
-            else
-            {
-                void *mem = malloc(sizeof(struct MemChunk));
-                if (!mem)
-                    throw std::bad_alloc();
-                struct MemChunk *chunk = new (mem) MemChunk();
-                chunk->_next = _head;
-                _head->_prev = chunk;
-                _head = chunk;
-            }
+            void *p = nullptr;
+            if (posix_memalign(&p, static_cast<size_t>(align), size ? size : 1) != 0)
+                return nullptr;
+            account(p, 1);
+            return p;
         }
-        // 找到头节点并且如果头节点还有空闲内存可使用，那么从头节点中切分小块内存
-        if (_head && (char *)(_head->_mem) + MEM_SIZE >= (char *)(_head->_ptr) + size)
+        inline void countedFree(void *p) noexcept
         {
-            void *ptr = _head->_ptr;
-            *(unsigned short *)ptr = (unsigned short)size;
-            size_t sz = sizeof(unsigned short) + size;
-            _head->_ptr = (void *)((char *)(_head->_ptr) + sz);
-            _head->_availCntBytes -= sz;
-            std::cout << "ok out allocate\n";
-            return (char *)ptr + sizeof(unsigned short);
+            if (!p)
+                return;
+            account(p, -1);
+            std::free(p);
         }
-        std::cout << "no ok out allocate\n";
-        return nullptr;
-        //return ::malloc(size);
     }
-
-
-    void MemoryPool::deallocate(void *ptr)
+    size_t usedMemory()
+    {
+        int64_t sum = 0;
+        for (const Counter &c : gCounters)
+            sum += c._bytes.load(std::memory_order_relaxed);
+        // 一个线程释放另一个线程分配的内存时单个槽可能是负数，总和不会是负数
+        return sum > 0 ? static_cast<size_t>(sum) : 0;
+    }
+    static std::atomic<size_t> gPeakMemory{0};
+    void updatePeakMemory()
     {
-        std::cout << "enter deallocate\n";
-        // 归还小块内存时先考虑遍历使用中链表，找到属于哪一大块，然后对其availCntBytes加上长度
-        if(ptr==nullptr)return;
-        if(!_head)throw std::runtime_error("mem deallocate error");
-        struct MemChunk* adv=_head;
-        bool find=false;//找到大块标志位
-        do{
-            //先判断当前块是否为要找的大块内存
-            if((char*)(adv->_mem)+MEM_SIZE+sizeof(unsigned short)<ptr)continue;
-            //先拆解出ptr隐藏的长度信息
-            char* p=(char*)ptr-sizeof(unsigned short);
-            unsigned short len=*(unsigned short*)p;
-            //再对块的长度进行操作
-            adv->_availCntBytes+=len;
-            //如果空闲长度等于MEM_SIZE，那么将这个块移动到空闲链表中
-            if(adv->_availCntBytes==MEM_SIZE){
-                 adv->_prev->_next=adv->_next;
-                 adv->_next->_prev=adv->_prev;
-                 struct MemChunk* tmp=adv;
-                 adv=adv->_prev;
-                 tmp->_prev=nullptr;
-                 tmp->_next=_freeHead;
-                 _freeHead=tmp;
-                 _freeNodeCnt++;
-            }
-            find=true;
-        }while((adv=adv->_next)!=nullptr);
-        // 对于特大快来说，肯定是在上面的while过程中没有能够找到，所以需要额外的free操作
-        // if(!find)::free(ptr);
-        // 最后再来判断空闲链表是否超限,超限就需要释放掉一部分节点
-        if(_freeNodeCnt>MAX_FREE_NODE_COUNT){
-            unsigned short cnt=_freeNodeCnt-MAX_FREE_NODE_COUNT;
-            for(int i=0;i<cnt;i++){
-                struct MemChunk* tmp=_freeHead;
-                _freeHead=_freeHead->_next;
-                ::free(tmp->_mem);
-                ::free(tmp);
-            }
+        size_t used = usedMemory();
+        size_t peak = gPeakMemory.load(std::memory_order_relaxed);
+        while (used > peak && !gPeakMemory.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+        {
         }
-        std::cout << "out deallocate\n";
+    }
+    size_t peakMemory()
+    {
+        updatePeakMemory();
+        return gPeakMemory.load(std::memory_order_relaxed);
+    }
+    size_t allocationSize(const void *p)
+    {
+        return p ? malloc_usable_size(const_cast<void *>(p)) : 0;
+    }
+    size_t stringAllocation(const std::string &s)
+    {
+        const char *data = s.data();
+        const char *self = reinterpret_cast<const char *>(&s);
+        if (data >= self && data < self + sizeof(s))
+            return 0;
+        return allocationSize(data);
     }
 }
-
-long long cnt = 0;
-long long ss = 0;
 void *operator new(size_t size)
 {
-    cnt++;
-    ss = ss + 2 + size;
-    std::cout << "thread ID:" << std::this_thread::get_id() << '\n';
-    void *ptr = myredis::MemoryPool::getInstance()->allocate(size);
-    if (ptr == nullptr)
-        throw std::bad_alloc();
-    std::cout << "new was called size:" << size << " -- cnt:" << cnt << " " << "addr:" << ptr << "\n";
-    std::cout << "current allocate size:" << ss << '\n';
-    return ptr;
+    if (void *p = myredis::countedAlloc(size))
+        return p;
+    throw std::bad_alloc();
 }
-long long dcnt = 0;
-void operator delete(void *ptr)
+void *operator new[](size_t size)
 {
-    dcnt++;
-    std::cout << "delete was called -- Dcnt:" << dcnt << " " << "ptr:" << ptr << '\n';
-    myredis::MemoryPool::getInstance()->deallocate(ptr);
-}*/
-void* mem = malloc(10716650);
-char* ptr = (char*)mem;
-char* const end = ptr + 10716650;
-
-void* allocate(size_t size) {
-    // 16字节对齐
-    const size_t alignment = 16;
-    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
-    uintptr_t aligned_addr = (addr + alignment - 1) & ~(alignment - 1);
-    size_t padding = aligned_addr - addr;
-    
-    // 边界检查
-    if (ptr + padding + size > end) {
-        std::cerr << "内存耗尽！需要:" << size << " 可用:" << (end - ptr) << "\n";
-        throw std::bad_alloc();
-    }
-    
-    ptr += padding;
-    void* result = ptr;
-    ptr += size;
-    
-    std::cout << "分配大小:" << size << " 对齐后:" << (size + padding) 
-              << " 地址:" << result << "\n";
-    return result;
+    return ::operator new(size);
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return myredis::countedAlloc(size);
 }
-void* operator new(size_t size) {
-    void* p=allocate(size);
-    std::cout << "new was called size:" << size << " " << "addr:" << p << "\n";
-    return p;
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return myredis::countedAlloc(size);
+}
+void *operator new(size_t size, std::align_val_t align)
+{
+    if (void *p = myredis::countedAlignedAlloc(size, align))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size, std::align_val_t align)
+{
+    return ::operator new(size, align);
+}
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return myredis::countedAlignedAlloc(size, align);
+}
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return myredis::countedAlignedAlloc(size, align);
 }
-
-void operator delete(void* ptr){
-    
-}
\ No newline at end of file
+void operator delete(void *p) noexcept { myredis::countedFree(p); }
+void operator delete[](void *p) noexcept { myredis::countedFree(p); }
+void operator delete(void *p, size_t) noexcept { myredis::countedFree(p); }
+void operator delete[](void *p, size_t) noexcept { myredis::countedFree(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { myredis::countedFree(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { myredis::countedFree(p); }
+void operator delete(void *p, std::align_val_t) noexcept { myredis::countedFree(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { myredis::countedFree(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { myredis::countedFree(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { myredis::countedFree(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { myredis::countedFree(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { myredis::countedFree(p); }
@@ -0,0 +1,137 @@
+#include "../include/outbuf.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+namespace myredis
+{
+    namespace
+    {
+        // 每个线程最多缓存这么多空闲块，多出来的直接释放，避免一次大回复之后一直占着内存
+        const size_t kOutPoolMax = 64;
+        struct BlockPool
+        {
+            std::vector<char *> _free;
+            ~BlockPool()
+            {
+                for (char *b : _free)
+                    delete[] b;
+            }
+        };
+        thread_local BlockPool gBlockPool;
+        char *acquireBlock()
+        {
+            if (gBlockPool._free.empty())
+                return new char[kOutBlockSize];
+            char *b = gBlockPool._free.back();
+            gBlockPool._free.pop_back();
+            return b;
+        }
+        void releaseBlock(char *b)
+        {
+            if (gBlockPool._free.size() < kOutPoolMax)
+                gBlockPool._free.push_back(b);
+            else
+                delete[] b;
+        }
+    }
+    OutBuffer::~OutBuffer()
+    {
+        clear();
+    }
+    OutBuffer::OutBuffer(OutBuffer &&other) noexcept
+        : _chunks{std::move(other._chunks)}, _offset{other._offset}, _bytes{other._bytes}
+    {
+        other._chunks.clear();
+        other._offset = 0;
+        other._bytes = 0;
+    }
+    OutBuffer &OutBuffer::operator=(OutBuffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            _chunks.swap(other._chunks);
+            _offset = other._offset;
+            _bytes = other._bytes;
+            other._offset = 0;
+            other._bytes = 0;
+        }
+        return *this;
+    }
+    void OutBuffer::append(std::string_view s)
+    {
+        _bytes += s.size();
+        while (!s.empty())
+        {
+            // 队尾是写满的定长块或者是移动进来的字符串时，取一个新块
+            if (_chunks.empty() || !_chunks.back()._block || _chunks.back()._len == kOutBlockSize)
+            {
+                _chunks.emplace_back();
+                _chunks.back()._block = acquireBlock();
+            }
+            Chunk &tail = _chunks.back();
+            size_t n = std::min(s.size(), kOutBlockSize - tail._len);
+            std::memcpy(tail._block + tail._len, s.data(), n);
+            tail._len += n;
+            s.remove_prefix(n);
+        }
+    }
+    void OutBuffer::append(std::string &&s)
+    {
+        if (s.size() < kOutRefMin)
+        {
+            append(std::string_view{s});
+            return;
+        }
+        _bytes += s.size();
+        _chunks.emplace_back();
+        Chunk &c = _chunks.back();
+        c._len = s.size();
+        c._owned = std::move(s);
+    }
+    size_t OutBuffer::fillIov(iovec *iov, size_t maxIov) const
+    {
+        size_t n = 0;
+        size_t offset = _offset;
+        for (size_t i = 0; i < _chunks.size() && n < maxIov; i++)
+        {
+            const Chunk &c = _chunks[i];
+            iov[n].iov_base = const_cast<char *>(c.data() + offset);
+            iov[n].iov_len = c._len - offset;
+            n++;
+            offset = 0;
+        }
+        return n;
+    }
+    void OutBuffer::consume(size_t n)
+    {
+        _bytes -= std::min(n, _bytes);
+        while (n > 0 && !_chunks.empty())
+        {
+            Chunk &c = _chunks.front();
+            size_t avail = c._len - _offset;
+            if (n < avail)
+            {
+                _offset += n;
+                return;
+            }
+            n -= avail;
+            _offset = 0;
+            if (c._block)
+                releaseBlock(c._block);
+            _chunks.pop_front();
+        }
+    }
+    void OutBuffer::clear()
+    {
+        for (Chunk &c : _chunks)
+        {
+            if (c._block)
+                releaseBlock(c._block);
+        }
+        _chunks.clear();
+        _offset = 0;
+        _bytes = 0;
+    }
+}
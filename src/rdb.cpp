@@ -1,11 +1,16 @@
 #include "../include/rdb.h"
+#include "../include/scan.h"
 #include <system_error>
 #include <fcntl.h>
 #include <unistd.h>
 #include<iostream>
+#include <mutex>
 #include <filesystem>
 namespace myredis
 {
+    // SAVE、BGSAVE、FLUSHALL以及从节点全量同步可能在不同的reactor线程上同时调用save，
+    // 它们写的是同一个文件，两边都用O_TRUNC打开会把内容写乱，所以所有Rdb对象共用这一把锁
+    static std::mutex gSaveMutex;
     // 拼接文件路径
     static std::string joinPath(const std::string &dir, const std::string &filename)
     {
@@ -27,6 +32,7 @@ namespace myredis
         // 先判断rdb选项参数中的enabled是否为true，只有true才能执行save操作
         if (!_opts._enabled)
             return true;
+        std::lock_guard<std::mutex> lock(gSaveMutex);
         std::error_code ec;
         if (!std::filesystem::create_directories(_opts._dir, ec))
         {
@@ -125,7 +131,7 @@ namespace myredis
             for (const auto &[s, m] : data._value)
             {
                 std::string zsetBodyLines{};
-                zsetBodyLines.append(std::to_string(s)).append(" ").append(std::to_string(m.size())).append(" ").append(m).append("\n");
+                zsetBodyLines.append(formatScore(s)).append(" ").append(std::to_string(m.size())).append(" ").append(m).append("\n");
                 if (::write(fd, zsetBodyLines.c_str(), zsetBodyLines.size()) < 0)
                 {
                     ::close(fd);
@@ -168,9 +174,12 @@ namespace myredis
         // 读取file中的一行，这个一行就是指'\n'结束之前内容，然后将这个截取出来的字符串分配给传入参数out
         auto readLine = [&](std::string &out) -> bool
         {
-            size_t e = file.find('\n', pos);
-            if (e == std::string::npos)
+            if (pos >= file.size())
                 return false;
+            size_t e = findByte(file.data() + pos, file.size() - pos, '\n');
+            if (e == kScanNotFound)
+                return false;
+            e += pos;
             out.assign(file.data() + pos, e - pos);
             pos = e + 1;
             return true;
@@ -373,7 +382,7 @@ namespace myredis
                 store.hset(key, tmp);
                 if (exp >= 0)
                 {
-                    store.setHashExpireAtMs(key, exp);
+                    store.setExpireAtMs(key, exp);
                 }
             }
         }
@@ -447,7 +456,7 @@ namespace myredis
                 itemsVec.push_back({sc,member});
             }
             store.zadd(key,itemsVec);
-            if(exp>=0)store.setZsetExpireAtMs(key,exp);
+            if(exp>=0)store.setExpireAtMs(key,exp);
         }
         return true;
     }
@@ -99,69 +99,97 @@ namespace myredis
                     std::string cmd;
                     for (auto &c : v->_array[0]._bulk)
                         cmd.push_back(static_cast<char>(::toupper(c)));
-                    if (cmd == "SET" && v->_array.size() == 3)
+                    // 类型不符的命令在命令层只会回复WRONGTYPE、不会修改数据，这里同样记一条日志跳过，不能让异常终止整个复制线程
+                    try
                     {
-                        gStore.set(v->_array[1]._bulk, v->_array[2]._bulk);
-                    }
-                    else if (cmd == "DEL" && v->_array.size() >= 2)
-                    {
-                        std::vector<std::string> args;
-                        for (int i = 1; i < v->_array.size(); i++)
-                            args.emplace_back(v->_array[i]._bulk);
-                        gStore.del(args);
-                    }
-                    else if (cmd == "EXPIRE" && v->_array.size() == 3)
-                    {
-                        int64_t s = std::stoll(v->_array[2]._bulk);
-                        gStore.expire(v->_array[1]._bulk, s);
-                    }
-                    else if (cmd == "HSET" && v->_array.size() >= 4 && !(v->_array.size() % 2))
-                    {
-                        std::vector<std::string> args;
-                        for (int i = 2; i < v->_array.size(); i++)
-                            args.push_back(v->_array[i]._bulk);
-                        gStore.hset(v->_array[1]._bulk, args);
-                    }
-                    else if (cmd == "HDEL" && v->_array.size() >= 3)
-                    {
-                        std::vector<std::string> fs;
-                        for (size_t i = 2; i < v->_array.size(); ++i)
-                            fs.emplace_back(v->_array[i]._bulk);
-                        gStore.hdel(v->_array[1]._bulk, fs);
-                    }
-                    else if (cmd == "ZADD" && v->_array.size() >= 4 && !(v->_array.size() % 2))
-                    {
-                        std::vector<std::pair<double, std::string>> args;
-                        for (int i = 2; i < v->_array.size(); i += 2)
+                        if (cmd == "SET" && v->_array.size() == 3)
                         {
-                            double sc = std::stod(v->_array[i]._bulk);
-                            std::string member = v->_array[i + 1]._bulk;
-                            args.push_back({sc, member});
+                            gStore.set(v->_array[1]._bulk, v->_array[2]._bulk);
                         }
-                        gStore.zadd(v->_array[1]._bulk, args);
-                    }
-                    else if (cmd == "ZREM" && v->_array.size() >= 3)
-                    {
-                        std::vector<std::string> ms;
-                        for (size_t i = 2; i < v->_array.size(); ++i)
-                            ms.emplace_back(v->_array[i]._bulk);
-                        gStore.zrem(v->_array[1]._bulk, ms);
-                    }
-                    else if (v->_type == RespType::SimpleString)
-                    {
-                        // parse +OFFSET <num>
-                        const std::string &s = v->_bulk;
-                        if (s.rfind("OFFSET ", 0) == 0)
+                        else if ((cmd == "DEL" || cmd == "UNLINK") && v->_array.size() >= 2)
                         {
-                            try
-                            {
-                                _lastOffset = std::stoll(s.substr(8));
-                            }
-                            catch (...)
+                            std::vector<std::string> args;
+                            for (int i = 1; i < v->_array.size(); i++)
+                                args.emplace_back(v->_array[i]._bulk);
+                            gStore.del(args, cmd == "UNLINK");
+                        }
+                        else if (cmd == "FLUSHALL" && v->_array.size() <= 2)
+                        {
+                            std::string mode;
+                            for (size_t i = 1; i < v->_array.size(); i++)
+                                for (auto &c : v->_array[i]._bulk)
+                                    mode.push_back(static_cast<char>(::toupper(c)));
+                            gStore.clearAll(mode == "ASYNC");
+                        }
+                        else if (cmd == "EXPIRE" && v->_array.size() == 3)
+                        {
+                            int64_t s = std::stoll(v->_array[2]._bulk);
+                            gStore.expire(v->_array[1]._bulk, s);
+                        }
+                        else if (cmd == "HSET" && v->_array.size() >= 4 && !(v->_array.size() % 2))
+                        {
+                            std::vector<std::string> args;
+                            for (int i = 2; i < v->_array.size(); i++)
+                                args.push_back(v->_array[i]._bulk);
+                            gStore.hset(v->_array[1]._bulk, args);
+                        }
+                        else if (cmd == "HDEL" && v->_array.size() >= 3)
+                        {
+                            std::vector<std::string> fs;
+                            for (size_t i = 2; i < v->_array.size(); ++i)
+                                fs.emplace_back(v->_array[i]._bulk);
+                            gStore.hdel(v->_array[1]._bulk, fs);
+                        }
+                        else if (cmd == "ZADD" && v->_array.size() >= 4)
+                        {
+                            // 选项和命令处理时一样解析，NX/XX/GT/LT/INCR在回放时得到相同的结果
+                            std::vector<std::string_view> view;
+                            for (const auto &a : v->_array)
+                                view.emplace_back(a._bulk);
+                            int flags = 0;
+                            std::vector<std::pair<double, std::string>> args;
+                            if (!parseZaddArgs(view, 2, flags, args))
+                                gStore.zadd(v->_array[1]._bulk, args, flags);
+                        }
+                        else if (cmd == "ZINCRBY" && v->_array.size() == 4)
+                        {
+                            double incr;
+                            if (parseScore(v->_array[2]._bulk, incr))
+                                gStore.zadd(v->_array[1]._bulk, {{incr, v->_array[3]._bulk}}, kZaddIncr);
+                        }
+                        else if (cmd == "ZREM" && v->_array.size() >= 3)
+                        {
+                            std::vector<std::string> ms;
+                            for (size_t i = 2; i < v->_array.size(); ++i)
+                                ms.emplace_back(v->_array[i]._bulk);
+                            gStore.zrem(v->_array[1]._bulk, ms);
+                        }
+                        else if (cmd == "ZREMRANGEBYSCORE" && v->_array.size() == 4)
+                        {
+                            ScoreRange range;
+                            if (parseScoreRange(v->_array[2]._bulk, v->_array[3]._bulk, range))
+                                gStore.zremRangeByScore(v->_array[1]._bulk, range);
+                        }
+                        else if (v->_type == RespType::SimpleString)
+                        {
+                            // parse +OFFSET <num>
+                            const std::string &s = v->_bulk;
+                            if (s.rfind("OFFSET ", 0) == 0)
                             {
+                                try
+                                {
+                                    _lastOffset = std::stoll(s.substr(8));
+                                }
+                                catch (...)
+                                {
+                                }
                             }
                         }
                     }
+                    catch (const WrongTypeError &e)
+                    {
+                        std::cerr << "replica apply: skip " << cmd << ": " << e.what() << "\n";
+                    }
                 }
             }
         }
@@ -1,230 +1,350 @@
 #include "../include/resp.h"
+#include "../include/scan.h"
 #include <charconv>
+#include <algorithm>
 namespace myredis
 {
+    // 数组长度由客户端决定，预留空间设一个上限，避免一个很大的假长度直接分配出大量内存
+    static const size_t kMaxArrayReserve = 1024;
+    // 和redis的proto-max-bulk-len一样，单个bulk最长512MB，超过直接按协议错误处理
+    static const int64_t kMaxBulkLen = 512LL * 1024 * 1024;
+    // bulk的数据还没收到，按声明的长度预留空间最多预留这么多，之后随数据到达再增长
+    static const size_t kMaxBulkReserve = 16 * 1024 * 1024;
+    // 已解析走的数据超过这个大小并且占了_buf一半以上时才搬移，避免每条命令都erase一次
+    static const size_t kCompactThreshold = 64 * 1024;
+
     void RespParser::append(std::string_view data)
     {
+        if (_start > 0)
+        {
+            if (_start == _buf.size())
+            {
+                _buf.clear();
+                _pos -= _start;
+                _scan = _scan > _start ? _scan - _start : 0;
+                _start = 0;
+            }
+            else if (_start >= kCompactThreshold && _start * 2 >= _buf.size())
+            {
+                _buf.erase(0, _start);
+                _pos -= _start;
+                _scan = _scan > _start ? _scan - _start : 0;
+                _start = 0;
+            }
+        }
         _buf.append(data.data(), data.length());
     }
-    //得到pos开始第一个"\r\n"之前的数据并且pos要移动到"\r\n"后面一格位置
-    bool RespParser::parseLine(size_t &pos, std::string &outLine)
+    // 协议错误后丢掉所有数据和解析状态，否则同一段坏数据会被反复解析
+    void RespParser::reset()
     {
-        size_t end = _buf.find("\r\n", pos);
-        if (end == std::string::npos)
-            return false;
-        outLine.assign(_buf.data() + pos, end - pos);
-        pos = end + 2;
-        return true;
+        _buf.clear();
+        _start = _pos = _scan = 0;
+        _bulkLen = -1;
+        _stack.clear();
+        _argc = -1;
+        _spans.clear();
     }
-    //得到简单字符串，简单字符串形如"+OK\r\n",通过parseLine得到这个Ok，所以这里也是已经将pos移动到"\r\n"后一格了
-    bool RespParser::parseSimple(size_t &pos, RespType type, RespValue &out)
+    // 得到_pos处类型符号之后、第一个"\r\n"之前的数据，成功时_pos移动到"\r\n"后一格
+    // 没找到时记下已经扫描过的位置，数据没到齐的长行不会被重复扫描
+    bool RespParser::parseLine(std::string_view &outLine)
     {
-        std::string s;
-        if (!parseLine(pos, s))
+        size_t from = std::max(_scan, _pos + 1);
+        size_t end = from < _buf.size() ? findCrlf(_buf.data() + from, _buf.size() - from) : kScanNotFound;
+        if (end == kScanNotFound)
+        {
+            // 最后一个字节可能是'\r'，下次要把它也包括进来
+            _scan = _buf.empty() ? 0 : std::max(_pos + 1, _buf.size() - 1);
             return false;
-        out._type = type;
-        out._bulk = std::move(s);
+        }
+        end += from;
+        outLine = std::string_view{_buf.data() + _pos + 1, end - _pos - 1};
+        _pos = end + 2;
+        _scan = 0;
         return true;
     }
-    //Integer其实和之前的简单字符串的形式很像，形如":123\r\n",那么直接调用parseLine得到123,并且也是将pos移动到"\r\n"后一格了
-    bool RespParser::parseInteger(size_t &pos, int64_t &out)
+    static bool toInteger(std::string_view s, int64_t &out)
     {
-        std::string s;
-        if (!parseLine(pos, s))
-            return false;
-        int64_t integer = 0;
         auto end = s.data() + s.size();
-        auto [ptr, ec] = std::from_chars(s.data(), end, integer);
-        if (ec != std::errc{} || ptr != end)
-            return false;
-        out = integer;
-        return true;
-    }
-    //形如"$8\r\nwohenhao\r\n"就是bulkString,特点是前半段是Integer这样的格式，后半段是simpleString这样的格式，所以我们可以先调用parseInteger得到这个8,这时候pos已经移动到\
-        'w'这个位置，然后直接利用pos位置加上8这个长度信息拿到这个bulkString内容，最后再移动pos到末尾的"\r\n"后一格
-    bool RespParser::parseBulkString(size_t &pos, RespValue &out)
-    {
-        int64_t stringLen = 0;
-        if (!parseInteger(pos, stringLen))
-            return false;
-        if (stringLen == -1)
-        {
-            // 说明这个字符串为NULL
-            out._type = RespType::Null;
-            return true;
-        }
-        if (stringLen < 0)
-        {
-            // 协议层面错误
-            return false;
-        }
-        //_buf实际长度如果小于pos+前面的字符串长度信息+'\r\n'这个长度，那么说明对不上
-        if (_buf.size() < pos + static_cast<size_t>(stringLen) + 2)
-            return false;
-        out._type = RespType::BulkString;
-        out._bulk.assign(_buf.data() + pos, static_cast<size_t>(stringLen));
-        pos += static_cast<size_t>(stringLen);
-        // 如果在字符串中安插\r\n也是直接返回false
-        if (!(pos + 1 < _buf.size() && _buf[pos] == '\r' && _buf[pos + 1] == '\n'))
-            return false;
-        pos += 2;
-        return true;
+        auto [ptr, ec] = std::from_chars(s.data(), end, out);
+        return ec == std::errc{} && ptr == end && !s.empty();
     }
-    //数组形如"*2\r\n$3\r\nfoo\r\n$3\r\nbar\r\n",开头标明数组元素个数，后面就是任意五种resp协议数据类型
-    //所以先使用parseInteger得到数组长度，将pos移动到'$'处，然后开始循环拿到后面的元素
-    bool RespParser::parseArray(size_t &pos, RespValue &out)
+    // 状态机：每次要么读完一个bulk的数据体，要么读一行(简单字符串、错误、整数、bulk长度或者数组长度)
+    // 读出一个完整的元素后挂到栈顶数组上，数组收齐了再作为元素挂到上一层，栈空时就得到了一条完整的命令
+    RespParser::Status RespParser::parseNext(RespValue &out)
     {
-        int64_t count = 0;
-        if (!parseInteger(pos, count))
-            return false;
-        // 同样的，如果数组最开始位置的数字为-1，说明这是一个空值
-        if (count == -1)
+        while (1)
         {
-            out._type = RespType::Null;
-            return true;
-        }
-        if (count < 0)
-            return false;
-        out._type = RespType::Array;
-        out._array.clear();
-        out._array.reserve(static_cast<size_t>(count));
-        for (size_t i = 0; i < count; i++)
-        {
-            //判断pos位置是否移出_buf
-            if (pos >= _buf.size())
-                return false;
-            // 记录前缀
-            char prefix = _buf[pos++]; 
             RespValue elem;
-            bool ok = false;
-            switch (prefix)
+            if (_bulkLen >= 0)
             {
-            case '+':
-                ok = parseSimple(pos, RespType::SimpleString, elem);
-                break;
-            case '-':
-                ok = parseSimple(pos, RespType::Error, elem);
-                break;
-            case ':':
+                // 形如"$8\r\nwohenhao\r\n"，长度行已经读过了，这里等数据体和结尾的"\r\n"全部到齐
+                size_t len = static_cast<size_t>(_bulkLen);
+                if (_buf.size() < _pos + len + 2)
+                    return Status::Incomplete;
+                // 如果在字符串中安插\r\n也是协议错误
+                if (_buf[_pos + len] != '\r' || _buf[_pos + len + 1] != '\n')
+                    return Status::ProtocolError;
+                elem._type = RespType::BulkString;
+                elem._bulk.assign(_buf.data() + _pos, len);
+                _pos += len + 2;
+                _bulkLen = -1;
+            }
+            else
             {
-                int64_t integer = 0;
-                ok = parseInteger(pos, integer);
-                if (ok)
+                if (_pos >= _buf.size())
+                    return Status::Incomplete;
+                char prefix = _buf[_pos];
+                if (prefix != '+' && prefix != '-' && prefix != ':' && prefix != '$' && prefix != '*')
+                    return Status::ProtocolError;
+                std::string_view line;
+                if (!parseLine(line))
+                    return Status::Incomplete;
+                if (prefix == '+' || prefix == '-')
                 {
-                    elem._type = RespType::Integer;
-                    elem._bulk = std::to_string(integer);
+                    elem._type = prefix == '+' ? RespType::SimpleString : RespType::Error;
+                    elem._bulk.assign(line.data(), line.size());
+                }
+                else
+                {
+                    int64_t integer = 0;
+                    if (!toInteger(line, integer))
+                        return Status::ProtocolError;
+                    if (prefix == ':')
+                    {
+                        elem._type = RespType::Integer;
+                        elem._bulk = std::to_string(integer);
+                    }
+                    else if (integer == -1)
+                    {
+                        // "$-1\r\n"和"*-1\r\n"都表示空值
+                        elem._type = RespType::Null;
+                    }
+                    else if (integer < 0)
+                    {
+                        return Status::ProtocolError;
+                    }
+                    else if (prefix == '$')
+                    {
+                        if (integer > kMaxBulkLen)
+                            return Status::ProtocolError;
+                        // 大value提前把缓冲区扩到位，之后多次append不用反复搬移
+                        _bulkLen = integer;
+                        _buf.reserve(_pos + std::min(static_cast<size_t>(integer), kMaxBulkReserve) + 2);
+                        continue;
+                    }
+                    else if (integer > 0)
+                    {
+                        Frame frame;
+                        frame._value._type = RespType::Array;
+                        frame._value._array.reserve(std::min(static_cast<size_t>(integer), kMaxArrayReserve));
+                        frame._remaining = static_cast<size_t>(integer);
+                        _stack.emplace_back(std::move(frame));
+                        continue;
+                    }
+                    else
+                    {
+                        elem._type = RespType::Array;
+                    }
                 }
-                break;
             }
-            case '$':
-                ok = parseBulkString(pos, elem);
-                break;
-            case '*':
-                ok = parseArray(pos, elem);
-                break;
-            default:
-                return false;
+            // 得到一个完整元素，向上挂到数组里，收齐的数组继续向上挂
+            while (1)
+            {
+                if (_stack.empty())
+                {
+                    out = std::move(elem);
+                    return Status::Done;
+                }
+                Frame &top = _stack.back();
+                top._value._array.emplace_back(std::move(elem));
+                if (--top._remaining > 0)
+                    break;
+                elem = std::move(top._value);
+                _stack.pop_back();
             }
-            if(!ok)return false;
-            out._array.emplace_back(std::move(elem));
         }
-        return true;
     }
-    std::optional<RespValue> RespParser::tryParseOne(){
-        if (_buf.empty())
-            return std::nullopt;
-        size_t pos = 0;
-        char prefix = _buf[pos++]; // 得到最前面的符号，用来区别不同命令
+    std::optional<RespValue> RespParser::tryParseOne()
+    {
         RespValue out;
-        bool ok = false;
-        switch (prefix)
-        {
-        case '+':
-            ok = parseSimple(pos, RespType::SimpleString, out);
-            break;
-        case '-':
-            ok = parseSimple(pos, RespType::Error, out);
-            break;
-        case ':':
+        switch (parseNext(out))
         {
-            int64_t integer = 0;
-            ok = parseInteger(pos, integer);
-            if (ok)
-            {
-                out._type = RespType::Integer;
-                out._bulk = std::to_string(integer);
-            }
-            break;
-        }
-        case '$':
-            ok = parseBulkString(pos, out);
-            break;
-        case '*':
-            ok = parseArray(pos, out);
+        case Status::Incomplete:
+            return std::nullopt;
+        case Status::ProtocolError:
+            reset();
+            return std::make_optional(RespValue{RespType::Error, std::string{"protocol error"}, {}});
+        case Status::Done:
             break;
-        default:
-            return std::make_optional(RespValue{RespType::Error,std::string{"protocol error"}});
         }
-        if(!ok)return std::nullopt;
-        _buf.erase(0,pos);
+        _start = _pos;
         return out;
     }
-    std::optional<std::pair<RespValue, std::string>> RespParser::tryParseOneWithRaw()
+    // 客户端发来的命令一定是"*n\r\n"后面跟n个bulk string，这里只记录每个参数在缓冲区中的位置，收全后一次性生成view
+    RespParser::Status RespParser::tryParseCommand(RespCommand &out)
     {
-        if (_buf.empty())
-            return std::nullopt;
-        size_t pos = 0;
-        char prefix = _buf[pos++]; // 得到最前面的符号，用来区别不同命令
-        RespValue out;
-        bool ok = false;
-        switch (prefix)
+        while (1)
         {
-        case '+':
-            ok = parseSimple(pos, RespType::SimpleString, out);
-            break;
-        case '-':
-            ok = parseSimple(pos, RespType::Error, out);
-            break;
-        case ':':
-        {
-            int64_t integer = 0;
-            ok = parseInteger(pos, integer);
-            if (ok)
+            std::string_view line;
+            if (_argc < 0)
             {
-                out._type = RespType::Integer;
-                out._bulk = std::to_string(integer);
+                if (_pos >= _buf.size())
+                    return Status::Incomplete;
+                if (_buf[_pos] != '*')
+                    break;
+                if (!parseLine(line))
+                    return Status::Incomplete;
+                int64_t argc = 0;
+                if (!toInteger(line, argc) || argc < -1)
+                    break;
+                _argc = argc < 0 ? 0 : argc;
+                _spans.clear();
+                _spans.reserve(std::min(static_cast<size_t>(_argc), kMaxArrayReserve));
             }
-            break;
-        }
-        case '$':
-            ok = parseBulkString(pos, out);
-            break;
-        case '*':
-            ok = parseArray(pos, out);
-            break;
-        default:
-            return std::make_optional(std::make_pair(RespValue{RespType::Error,std::string{"protocol error"},{}},std::string{}));
+            if (_spans.size() == static_cast<size_t>(_argc))
+            {
+                out._args.clear();
+                out._args.reserve(_spans.size());
+                for (auto &[off, len] : _spans)
+                    out._args.emplace_back(_buf.data() + _start + off, len);
+                out._raw = std::string_view{_buf.data() + _start, _pos - _start};
+                _start = _pos;
+                _argc = -1;
+                return Status::Done;
+            }
+            if (_bulkLen >= 0)
+            {
+                size_t len = static_cast<size_t>(_bulkLen);
+                if (_buf.size() < _pos + len + 2)
+                    return Status::Incomplete;
+                if (_buf[_pos + len] != '\r' || _buf[_pos + len + 1] != '\n')
+                    break;
+                _spans.emplace_back(_pos - _start, len);
+                _pos += len + 2;
+                _bulkLen = -1;
+                continue;
+            }
+            if (_pos >= _buf.size())
+                return Status::Incomplete;
+            if (_buf[_pos] != '$')
+                break;
+            if (!parseLine(line))
+                return Status::Incomplete;
+            int64_t len = 0;
+            if (!toInteger(line, len) || len < 0 || len > kMaxBulkLen)
+                break;
+            _bulkLen = len;
+            _buf.reserve(_pos + std::min(static_cast<size_t>(len), kMaxBulkReserve) + 2);
         }
-        if(!ok)return std::nullopt;
-        //拿到_buf的全部数据后清空_buf
-        std::string raw{_buf.data(),pos};
-        _buf.erase(0,pos);
-        return std::make_pair(std::move(out),std::move(raw));
+        reset();
+        return Status::ProtocolError;
     }
 
     std::string respSimpleString(std::string_view s){
-        return std::string{"+"}+std::string{s}+std::string{"\r\n"};
+        std::string out;
+        out.reserve(s.size()+3);
+        out.push_back('+');
+        out.append(s);
+        out.append("\r\n");
+        return out;
     }
     std::string respError(std::string_view s){
-        return std::string{"-"}+std::string{s}+std::string{"\r\n"};
+        std::string out;
+        out.reserve(s.size()+3);
+        out.push_back('-');
+        out.append(s);
+        out.append("\r\n");
+        return out;
     }
     std::string respBulkString(std::string_view s){
-        return std::string{"$"}+std::to_string(s.length())+std::string{"\r\n"}+std::string{s}+std::string{"\r\n"};
+        char head[24];
+        head[0]='$';
+        char* end=std::to_chars(head+1,head+sizeof(head),s.size()).ptr;
+        std::string out;
+        out.reserve(static_cast<size_t>(end-head)+s.size()+4);
+        out.append(head,end);
+        out.append("\r\n");
+        out.append(s);
+        out.append("\r\n");
+        return out;
     }
     std::string respNullBulk(){
-        return "$-1\r\n";
+        return std::string{kReplyNullBulk};
     }
     std::string respInteger(int64_t val){
-        return std::string{":"}+std::to_string(val)+std::string{"\r\n"};
+        if(val>=0&&val<kSharedIntegers)
+            return std::string{sharedInteger(val)};
+        char buf[24];
+        buf[0]=':';
+        char* end=std::to_chars(buf+1,buf+sizeof(buf),val).ptr;
+        std::string out{buf,end};
+        out.append("\r\n");
+        return out;
+    }
+
+    namespace{
+        //所有共享整数回复连续存放在一个字符串里，_offsets[i]是":i\r\n"的起始位置
+        struct SharedIntegers{
+            std::string _text;
+            std::vector<uint32_t> _offsets;
+            SharedIntegers(){
+                _offsets.reserve(kSharedIntegers+1);
+                char buf[24];
+                for(int64_t i=0;i<kSharedIntegers;i++){
+                    _offsets.push_back(static_cast<uint32_t>(_text.size()));
+                    buf[0]=':';
+                    char* end=std::to_chars(buf+1,buf+sizeof(buf),i).ptr;
+                    _text.append(buf,end);
+                    _text.append("\r\n");
+                }
+                _offsets.push_back(static_cast<uint32_t>(_text.size()));
+            }
+        };
+        const SharedIntegers gSharedIntegers;
+    }
+    std::string_view sharedInteger(int64_t val){
+        size_t begin=gSharedIntegers._offsets[static_cast<size_t>(val)];
+        size_t end=gSharedIntegers._offsets[static_cast<size_t>(val)+1];
+        return std::string_view{gSharedIntegers._text}.substr(begin,end-begin);
+    }
+
+    void RespWriter::header(char prefix,int64_t val){
+        char buf[24];
+        buf[0]=prefix;
+        char* end=std::to_chars(buf+1,buf+sizeof(buf)-2,val).ptr;
+        *end++='\r';
+        *end++='\n';
+        _out.append(std::string_view{buf,static_cast<size_t>(end-buf)});
+    }
+    void RespWriter::simple(std::string_view s){
+        char prefix='+';
+        _out.append(std::string_view{&prefix,1});
+        _out.append(s);
+        _out.append(std::string_view{"\r\n",2});
+    }
+    void RespWriter::error(std::string_view s){
+        char prefix='-';
+        _out.append(std::string_view{&prefix,1});
+        _out.append(s);
+        _out.append(std::string_view{"\r\n",2});
+    }
+    void RespWriter::integer(int64_t val){
+        if(val>=0&&val<kSharedIntegers)
+            _out.append(sharedInteger(val));
+        else
+            header(':',val);
+    }
+    void RespWriter::bulk(std::string_view s){
+        header('$',static_cast<int64_t>(s.size()));
+        _out.append(s);
+        _out.append(std::string_view{"\r\n",2});
+    }
+    void RespWriter::bulk(std::string&& s){
+        header('$',static_cast<int64_t>(s.size()));
+        _out.append(std::move(s));
+        _out.append(std::string_view{"\r\n",2});
+    }
+    void RespWriter::arrayHeader(size_t n){
+        header('*',static_cast<int64_t>(n));
     }
 }
@@ -0,0 +1,158 @@
+#include "../include/scan.h"
+#include <cstring>
+#include <cstdint>
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define MYREDIS_SCAN_X86 1
+#endif
+namespace myredis
+{
+    size_t findCrlfScalar(const char *data, size_t len)
+    {
+        for (size_t i = 0; i + 1 < len; i++)
+        {
+            if (data[i] == '\r' && data[i + 1] == '\n')
+                return i;
+        }
+        return kScanNotFound;
+    }
+    static size_t findByteScalar(const char *data, size_t len, char ch)
+    {
+        const void *p = std::memchr(data, ch, len);
+        return p ? static_cast<size_t>(static_cast<const char *>(p) - data) : kScanNotFound;
+    }
+#ifdef MYREDIS_SCAN_X86
+    // 一次比较16字节：在i处和i+1处各加载一次，'\r'的掩码和'\n'的掩码按位与，得到的每一位就是一个完整的"\r\n"
+    static size_t findCrlfSse2(const char *data, size_t len)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 16 < len; i += 16)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf))));
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+        size_t rest = findCrlfScalar(data + i, len - i);
+        return rest == kScanNotFound ? kScanNotFound : i + rest;
+    }
+    static size_t findByteSse2(const char *data, size_t len, char ch)
+    {
+        const __m128i needle = _mm_set1_epi8(ch);
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, needle)));
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+        size_t rest = findByteScalar(data + i, len - i, ch);
+        return rest == kScanNotFound ? kScanNotFound : i + rest;
+    }
+    // AVX2版本一次比较32字节，只在这两个函数上打开avx2，其余代码仍按基础指令集编译
+    __attribute__((target("avx2"))) static size_t findCrlfAvx2(const char *data, size_t len)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        size_t i = 0;
+        // 每轮处理64字节，两个32字节块的结果先合并判断一次，命中了再分别取掩码
+        for (; i + 64 < len; i += 64)
+        {
+            __m256i m0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), cr),
+                                          _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 1)), lf));
+            __m256i m1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32)), cr),
+                                          _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 33)), lf));
+            if (!_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1)))
+            {
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(m0));
+                if (mask)
+                    return i + static_cast<size_t>(__builtin_ctz(mask));
+                return i + 32 + static_cast<size_t>(__builtin_ctz(static_cast<uint32_t>(_mm256_movemask_epi8(m1))));
+            }
+        }
+        for (; i + 32 < len; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 1));
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf))));
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+        size_t rest = findCrlfSse2(data + i, len - i);
+        return rest == kScanNotFound ? kScanNotFound : i + rest;
+    }
+    __attribute__((target("avx2"))) static size_t findByteAvx2(const char *data, size_t len, char ch)
+    {
+        const __m256i needle = _mm256_set1_epi8(ch);
+        size_t i = 0;
+        for (; i + 64 <= len; i += 64)
+        {
+            __m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), needle);
+            __m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32)), needle);
+            if (!_mm256_testz_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m0, m1)))
+            {
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(m0));
+                if (mask)
+                    return i + static_cast<size_t>(__builtin_ctz(mask));
+                return i + 32 + static_cast<size_t>(__builtin_ctz(static_cast<uint32_t>(_mm256_movemask_epi8(m1))));
+            }
+        }
+        for (; i + 32 <= len; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, needle)));
+            if (mask)
+                return i + static_cast<size_t>(__builtin_ctz(mask));
+        }
+        size_t rest = findByteSse2(data + i, len - i, ch);
+        return rest == kScanNotFound ? kScanNotFound : i + rest;
+    }
+#endif
+    // 实现只在第一次调用时选一次，之后都走同一个函数指针
+    struct ScanImpl
+    {
+        size_t (*_crlf)(const char *, size_t);
+        size_t (*_byte)(const char *, size_t, char);
+        const char *_name;
+    };
+    static ScanImpl selectImpl()
+    {
+#ifdef MYREDIS_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return ScanImpl{findCrlfAvx2, findByteAvx2, "avx2"};
+        return ScanImpl{findCrlfSse2, findByteSse2, "sse2"};
+#else
+        return ScanImpl{findCrlfScalar, findByteScalar, "scalar"};
+#endif
+    }
+    // 静态初始化时就选好，热路径上不需要再判断是否已经初始化
+    static const ScanImpl gScanImpl = selectImpl();
+    // resp里的长度行一般只有几个字节，先逐字节看前kScanHead个字节，多数情况下在这里就找到了，找不到再交给向量化实现
+    static const size_t kScanHead = 16;
+    size_t findCrlf(const char *data, size_t len)
+    {
+        size_t head = len < kScanHead ? len : kScanHead;
+        for (size_t i = 0; i < head && i + 1 < len; i++)
+        {
+            if (data[i] == '\r' && data[i + 1] == '\n')
+                return i;
+        }
+        if (len <= kScanHead)
+            return kScanNotFound;
+        size_t rest = gScanImpl._crlf(data + kScanHead, len - kScanHead);
+        return rest == kScanNotFound ? kScanNotFound : kScanHead + rest;
+    }
+    size_t findByte(const char *data, size_t len, char ch)
+    {
+        return gScanImpl._byte(data, len, ch);
+    }
+    const char *scanImplName()
+    {
+        return gScanImpl._name;
+    }
+}
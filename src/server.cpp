@@ -17,12 +17,25 @@
 #include <string_view>
 #include<csignal>
 #include <charconv>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <deque>
+#include <poll.h>
+#include <climits>
 #include "../include/rdb.h"
 #include "../include/resp.h"
 #include "../include/kv.h"
 #include "../include/server.h"
 #include "../include/aof.h"
+#include "../include/config_loader.h"
+#include "../include/memory.h"
 #include"../include/replica_client.h"
+#include "../include/uring.h"
+#include "../include/outbuf.h"
 // namespace myredis这样是正常的命名空间，对外文件public
 namespace myredis
 {
@@ -30,7 +43,19 @@ namespace myredis
     static AofLogger gAof;
     static Rdb gRdb;
     int64_t gRepliBacklogOffset = 0;
+    // 启动完成、载入数据之前的已用内存，MEMORY STATS的startup.allocated
+    static size_t gStartupMemory = 0;
+    // 写命令在各reactor线程上并发执行时，执行、写aof、进复制队列这三步都在这把锁里完成，
+    // aof和复制流里命令的先后顺序才和它们真正修改数据的顺序一致；读命令不拿这把锁
+    static std::mutex gWriteMutex;
+    // 所有reactor线程执行的写命令按执行顺序放进同一个复制队列，由gReplMutex保护，一轮读事件处理完后推送给从节点
     static std::vector<std::vector<std::string>> gReplQueue;
+    // 本线程往复制队列里放过命令、还没推送，没有写命令的线程不用去抢gReplMutex
+    static thread_local bool gReplPending = false;
+    // 保护复制积压缓冲区、复制偏移量、复制队列以及从节点登记表，多个reactor线程会同时访问它们
+    static std::mutex gReplMutex;
+    // 复制积压缓冲区，最多保留kReplBacklogCap字节最近的复制流
+    static std::string gReplBacklog{};
     // 而namespace{}这种就是匿名命名空间，对外文件来说是private的
     namespace
     {
@@ -65,83 +90,216 @@ namespace myredis
         {
             int _fd = -1;
             std::string _in = "";                // 接收缓冲区
-            std::vector<std::string> _outChunks; // 发送块队列缓冲区
-            size_t _outIndex;                    // 当前发送块的下标
-            size_t _outOffset;                   // 当前发送快的块内偏移
+            OutBuffer _out;                      // 发送缓冲区，小回复直接拷贝进池化的定长块，大value整块移动进来
             RespParser _parser{};                // resp解析器对象
             bool isReplica = false;              // 标志该条连接是否为从节点
+            uint64_t _id = 0;                    // 连接序号，fd会被复用，跨线程投递数据时用它确认还是同一条连接
+            // 以下字段只有io_uring后端使用
+            bool _sendQueued = false;   // 已经在本轮的待发送列表中
+            bool _sendInFlight = false; // 已经提交了一个sendmsg还没有完成
+            bool _closing = false;      // 对端已关闭或出错，等在途发送完成后关闭
+            std::vector<iovec> _iov{};  // 在途sendmsg引用的iovec，完成之前不能改动
+            msghdr _msg{};
+        };
+    }
+    // 一个reactor就是一个独立的事件循环：自己的epoll实例、自己的连接表，连接一旦分给某个reactor就只在这个线程上读写
+    // 其他线程要给它的连接投递数据(新连接、复制流)时，先放进收件箱再通过eventfd唤醒它
+    class Reactor
+    {
+    public:
+        Reactor(const ServerConfig &config, size_t id, std::vector<std::unique_ptr<Reactor>> &group);
+        ~Reactor();
+        int init();
+        // 共享监听模式下listenfd只注册在_reactors[0]上，SO_REUSEPORT模式下每个reactor注册自己的listenfd
+        int watchListen(int listenFd);
+        // timerfd只注册在_reactors[0]上
+        int watchTimer(int timerFd);
+        int loop();
+        void start();
+        void stop();
+        // 把一条已accept的连接交给本reactor，可以在任意线程调用
+        void adopt(int cfd);
+        // 把数据投递到本reactor的某条连接的发送队列，可以在任意线程调用
+        void post(int fd, uint64_t connId, std::string data);
+        size_t load() const { return _connCount.load(std::memory_order_relaxed); }
+
+    private:
+        void acceptAll();
+        void drainTimer();
+        void drainInbox();
+        void addConn(int cfd);
+        void deliver(int fd, uint64_t connId, std::string data);
+        void closeConn(std::unordered_map<int, NetConnection>::iterator it);
+        void processInput(NetConnection &conn, uint32_t &ev);
+        void propagateRepl();
+        void flushReplQueue();
+        Reactor &pick();
+#ifdef MYREDIS_WITH_IO_URING
+        int loopUring();
+        void armAccept();
+        void armRecv(const NetConnection &conn);
+        void armPoll(int fd, uint64_t op);
+        void queueSend(NetConnection &conn);
+        void flushSends();
+        void onRecv(int fd, uint64_t idBits, int res, uint32_t flags);
+        void onSend(int fd, uint64_t idBits, int res);
+#endif
+
+    private:
+        const ServerConfig &_config;
+        size_t _id;
+        std::vector<std::unique_ptr<Reactor>> &_group;
+        int _epollFd = -1;
+        int _wakeFd = -1; // eventfd，别的线程往收件箱放东西后写它来唤醒epoll_wait
+        int _listenFd = -1;
+        int _timerFd = -1;
+        std::unordered_map<int, NetConnection> _connsMap;
+        std::atomic<size_t> _connCount{0};
+        size_t _rrIndex = 0; // 轮询分发的游标，只有accept线程使用
+        std::mutex _inboxMutex;
+        std::vector<int> _inboxFds;
+        struct Outgoing
+        {
+            int _fd;
+            uint64_t _connId;
+            std::string _data;
+        };
+        std::vector<Outgoing> _inboxOut;
+        std::atomic<bool> _stop{false};
+        std::thread _thread;
+        bool _uring = false; // 是否使用io_uring后端替代epoll+recv+writev
+#ifdef MYREDIS_WITH_IO_URING
+        std::unique_ptr<IoUring> _ring;
+        struct SendRef
+        {
+            int _fd;
+            uint64_t _connId;
         };
+        std::vector<SendRef> _sendQueue; // 本轮循环有待发送数据的连接，循环末尾一次性提交
+#endif
+    };
+    // 所有reactor共用的连接序号生成器
+    static std::atomic<uint64_t> gConnIdGen{0};
+    // 已经登记为从节点的连接：所在reactor、fd和连接序号
+    struct ReplicaLink
+    {
+        Reactor *_reactor;
+        int _fd;
+        uint64_t _connId;
+    };
+    static std::vector<ReplicaLink> gReplicas;
+#ifdef MYREDIS_WITH_IO_URING
+    // io_uring请求的user_data：高8位是请求类型，中间24位是连接序号的低位，低32位是fd，类型0是归还缓冲区，完成后直接忽略
+    enum UringOp : uint64_t
+    {
+        kOpAccept = 1,
+        kOpRecv,
+        kOpSend,
+        kOpWake,
+        kOpTimer
+    };
+    static inline uint64_t packUserData(uint64_t op, int fd, uint64_t connId)
+    {
+        return (op << 56) | ((connId & 0xffffff) << 32) | static_cast<uint32_t>(fd);
     }
+    static const unsigned kUringEntries = 4096;
+    static const unsigned kUringBufCount = 512;   // 接收缓冲区个数
+    static const size_t kUringBufSize = 4096;     // 和epoll路径的recv缓冲区一样大
+#endif
 
     Server::Server(const ServerConfig &config) : _config{config} {}
     Server::~Server()
     {
-        if (_listenFd >= 0)
-            close(_listenFd);
-        if (_epollFd >= 0)
-            close(_epollFd);
+        _reactors.clear();
+        for (int fd : _listenFds)
+            close(fd);
+        if (_timerFd >= 0)
+            close(_timerFd);
     }
-    int Server::setupListen()
+    // 创建一个绑定到配置地址上的非阻塞监听fd，reusePort为true时额外打开SO_REUSEPORT，让多个监听fd共享同一个端口
+    static int openListenFd(const ServerConfig &config, bool reusePort)
     {
-        _listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
-        if (_listenFd == -1)
+        int listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd == -1)
         {
             std::perror("failed to alloc listen fd\n");
             return -1;
         }
         int opt = 1;
         // 设置ip,端口复用
-        if (setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+        if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
         {
             std::perror("failed to set sockopt for listen fd\n");
+            close(listenFd);
+            return -1;
+        }
+        // SO_REUSEPORT模式下每个reactor各自持有一个监听fd，内核按四元组哈希把新连接分散到这些fd的全连接队列上
+        // 这样没有共享的accept队列，也不会出现多个线程同时被一个连接唤醒的惊群
+        if (reusePort && setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+        {
+            std::perror("failed to set SO_REUSEPORT for listen fd\n");
+            close(listenFd);
             return -1;
         }
         // 填充地址
         sockaddr_in addr{};
         addr.sin_family = AF_INET;
-        addr.sin_port = htons(_config._port);
-        if (inet_pton(AF_INET, _config._bindAddr.c_str(), &addr.sin_addr) <= 0)
+        addr.sin_port = htons(config._port);
+        if (inet_pton(AF_INET, config._bindAddr.c_str(), &addr.sin_addr) <= 0)
         {
             std::perror("inet_pton is failed\n");
+            close(listenFd);
             return -1;
         }
         // 绑定fd
-        if (bind(_listenFd, (sockaddr *)&addr, sizeof(addr)) < 0)
+        if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) < 0)
         {
             std::perror("failed to bind\n");
+            close(listenFd);
             return -1;
         }
         // 设置非阻塞,listenfd的阻塞与非阻塞是相对于内核中的连接队列的这个队列来说的
         // listenfd的阻塞与否在用户态上只体现在accept这一步上，而accept函数就是从内核的连接已完成队列中拿一条连接
         // 所以如果是阻塞模式，当内核的这个连接队列中没有连接时会阻塞等待，而如果是非阻塞模式则直接返回一个错误值
-        if (setNonBlock(_listenFd) == -1)
+        if (setNonBlock(listenFd) == -1)
         {
             std::perror("failed to set nonblock\n");
+            close(listenFd);
             return -1;
         }
         // 监听listenfd
-        if (listen(_listenFd, 512) == -1)
+        if (listen(listenFd, 512) == -1)
         {
             std::perror("failed to set listen\n");
+            close(listenFd);
             return -1;
         }
-        return 0;
+        return listenFd;
     }
-    // 首先创建出epollfd,然后将listenfd和timerfd注册到epoll中
-    int Server::setupEpoll()
+    int Server::setupListen()
     {
-        _epollFd = epoll_create(1);
-        if (_epollFd < 0)
+        // 共享监听模式只有一个监听fd，由_reactors[0]负责accept后再分发；SO_REUSEPORT模式每个reactor一个
+        bool reusePort = _config._net._reusePort;
+        size_t n = reusePort ? static_cast<size_t>(_config._net._ioThreads > 0 ? _config._net._ioThreads : 1) : 1;
+        for (size_t i = 0; i < n; i++)
         {
-            std::perror("epoll fd is failed to allocate\n");
-            return -1;
+            int fd = openListenFd(_config, reusePort);
+            if (fd == -1)
+                return -1;
+            _listenFds.push_back(fd);
         }
-        // listenfd设置为边缘触发，那么就是说从条件不满足到条件满足才会触发一次，提高效率
-        // 这样可以配合后续的循环accept
-        if (addEpoll(_epollFd, _listenFd, EPOLLIN | EPOLLET) == -1)
+        return 0;
+    }
+    // 按照io线程数创建出reactor，每个reactor各自创建epollfd，然后将listenfd和timerfd注册到第一个reactor的epoll中
+    int Server::setupEpoll()
+    {
+        size_t n = static_cast<size_t>(_config._net._ioThreads > 0 ? _config._net._ioThreads : 1);
+        _reactors.reserve(n);
+        for (size_t i = 0; i < n; i++)
         {
-            std::perror("failed to add listen fd to epoll\n");
-            return -1;
+            _reactors.emplace_back(std::make_unique<Reactor>(_config, i, _reactors));
+            if (_reactors.back()->init() == -1)
+                return -1;
         }
         _timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
         if (_timerFd < 0)
@@ -150,84 +308,48 @@ namespace myredis
             return -1;
         }
         itimerspec iti{};
-        // iti.it_interval指首次超时时间
-        iti.it_interval.tv_sec = 0;
-        iti.it_interval.tv_nsec = 200 * 1000 * 1000; // 200ms
-        // iti.it_value指之后超时周期
+        // 每秒触发hz次，定期删除和字典搬迁都在这个定时器上
+        long periodNs = 1000000000L / _config._hz;
+        // iti.it_interval指之后的超时周期
+        iti.it_interval.tv_sec = periodNs / 1000000000L;
+        iti.it_interval.tv_nsec = periodNs % 1000000000L;
+        // iti.it_value指首次超时时间
         iti.it_value = iti.it_interval;
         if (timerfd_settime(_timerFd, 0, &iti, nullptr) < 0)
         {
             std::perror("failed to timerfd_settime\n");
             return -1;
         }
-        /*if (addEpoll(_epollFd, _timerFd, EPOLLIN | EPOLLET) == -1)
+        for (size_t i = 0; i < _listenFds.size(); i++)
         {
-            std::perror("failed to add timerfd to epoll\n");
-            return -1;
-        }*/
-        return 0;
+            if (_reactors[i]->watchListen(_listenFds[i]) == -1)
+                return -1;
+        }
+        return _reactors[0]->watchTimer(_timerFd);
     }
-    // 判断conn的outChunks是否发送完毕，如果完全发送完了，返回false，如果还有数据等待发送，返回true,这里的发送单纯是用户态数据拷贝到内核态的发送缓冲区。
+    // 判断conn的发送缓冲区是否发送完毕，如果完全发送完了，返回false，如果还有数据等待发送，返回true,这里的发送单纯是用户态数据拷贝到内核态的发送缓冲区。
     //所以如果还有数据没有发送，那么说明conn有数据可写，这样才需要epoll去检测conn的写事件，如果说conn没有用户态数据需要写，那么也就没有检测EPOLLOUT了
     static inline bool hasPending(const NetConnection &conn)
     {
-        return conn._outIndex < conn._outChunks.size() || (conn._outIndex == conn._outChunks.size() && conn._outOffset != 0);
+        return !conn._out.empty();
     }
 
-    // 将conn中的_outChunk待发送数据块一次性发送出去
+    // 将conn发送缓冲区中的待发送数据一次性发送出去
     static void tryFlushNow(int fd, NetConnection &conn, uint32_t &ev)
     {
         while (hasPending(conn))
         {
-            const size_t maxIov = 64; // I/O vector最大的长度，简单来说就是io向量个数
+            const size_t maxIov = IOV_MAX; // I/O vector最大的长度，简单来说就是io向量个数，pipeline模式下一批回复尽量用一次writev发完
             struct iovec iov[maxIov]; // struct iovec结构体其实是很简单的一个结构，第一个成员是指向内存起始地址的指针，第二个成员是这块内存的长度
-            int iovIdx = 0;           // iov数组的下标
-            size_t idx = conn._outIndex;
-            size_t offset = conn._outOffset;
-            while (idx < conn._outChunks.size() && iovIdx < (int)maxIov)
-            {
-                const std::string &s = conn._outChunks[idx];
-                const char *base = s.data();
-                size_t len = s.size();
-                // 如果当前块偏移刚好到块末尾或者超出块末尾，说明当前块发送完毕，直接跳转到下一个块
-                if (offset >= len)
-                {
-                    idx++;
-                    offset = 0;
-                    continue;
-                }
-                // 否则，说明当前块偏移在当前块的中间部分或者开头，那么意味着当前块还没有完全发送，需要提取出未发送部分到iov中
-                iov[iovIdx].iov_base = (void *)(base + offset);
-                iov[iovIdx].iov_len = len - offset;
-                iovIdx++;
-                idx++;
-                offset = 0;
-            }
-            // 说明iov数组没有数据直接跳出循环，没有发送的需求
-            if (iovIdx == 0)
-                break;
+            // 发送缓冲区的每一块对应一个iovec，小回复都挤在16KB的块里，一般只有几个iovec
+            size_t iovcnt = conn._out.fillIov(iov, maxIov);
             // 写数据到内核缓冲区中
-            ssize_t dataLen = ::writev(conn._fd, iov, iovIdx);
+            ssize_t dataLen = ::writev(fd, iov, static_cast<int>(iovcnt));
             // ssize_t是有符号整数类型，但是系统库作为返回值通常只会返回io字节数或者失败-1，其他的都没有意义
             if (dataLen > 0)
             {
-                size_t len = (size_t)dataLen;
-                while (len > 0 && conn._outIndex < conn._outChunks.size())
-                {
-                    std::string &str = conn._outChunks[conn._outIndex];
-                    size_t avail = str.size() - conn._outOffset;
-                    if (len < avail)
-                    {
-                        conn._outOffset += len;
-                        len = 0;
-                    }
-                    else if (len >= avail)
-                    {
-                        len -= avail;
-                        conn._outOffset = 0;
-                        conn._outIndex++;
-                    }
-                }
+                // 已经发出去的块归还块池
+                conn._out.consume(static_cast<size_t>(dataLen));
             }
             else if (dataLen < 0 && (errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK))
             {
@@ -241,576 +363,835 @@ namespace myredis
             }
         }
     }
-    //所有的更改操作的原始命令都会记录到aof的缓存中，并且更改操作的vector记录形式会记录在grepliQueue中
-    static std::string handleCommand(const RespValue &respV, const std::string *raw,const ServerConfig& config)
+    // 一条命令执行时的上下文，写命令真正修改了数据时把_dirty置为true，由handleCommand统一记录aof并放入复制队列
+    struct CommandContext
     {
-        // 这个命令必须是array存储，因为命令往往是多个指令
-        if (respV._type != RespType::Array || respV._array.empty())
-            return respError("ERROR protocol");
-        const RespValue &head = respV._array[0];
-        // 判断数组第一个元素是不是字符串类型
-        if (head._type != RespType::BulkString && head._type != RespType::SimpleString)
-            return respError("ERROR command type");
-        // 将命令转为大写
-        std::string cmd{};
-        cmd.reserve(head._bulk.size());
-        for (const auto &c : head._bulk)
-        {
-            cmd.push_back(static_cast<char>(::toupper(c)));
-        }
-        if (cmd == "PING")
+        const std::vector<std::string_view> &_args; // 指向连接输入缓冲区的参数，_args[0]是命令名
+        const ServerConfig &_config;
+        RespWriter &_reply; // 回复直接写进连接的发送缓冲区
+        bool _dirty = false;
+    };
+    using CommandHandler = void (*)(CommandContext &);
+    enum CommandFlag : uint32_t
+    {
+        kCmdWrite = 1u << 0,   // 写命令，修改了数据时需要写aof和复制给从节点
+        kCmdDenyOom = 1u << 1, // 可能增加内存的写命令，超过maxmemory又淘汰不出空间时拒绝执行
+    };
+    // 命令表中的一项：小写的命令名、参数个数、标志位和处理函数
+    struct CommandSpec
+    {
+        std::string_view _name;
+        int _arity; // 包括命令名在内的参数个数，负数表示至少-_arity个
+        uint32_t _flags;
+        CommandHandler _handler;
+    };
+    static constexpr char foldCase(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+    // 对大小写折叠后的命令名做FNV-1a哈希，大小写不同的命令名得到同一个哈希值，不用先把命令名转成大写字符串
+    static constexpr uint32_t foldHash(std::string_view s)
+    {
+        uint32_t h = 2166136261u;
+        for (char c : s)
         {
-            if (respV._array.size() <= 1)
-                return respSimpleString("PONG");
-            if (respV._array.size() == 2 && respV._array[1]._type == RespType::BulkString)
-                return respBulkString(respV._array[1]._bulk);
-            return respError("error with wrong numbers of args of command 'PING'");
+            h ^= static_cast<unsigned char>(foldCase(c));
+            h *= 16777619u;
         }
-        if (cmd == "ECHO")
+        return h;
+    }
+    static constexpr bool equalsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); i++)
         {
-            if (respV._array.size() == 2 && respV._array[1]._type == RespType::BulkString)
-                return respBulkString(respV._array[1]._bulk);
-            return respError("error with wrong numbers of args of command 'ECHO'");
+            if (foldCase(a[i]) != foldCase(b[i]))
+                return false;
         }
-        // 字符对象的写入命令
-        if (cmd == "SET")
+        return true;
+    }
+    // 所有写命令的公共收尾：原始命令直接追加到aof，命令本身放进复制队列，调用方必须持有gWriteMutex
+    static void propagateWrite(const std::vector<std::string_view> &args, std::string_view raw)
+    {
+        std::vector<std::string> command{args.begin(), args.end()};
+        if (!raw.empty())
+            gAof.appendRaw(raw);
+        else
+            gAof.appendCommand(command);
+        std::lock_guard<std::mutex> lock(gReplMutex);
+        gReplQueue.push_back(std::move(command));
+        gReplPending = true;
+    }
+    // 超过maxmemory时淘汰key，被淘汰的key和过期删除一样作为DEL写aof、复制给从节点，返回是否还超过上限且淘汰不出空间
+    // 调用方必须持有gWriteMutex；从节点不主动淘汰，和redis的replica-ignore-maxmemory默认值一样，内存跟着主节点发来的DEL走
+    static bool evictForMaxmemory(const ServerConfig &config, int64_t budgetUs)
+    {
+        if (config._replica._enabled)
+            return false;
+        std::vector<std::string> evicted;
+        EvictStatus st = gStore.performEvictions(budgetUs, evicted);
+        for (const std::string &key : evicted)
+            propagateWrite({"DEL", key}, {});
+        return st == EvictStatus::Fail;
+    }
+    static void cmdPing(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        if (args.size() <= 1)
+            return ctx._reply.raw(kReplyPong);
+        if (args.size() == 2)
+            return ctx._reply.bulk(args[1]);
+        return ctx._reply.error("error with wrong numbers of args of command 'PING'");
+    }
+    static void cmdEcho(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        return ctx._reply.bulk(args[1]);
+    }
+    static void cmdSet(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        std::optional<int64_t> ttlMs;
+        size_t i = 3;
+        // 从第四个参数起开始循环检查后面的参数
+        // set命令还有可能长这样:SET key value [EX seconds] [PX milliseconds],这里的EX组合和PX组合的顺序是任意的
+        while (i < args.size())
         {
-            // 检查参数个数和参数类型
-            if (respV._array.size() < 3)
-                return respError("error with  wrong numbers of args of command 'SET'");
-            if (respV._array[1]._type != RespType::BulkString || respV._array[2]._type != RespType::BulkString)
-                return respError("error with wrong type of command 'SET'");
-
-            std::optional<int64_t> ttlMs;
-            size_t i = 3;
-            // 从第四个参数起开始循环检查后面的参数
-            // set命令还有可能长这样:SET key value [EX seconds] [PX milliseconds],这里的EX组合和PX组合的顺序是任意的
-            while (i < respV._array.size())
+            std::string opt;
+            opt.reserve(args[i].size());
+            for (const auto &c : args[i])
+                opt.push_back(static_cast<char>(::toupper(c)));
+            // 秒级过期时间
+            if (opt == "EX")
             {
-                if (respV._array[i]._type != RespType::BulkString)
-                    return respError("error with wrong type of SET");
-                std::string opt;
-                opt.reserve(respV._array[i]._bulk.size());
-                for (const auto &c : respV._array[i]._bulk)
-                    opt.push_back(static_cast<char>(::toupper(c)));
-                // 秒级过期时间
-                if (opt == "EX")
+                if (i + 1 >= args.size())
+                    return ctx._reply.error("error with EX arg type");
+                try
                 {
-                    if (i + 1 >= respV._array.size() || respV._array[i]._type != RespType::BulkString)
-                        return respError("error with EX arg type");
-                    try
-                    {
-                        int64_t sec = std::stoll(respV._array[i + 1]._bulk);
-                        if (sec < 0)
-                            return respError("error with EX arg of value");
-                        ttlMs = 1000 * sec;
-                    }
-                    catch (...)
-                    {
-                        return respError("EX arg's value is not reasonable");
-                    }
-                    i += 2;
-                    continue;
+                    int64_t sec = std::stoll(std::string{args[i + 1]});
+                    if (sec < 0)
+                        return ctx._reply.error("error with EX arg of value");
+                    ttlMs = 1000 * sec;
                 }
-                else if (opt == "PX")
+                catch (...)
                 {
-                    if (i + 1 >= respV._array.size() || respV._array[i]._type != RespType::BulkString)
-                        return respError("error with PX arg type");
-                    try
-                    {
-                        int64_t ms = std::stoll(respV._array[i + 1]._bulk);
-                        if (ms < 0)
-                            return respError("error with PX arg of value");
-                        ttlMs = ms;
-                    }
-                    catch (...)
-                    {
-                        return respError("PX arg's value is not reasonable");
-                    }
-                    i += 2;
-                    continue;
+                    return ctx._reply.error("EX arg's value is not reasonable");
                 }
-                else
-                    return respError("error with set option args");
-            }
-            // 解析完命令就可以执行命令了
-            gStore.set(respV._array[1]._bulk, respV._array[2]._bulk, ttlMs);
-            // 然后将这个命令按照resp协议格式使用aof持久化
-            if (raw)
-                gAof.appendRaw(*raw);
-            else
-            {
-                std::vector<std::string> command;
-                command.reserve(respV._array.size());
-                for (const auto &s : respV._array)
-                    command.push_back(s._bulk);
-                gAof.appendCommand(command);
+                i += 2;
+                continue;
             }
-            // 这里将命令存储到主从复制的增量复制队列中
+            else if (opt == "PX")
             {
-                std::vector<std::string> command;
-                command.reserve(respV._array.size());
-                for (const auto &s : respV._array)
-                    command.push_back(s._bulk);
-                gReplQueue.push_back(std::move(command));
+                if (i + 1 >= args.size())
+                    return ctx._reply.error("error with PX arg type");
+                try
+                {
+                    int64_t ms = std::stoll(std::string{args[i + 1]});
+                    if (ms < 0)
+                        return ctx._reply.error("error with PX arg of value");
+                    ttlMs = ms;
+                }
+                catch (...)
+                {
+                    return ctx._reply.error("PX arg's value is not reasonable");
+                }
+                i += 2;
+                continue;
             }
-            return respSimpleString("OK");
+            else
+                return ctx._reply.error("error with set option args");
+        }
+        // 解析完命令就可以执行命令了
+        gStore.set(args[1], args[2], ttlMs);
+        ctx._dirty = true;
+        return ctx._reply.ok();
+    }
+    static void cmdGet(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        auto opt = gStore.get(args[1]);
+        if (opt.has_value())
+            return ctx._reply.bulk(std::move(*opt));
+        else
+            return ctx._reply.nullBulk();
+    }
+    static void cmdKeys(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        std::string pattern = "*";
+        if (args.size() == 2)
+            pattern = args[1];
+        else if (args.size() > 2)
+            return ctx._reply.error("error with count of args of command 'KEYS'");
+        
+        // 先暂时只支持*
+        if (pattern == "*")
+        {
+            auto keys = gStore.listKeys();
+            ctx._reply.arrayHeader(keys.size());
+            for (const auto &k : keys)
+                ctx._reply.bulk(k);
+            return;
+        }
+        return ctx._reply.error("error with the args of 'KEYS'");
+    }
+    // FLUSHALL [ASYNC|SYNC]
+    static void cmdFlushall(CommandContext &ctx)
+    {
+        const ServerConfig &config = ctx._config;
+        const std::vector<std::string_view> &args = ctx._args;
+        bool async = false;
+        if (args.size() == 2 && equalsIgnoreCase(args[1], "async"))
+            async = true;
+        else if (args.size() != 1 && !(args.size() == 2 && equalsIgnoreCase(args[1], "sync")))
+            return ctx._reply.error("ERR syntax error");
+        // 清空redis数据库,然后再进行一次rdb持久化操作，redis数据库为空，那么相应地为了保证数据一致性，rdb文件必须也清空，这里我还没有进行rdb持久化
+        gStore.clearAll(async);
+        //在任何与aof或者rdb或者replica相关的操作中都要考虑相关组件是否开启
+        if(config._rdb._enabled){
+            std::string err;
+            if(!gRdb.save(gStore,err))return ctx._reply.error(err);
         }
-        if (cmd == "GET")
+        ctx._dirty = true;
+        return ctx._reply.ok();
+    }
+    static void cmdDel(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        std::vector<std::string> keys;
+        keys.reserve(args.size() - 1);
+        for (size_t i = 1; i < args.size(); i++)
         {
-            if (respV._array.size() != 2)
-                return respError("error with the number of args of command 'GET'");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("error with the type of args of command 'GET'");
-            auto opt = gStore.get(respV._array[1]._bulk);
-            if (opt.has_value())
-                return respBulkString(*opt);
-            else
-                return respNullBulk();
+            keys.emplace_back(args[i]);
         }
-        if (cmd == "KEYS")
+        int removed = gStore.del(keys, equalsIgnoreCase(args[0], "unlink"));
+        // 真正删除了key才需要记录这条命令
+        ctx._dirty = removed > 0;
+        return ctx._reply.integer(removed);
+    }
+    static void cmdExists(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        bool ret = gStore.exists(args[1]);
+        return ctx._reply.integer((ret ? 1 : 0));
+    }
+    static void cmdExpire(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        int64_t sec = 0;
+        try
         {
-            std::string pattern = "*";
-            if (respV._array.size() == 2)
-            {
-                if (respV._array[1]._type == RespType::SimpleString || respV._array[1]._type == RespType::BulkString)
-                    pattern = respV._array[1]._bulk;
-                else
-                    return respError("error with type of args of command 'KEYS'");
-            }
-            else if (respV._array.size() != 1)
-                return respError("error with count of args of command 'KEYS'");
-            
-            // 先暂时只支持*
-            if (pattern == "*")
-            {
-                auto keys = gStore.listKeys();
-                std::string out = "*" + std::to_string(keys.size()) + "\r\n";
-                for (const auto &k : keys)
-                    out += respBulkString(k);
-                return out;
-            }
-            return respError("error with the args of 'KEYS'");
-        }
-        if (cmd == "FLUSHALL")
-        {
-            // 清空redis数据库,然后再进行一次rdb持久化操作，redis数据库为空，那么相应地为了保证数据一致性，rdb文件必须也清空，这里我还没有进行rdb持久化
-            if (respV._array.size() != 1)
-                return respError("error with count of args of 'FLUSHALL'");
-            gStore.clearAll();
-            //在任何与aof或者rdb或者replica相关的操作中都要考虑相关组件是否开启
-            if(config._rdb._enabled){
-                std::string err;
-                if(!gRdb.save(gStore,err))return respError(err);
-            }
-            
-            // aof记录
-            if (raw)
-                gAof.appendRaw(*raw);
-            else
-                gAof.appendCommand({"FLUSHALL"});
-            gReplQueue.push_back({"FLUSHALL"});
-            return respSimpleString("OK");
+            sec = std::stoll(std::string{args[2]});
         }
-        if (cmd == "DEL")
+        catch (...)
         {
-            if (respV._array.size() < 2)
-                return respError("error with del");
-            std::vector<std::string> keys;
-            keys.reserve(respV._array.size() - 1);
-            for (size_t i = 1; i < respV._array.size(); i++)
-            {
-                if (respV._array[i]._type != RespType::BulkString)
-                    return respError("error with del");
-                keys.push_back(respV._array[i]._bulk);
-            }
-            int removed = gStore.del(keys);
-            if (removed > 0)
-            {
-                // 那么删除成功，这样就需要将这个删除操作记录起来
-                std::vector<std::string> parts;
-                parts.reserve(1 + keys.size());
-                parts.emplace_back("DEL");
-                for (auto &k : keys)
-                    parts.emplace_back(k);
-                if (raw)
-                    gAof.appendRaw(*raw);
-                else
-                    gAof.appendCommand(parts);
-                gReplQueue.push_back(parts);
-            }
-            return respInteger(removed);
+            return ctx._reply.error("error with expire");
+        }
+        bool ok = gStore.expire(args[1], sec);
+        ctx._dirty = ok;
+        return ctx._reply.integer((ok ? 1 : 0));
+    }
+    static void cmdTtl(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        int64_t ret = gStore.ttl(args[1]);
+        return ctx._reply.integer(ret);
+    }
+    static void cmdHset(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        if (args.size() % 2)
+            return ctx._reply.error("error with the count of args of HSET");
+        std::vector<std::string> fieldValues;
+        fieldValues.reserve(args.size() - 2);
+        for (size_t i = 2; i < args.size(); i++)
+            fieldValues.emplace_back(args[i]);
+        int created = gStore.hset(args[1], fieldValues);
+        ctx._dirty = true;
+        return ctx._reply.integer(created);
+    }
+    static void cmdHget(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        auto opt = gStore.hget(args[1], args[2]);
+        if (opt.has_value())
+            return ctx._reply.bulk(std::move(*opt));
+        return ctx._reply.nullBulk();
+    }
+    static void cmdHdel(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        std::vector<std::string> fields;
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            fields.emplace_back(args[i]);
+        }
+        int removed = gStore.hdel(args[1], fields);
+        //>0说明删除成功，所以需要记录下这个hdel命令
+        ctx._dirty = removed > 0;
+        return ctx._reply.integer(removed);
+    }
+    static void cmdHexists(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        bool ret = gStore.hexists(args[1], args[2]);
+        return ctx._reply.integer((ret ? 1 : 0));
+    }
+    static void cmdHgetall(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        auto vec = gStore.hgetAll(args[1]);
+        ctx._reply.arrayHeader(vec.size());
+        for (const auto &s : vec)
+            ctx._reply.bulk(s);
+    }
+    static void cmdHlen(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        int len = gStore.hlen(args[1]);
+        return ctx._reply.integer(len);
+    }
+    static void cmdZadd(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zadd key [NX|XX] [GT|LT] [CH] [INCR] score1 member1 [score2 member2 ...]
+        int flags = 0;
+        std::vector<std::pair<double, std::string>> items;
+        if (const char *err = parseZaddArgs(args, 2, flags, items))
+            return ctx._reply.error(err);
+        ZaddResult res = gStore.zadd(args[1], items, flags);
+        if (res._nan)
+            return ctx._reply.error("ERR resulting score is not a number (NaN)");
+        // 没有新增也没有分数变化时不需要记录aof
+        ctx._dirty = res._added + res._updated > 0;
+        if (flags & kZaddIncr)
+            return res._score ? ctx._reply.bulk(formatScore(*res._score)) : ctx._reply.nullBulk();
+        return ctx._reply.integer((flags & kZaddCh) ? res._added + res._updated : res._added);
+    }
+    static void cmdZincrby(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zincrby key increment member，等价于zadd key incr increment member
+        double incr;
+        if (!parseScore(args[2], incr))
+            return ctx._reply.error("ERR value is not a valid float");
+        ZaddResult res = gStore.zadd(args[1], {{incr, std::string{args[3]}}}, kZaddIncr);
+        if (res._nan)
+            return ctx._reply.error("ERR resulting score is not a number (NaN)");
+        ctx._dirty = res._added + res._updated > 0;
+        return ctx._reply.bulk(formatScore(*res._score));
+    }
+    static void cmdZrem(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // 移除zset中的指定元素，格式如zrem key member [member ...]
+        std::vector<std::string> members;
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            members.emplace_back(args[i]);
+        }
+        int removed = gStore.zrem(args[1], members);
+        // 当zrem删除了数据时我们才需要记录下这条命令
+        ctx._dirty = removed > 0;
+        return ctx._reply.integer(removed);
+    }
+    static void cmdZrange(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zrange key start stop [withscores]
+        // 在此实现成zrange key start stop
+        int64_t start = 0, stop = 0;
+        try
+        {
+            start = std::stoll(std::string{args[2]});
+            stop = std::stoll(std::string{args[3]});
         }
-        if (cmd == "EXISTS")
+        catch (...)
         {
-            if (respV._array.size() != 2)
-                return respError("error with exists");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("error with exists");
-            bool ret = gStore.exists(respV._array[1]._bulk);
-            return respInteger((ret ? 1 : 0));
+            return ctx._reply.error("error with args swith");
         }
-        if (cmd == "EXPIRE")
+        auto members = gStore.zrange(args[1], start, stop);
+        ctx._reply.arrayHeader(members.size());
+        for (const auto &m : members)
+            ctx._reply.bulk(m);
+    }
+    static void cmdZscore(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zscore key member
+        auto s = gStore.zscore(args[1], args[2]);
+        if (!s.has_value())
+            return ctx._reply.nullBulk();
+        return ctx._reply.bulk(formatScore(*s));
+    }
+    static void cmdZrangebyscore(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zrangebyscore key min max [withscores] [limit offset count]
+        ScoreRange range;
+        if (!parseScoreRange(args[2], args[3], range))
+            return ctx._reply.error("ERR min or max is not a float");
+        bool withScores = false;
+        int64_t offset = 0, count = -1;
+        for (size_t i = 4; i < args.size(); i++)
         {
-            if (respV._array.size() != 3)
-                return respError("error with expire");
-            if (respV._array[1]._type != RespType::BulkString || respV._array[2]._type != RespType::BulkString)
-                return respError("error with expire");
-            try
+            if (equalsIgnoreCase(args[i], "withscores"))
+                withScores = true;
+            else if (equalsIgnoreCase(args[i], "limit") && i + 2 < args.size())
             {
-                int64_t sec = std::stoll(respV._array[2]._bulk);
-                bool ok = gStore.expire(respV._array[1]._bulk, sec);
-                if (ok)
+                try
                 {
-                    if (raw)
-                        gAof.appendRaw(*raw);
-                    else
-                        gAof.appendCommand({"EXPIRE", respV._array[1]._bulk, respV._array[2]._bulk});
-                    gReplQueue.push_back({"EXPIRE", respV._array[1]._bulk, respV._array[2]._bulk});
+                    offset = std::stoll(std::string{args[i + 1]});
+                    count = std::stoll(std::string{args[i + 2]});
                 }
-                return respInteger((ok ? 1 : 0));
-            }
-            catch (...)
-            {
-                return respError("error with expire");
+                catch (...)
+                {
+                    return ctx._reply.error("ERR value is not an integer or out of range");
+                }
+                i += 2;
             }
+            else
+                return ctx._reply.error("ERR syntax error");
         }
-        if (cmd == "TTL")
+        auto items = gStore.zrangeByScore(args[1], range, offset, count);
+        ctx._reply.arrayHeader(withScores ? items.size() * 2 : items.size());
+        for (const auto &[score, member] : items)
         {
-            if (respV._array.size() != 2)
-                return respError("ERR wrong number of arguments for 'TTL'");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            int64_t ret = gStore.ttl(respV._array[1]._bulk);
-            return respInteger(ret);
+            ctx._reply.bulk(member);
+            if (withScores)
+                ctx._reply.bulk(formatScore(score));
         }
-        // HSET key field value [field value ...]这是hset命令格式
-        if (cmd == "HSET")
+    }
+    static void cmdZcount(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zcount key min max
+        ScoreRange range;
+        if (!parseScoreRange(args[2], args[3], range))
+            return ctx._reply.error("ERR min or max is not a float");
+        return ctx._reply.integer(gStore.zcount(args[1], range));
+    }
+    static void cmdZremrangebyscore(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zremrangebyscore key min max
+        ScoreRange range;
+        if (!parseScoreRange(args[2], args[3], range))
+            return ctx._reply.error("ERR min or max is not a float");
+        int64_t removed = gStore.zremRangeByScore(args[1], range);
+        ctx._dirty = removed > 0;
+        return ctx._reply.integer(removed);
+    }
+    static void cmdZrank(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // zrank key member / zrevrank key member
+        auto r = gStore.zrank(args[1], args[2], false);
+        if (!r.has_value())
+            return ctx._reply.nullBulk();
+        return ctx._reply.integer(*r);
+    }
+    static void cmdZrevrank(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        auto r = gStore.zrank(args[1], args[2], true);
+        if (!r.has_value())
+            return ctx._reply.nullBulk();
+        return ctx._reply.integer(*r);
+    }
+    static void cmdBgsave(CommandContext &ctx)
+    {
+        // 这里暂时实现成阻塞主线程模式
+        std::string err;
+        //std::cout<<"cmd save\n";
+        if (!gRdb.save(gStore, err))
+            return ctx._reply.error(std::string{"ERR rdb save faild:"} + err);
+        return ctx._reply.ok();
+    }
+    static void cmdBgrewriteaof(CommandContext &ctx)
+    {
+        // 重写aof文件，随着时间推移，aof文件越来越大，需要对aof文件内容进行优化
+        std::string err;
+        if (!gAof.isEnabled())
+            return ctx._reply.error("ERR aof disabled");
+        if (!gAof.bgRewrite(gStore, err))
+            return ctx._reply.error(std::string{"ERROR"} + err);
+        return ctx._reply.ok();
+    }
+    static void cmdConfig(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        // config get/set/resetstat 后面跟配置的key值
+        std::string sub;
+        for (auto &c : args[1])
+            sub.push_back(static_cast<char>(::toupper(c)));
+        if (sub == "GET")
         {
-            if (respV._array.size() < 4 || (respV._array.size() >= 4 && respV._array.size() % 2))
-                return respError("error with the count of args of HSET");
-            std::vector<std::string> args;
-            for (size_t i = 1; i < respV._array.size(); i++)
+            std::string pattern = "*"; // 默认get操作的参数
+            if (args.size() >= 3)
             {
-                if (respV._array[i]._type != RespType::BulkString)
-                    return respError("error with type of args of HSET");
-                if (i > 1)
-                    args.push_back(respV._array[i]._bulk);
+                // 如果get命令的长度>=3，那么说明命令自带get参数，使用自带参数就行了
+                pattern = args[2];
             }
-            int created = gStore.hset(respV._array[1]._bulk, args);
-            std::vector<std::string> out;
-            for (const auto &s : respV._array)out.push_back(s._bulk);
-            if (raw)
-                gAof.appendRaw(*raw);
-            else gAof.appendCommand(out);
-            gReplQueue.push_back(out);
-            return respInteger(created);
-        }
-        if (cmd == "HGET")
-        {
-            if (respV._array.size() != 3)
-                return respError("ERR wrong number of arguments for 'HGET'");
-            if (respV._array[1]._type != RespType::BulkString || respV._array[2]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            auto opt = gStore.hget(respV._array[1]._bulk, respV._array[2]._bulk);
-            if (opt.has_value())
-                return respBulkString(*opt);
-            return respNullBulk();
-        }
-        if (cmd == "HDEL")
-        {
-            if (respV._array.size() < 3)
-                return respError("ERR wrong number of arguments for 'HDEL'");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            std::vector<std::string> fields;
-            for (size_t i = 2; i < respV._array.size(); i++)
+            // 判断pattern与传入参数是否相同或者pattern是否为*
+            auto match = [&](const std::string &k) -> bool
             {
-                if (respV._array[i]._type != RespType::BulkString)
-                    return respError("error with type of HDEL");
-                fields.push_back(respV._array[i]._bulk);
-            }
-            int removed = gStore.hdel(respV._array[1]._bulk, fields);
-            if (removed > 0)
+                if (pattern == "*")
+                    return true;
+                return pattern == k;
+            };
+            std::vector<std::pair<std::string, std::string>> kvs;
+            kvs.emplace_back("appendonly", gAof.isEnabled() ? "yes" : "no");
+            std::string appendfsync;
+            switch (gAof.mode())
             {
-                //>0说明删除成功，所以需要记录下这个hdel命令
-                std::vector<std::string> command;
-                command.reserve(respV._array.size());
-                for (const auto &s : respV._array)command.push_back(s._bulk);
-                if (raw)
-                    gAof.appendRaw(*raw);
-                else gAof.appendCommand(command);
-                gReplQueue.push_back(command);
+            case AofMode::No:
+                appendfsync = "no";
+                break;
+            case AofMode::EverySec:
+                appendfsync = "everysec";
+                break;
+            case AofMode::Always:
+                appendfsync = "always";
+                break;
             }
-            return respInteger(removed);
-        }
-        if (cmd == "HEXISTS")
-        {
-            if (respV._array.size() != 3)
-                return respError("ERR wrong number of arguments for 'HEXISTS'");
-            if (respV._array[1]._type != RespType::BulkString || respV._array[2]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            bool ret = gStore.hexists(respV._array[1]._bulk, respV._array[2]._bulk);
-            return respInteger((ret ? 1 : 0));
-        }
-        if (cmd == "HGETALL")
-        {
-            if (respV._array.size() != 2)
-                return respError("ERR wrong number of arguments for 'HGETALL'");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            auto vec = gStore.hgetAll(respV._array[1]._bulk);
-            std::string out = "*" + std::to_string(vec.size()) + "\r\n";
-            for (const auto &s : vec)
-                out += respBulkString(s);
-            return out;
-        }
-        if (cmd == "HLEN")
-        {
-            if (respV._array.size() != 2)
-                return respError("ERR wrong number of arguments for 'HLEN'");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            int len = gStore.hlen(respV._array[1]._bulk);
-            return respInteger(len);
-        }
-        if (cmd == "ZADD")
-        {
-            // zadd的命令格式是zadd key score1 member1 [score2 member2 ...]
-            if (respV._array.size() < 4 || respV._array.size() % 2)
-                return respError("ERR wrong number of arguments for 'ZADD'");
-            for (size_t i = 1; i < respV._array.size(); i++)
+            kvs.emplace_back("appendfsync", appendfsync);
+            kvs.emplace_back("dir", "./data");
+            kvs.emplace_back("dbfilename", "dump.rdb");
+            kvs.emplace_back("save", "");
+            kvs.emplace_back("timeout", "0");
+            kvs.emplace_back("databases", "16");
+            kvs.emplace_back("maxmemory", std::to_string(gStore.maxmemory()));
+            kvs.emplace_back("maxmemory-policy", maxmemoryPolicyName(gStore.maxmemoryPolicy()));
+            kvs.emplace_back("maxmemory-samples", std::to_string(gStore.maxmemorySamples()));
+            kvs.emplace_back("lazyfree-lazy-expire", ctx._config._store._lazyfreeLazyExpire ? "yes" : "no");
+            size_t elems = 0;
+            for (auto &p : kvs)
             {
-                if (respV._array[i]._type != RespType::BulkString)
-                    return respError("ERR syntax");
+                if (match(p.first))
+                    elems += 2;
             }
-            std::vector<std::pair<double, std::string>> args;
-            try
+            ctx._reply.arrayHeader(elems);
+            for (auto &p : kvs)
             {
-                for (size_t i = 2; i < respV._array.size(); i += 2)
+                if (match(p.first))
                 {
-                    double sc = std::stoll(respV._array[i]._bulk);
-                    args.emplace_back(sc, respV._array[i + 1]._bulk);
+                    ctx._reply.bulk(p.first);
+                    ctx._reply.bulk(p.second);
                 }
             }
-            catch (...)
+        }
+        else if (sub == "SET")
+        {
+            // 目前只有maxmemory的几个参数支持运行时修改
+            if (args.size() != 4)
+                return ctx._reply.error("ERR wrong number of arguments for 'CONFIG SET'");
+            std::string name{args[2]};
+            std::string val{args[3]};
+            for (auto &c : name)
+                c = static_cast<char>(::tolower(c));
+            if (name == "maxmemory")
             {
-                return respError("error with ZADD");
+                size_t bytes = 0;
+                if (!parseMemorySize(val, bytes))
+                    return ctx._reply.error("ERR Invalid argument '" + val + "' for CONFIG SET 'maxmemory'");
+                gStore.setMaxmemory(bytes);
             }
-            int added = gStore.zadd(respV._array[1]._bulk, args);
-            std::vector<std::string> command;
-            command.reserve(respV._array.size());
-            for (const auto &s : respV._array)command.push_back(s._bulk);
-            if (raw)
-                gAof.appendRaw(*raw);
-            else gAof.appendCommand(command);
-            gReplQueue.push_back(command);
-            
-            return respInteger(added);
-        }
-        if (cmd == "ZREM")
-        {
-            // 移除zset中的指定元素，格式如zrem key member [member ...]
-            if (respV._array.size() < 3)
-                return respError("ERR wrong number of arguments for 'ZREM'");
-            if (respV._array[1]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            std::vector<std::string> members;
-            for (size_t i = 1; i < respV._array.size(); i++)
+            else if (name == "maxmemory-policy")
             {
-                if (respV._array[i]._type != RespType::BulkString)
-                    return respError("ERR syntax");
-                members.emplace_back(respV._array[i]._bulk);
+                MaxmemoryPolicy policy;
+                if (!parseMaxmemoryPolicy(val, policy))
+                    return ctx._reply.error("ERR Invalid argument '" + val + "' for CONFIG SET 'maxmemory-policy'");
+                gStore.setMaxmemoryPolicy(policy);
             }
-            int removed = gStore.zrem(respV._array[1]._bulk, members);
-            if (removed > 0)
+            else if (name == "maxmemory-samples")
             {
-                // 当zrem删除了数据时我们才需要记录下这条命令
-                /*std::vector<std::string> command;
-                command.reserve(2 + members.size());*/
-                std::vector<std::string> command;
-                command.reserve(respV._array.size());
-                for (const auto &s : respV._array)command.push_back(s._bulk);
-                if (raw)
-                    gAof.appendRaw(*raw);
-                else gAof.appendCommand(command);
-                gReplQueue.push_back(command);
-                
+                int samples = 0;
+                auto [end, ec] = std::from_chars(val.data(), val.data() + val.size(), samples);
+                if (ec != std::errc{} || end != val.data() + val.size() || samples < 1 || samples > 64)
+                    return ctx._reply.error("ERR Invalid argument '" + val + "' for CONFIG SET 'maxmemory-samples'");
+                gStore.setMaxmemorySamples(samples);
             }
-            return respInteger(removed);
+            else
+                return ctx._reply.error("ERR Unsupported CONFIG parameter: " + name);
+            return ctx._reply.ok();
         }
-        if (cmd == "ZRANGE")
+        else if (sub == "RESETSTAT")
         {
-            // zrange key start stop [withscores]
-            // 在此实现成zrange key start stop
-            if (respV._array.size() != 4)
-                return respError("ERR wrong number of arguments for 'ZRANGE'");
-            if (respV._array[1]._type != RespType::BulkString || respV._array[2]._type != RespType::BulkString || respV._array[3]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            try
-            {
-                int64_t start = std::stoll(respV._array[2]._bulk);
-                int64_t stop = std::stoll(respV._array[3]._bulk);
-                auto members = gStore.zrange(respV._array[1]._bulk, start, stop);
-                std::string out = "*" + std::to_string(members.size()) + "\r\n";
-                for (const auto &m : members)
-                    out += respBulkString(m);
-                return out;
-            }
-            catch (...)
-            {
-                return respError("error with args swith");
-            }
+            if (args.size() != 2)
+                return ctx._reply.error("ERR wrong number of arguments for 'CONFIG RESETSTAT'");
+            return ctx._reply.ok();
         }
-        if (cmd == "ZSCORE")
+        else
         {
-            // zscore key member
-            if (respV._array.size() != 3)
-                return respError("ERR wrong number of arguments for 'ZSCORE'");
-            if (respV._array[1]._type != RespType::BulkString || respV._array[2]._type != RespType::BulkString)
-                return respError("ERR syntax");
-            auto s = gStore.zscore(respV._array[1]._bulk, respV._array[2]._bulk);
-            if (!s.has_value())
-                return respNullBulk();
-            return respBulkString(std::to_string(*s));
+            return ctx._reply.error("ERR unsupported CONFIG subcommand");
         }
-        if (cmd == "BGSAVE" || cmd == "SAVE")
+    }
+    // 和redis的bytesToHuman一样，例如1.50M
+    static std::string bytesToHuman(size_t bytes)
+    {
+        const char *units = "BKMGT";
+        double v = static_cast<double>(bytes);
+        size_t u = 0;
+        while (v >= 1024 && u + 1 < std::strlen(units))
         {
-            // 这里暂时实现成阻塞主线程模式
-            if (respV._array.size() != 1)
-                return respError("ERR wrong number of arguments for 'BGSAVE' or 'SAVE'");
-            std::string err;
-            //std::cout<<"cmd save\n";
-            if (!gRdb.save(gStore, err))
-                return respError(std::string{"ERR rdb save faild:"} + err);
-            return respSimpleString("OK");
+            v /= 1024;
+            ++u;
+        }
+        char buf[32];
+        if (u == 0)
+            std::snprintf(buf, sizeof(buf), "%zuB", bytes);
+        else
+            std::snprintf(buf, sizeof(buf), "%.2f%c", v, units[u]);
+        return buf;
+    }
+    // 和键空间无关的内存开销：启动时的内存、复制积压缓冲区、字典的槽位和过期索引
+    struct MemoryOverhead
+    {
+        size_t _used;
+        size_t _backlog;
+        size_t _overhead;
+        KeyspaceMemory _keyspace;
+    };
+    static MemoryOverhead memoryOverhead()
+    {
+        MemoryOverhead m;
+        m._used = usedMemory();
+        {
+            std::lock_guard<std::mutex> lock(gReplMutex);
+            m._backlog = allocationSize(gReplBacklog.data());
         }
-        if (cmd == "BGREWRITEAOF")
+        m._keyspace = gStore.memoryStats();
+        m._overhead = gStartupMemory + m._backlog + m._keyspace._tableBytes + m._keyspace._expireIndexBytes;
+        return m;
+    }
+    // MEMORY USAGE key [SAMPLES count]
+    // MEMORY STATS
+    static void cmdMemory(CommandContext &ctx)
+    {
+        const std::vector<std::string_view> &args = ctx._args;
+        if (equalsIgnoreCase(args[1], "usage"))
         {
-            // 重写aof文件，随着时间推移，aof文件越来越大，需要对aof文件内容进行优化
-            if (respV._array.size() != 1)
-                return respError("ERR wrong number of arguments for 'BGREWRITEAOF'");
-            std::string err;
-            if (!gAof.isEnabled())
-                return respError("ERR aof disabled");
-            if (!gAof.bgRewrite(gStore, err))
-                return respError(std::string{"ERROR"} + err);
-            return respSimpleString("OK");
-        }
-        if (cmd == "CONFIG")
-        {
-            // config get/set/resetstat 后面跟配置的key值
-            if (respV._array.size() < 2)
-                return respError("ERR wrong number of arguments for 'CONFIG'");
-            if (respV._array[1]._type != RespType::BulkString && respV._array[1]._type != RespType::SimpleString)
-                return respError("ERR syntax");
-            std::string sub;
-            for (auto &c : respV._array[1]._bulk)
-                sub.push_back(static_cast<char>(::toupper(c)));
-            if (sub == "GET")
+            size_t samples = 5;
+            if (args.size() == 5 && equalsIgnoreCase(args[3], "samples"))
             {
-                std::string pattern = "*"; // 默认get操作的参数
-                if (respV._array.size() >= 3)
-                {
-                    // 如果get命令的长度>=3，那么说明命令自带get参数，使用自带参数就行了
-                    if (respV._array[2]._type != RespType::BulkString && respV._array[2]._type != RespType::SimpleString)
-                        return respError("ERR syntax");
-                    pattern = respV._array[2]._bulk;
-                }
-                // 判断pattern与传入参数是否相同或者pattern是否为*
-                auto match = [&](const std::string &k) -> bool
-                {
-                    if (pattern == "*")
-                        return true;
-                    return pattern == k;
-                };
-                std::vector<std::pair<std::string, std::string>> kvs;
-                kvs.emplace_back("appendonly", gAof.isEnabled() ? "yes" : "no");
-                std::string appendfsync;
-                switch (gAof.mode())
-                {
-                case AofMode::No:
-                    appendfsync = "no";
-                    break;
-                case AofMode::EverySec:
-                    appendfsync = "everysec";
-                    break;
-                case AofMode::Always:
-                    appendfsync = "always";
-                    break;
-                }
-                kvs.emplace_back("appendfsync", appendfsync);
-                kvs.emplace_back("dir", "./data");
-                kvs.emplace_back("dbfilename", "dump.rdb");
-                kvs.emplace_back("save", "");
-                kvs.emplace_back("timeout", "0");
-                kvs.emplace_back("databases", "16");
-                kvs.emplace_back("maxmemory", "0");
-                std::string body;
-                size_t elems = 0;
-                if (pattern == "*")
-                {
-                    for (auto &p : kvs)
-                    {
-                        body += respBulkString(p.first);
-                        body += respBulkString(p.second);
-                        elems += 2;
-                    }
-                }
-                else
-                {
-                    for (auto &p : kvs)
-                    {
-                        if (match(p.first))
-                        {
-                            body += respBulkString(p.first);
-                            body += respBulkString(p.second);
-                            elems += 2;
-                        }
-                    }
-                }
-                return "*" + std::to_string(elems) + "\r\n" + body;
+                auto [end, ec] = std::from_chars(args[4].data(), args[4].data() + args[4].size(), samples);
+                if (ec != std::errc{} || end != args[4].data() + args[4].size())
+                    return ctx._reply.error("ERR value is not an integer or out of range");
             }
-            else if (sub == "RESETSTAT")
+            else if (args.size() != 3)
+                return ctx._reply.error("ERR syntax error");
+            std::optional<size_t> bytes = gStore.memoryUsage(args[2], samples);
+            if (!bytes)
+                return ctx._reply.nullBulk();
+            return ctx._reply.integer(static_cast<int64_t>(*bytes));
+        }
+        if (equalsIgnoreCase(args[1], "stats"))
+        {
+            if (args.size() != 2)
+                return ctx._reply.error("ERR wrong number of arguments for 'MEMORY STATS'");
+            MemoryOverhead m = memoryOverhead();
+            const KeyspaceMemory &ks = m._keyspace;
+            size_t net = m._used > gStartupMemory ? m._used - gStartupMemory : 0;
+            size_t dataset = m._used > m._overhead ? m._used - m._overhead : 0;
+            std::vector<std::pair<std::string, size_t>> kvs{
+                {"peak.allocated", peakMemory()},
+                {"total.allocated", m._used},
+                {"startup.allocated", gStartupMemory},
+                {"replication.backlog", m._backlog},
+                {"overhead.hashtable.main", ks._tableBytes},
+                {"overhead.hashtable.expires", ks._expireIndexBytes},
+                {"overhead.total", m._overhead},
+                {"keys.count", ks._keys},
+                {"keys.bytes-per-key", ks._keys ? net / ks._keys : 0},
+                {"dataset.bytes", dataset},
+                {"dataset.strings.keys", ks._typeKeys[static_cast<size_t>(ObjectType::String)]},
+                {"dataset.strings.bytes", ks._typeBytes[static_cast<size_t>(ObjectType::String)]},
+                {"dataset.hashes.keys", ks._typeKeys[static_cast<size_t>(ObjectType::Hash)]},
+                {"dataset.hashes.bytes", ks._typeBytes[static_cast<size_t>(ObjectType::Hash)]},
+                {"dataset.zsets.keys", ks._typeKeys[static_cast<size_t>(ObjectType::Zset)]},
+                {"dataset.zsets.bytes", ks._typeBytes[static_cast<size_t>(ObjectType::Zset)]},
+            };
+            ctx._reply.arrayHeader(2 * kvs.size() + 2);
+            for (const auto &[name, val] : kvs)
             {
-                if (respV._array.size() != 2)
-                    return respError("ERR wrong number of arguments for 'CONFIG RESETSTAT'");
-                return respSimpleString("OK");
+                ctx._reply.bulk(name);
+                ctx._reply.integer(static_cast<int64_t>(val));
             }
-            else
+            char pct[32];
+            std::snprintf(pct, sizeof(pct), "%.2f", net ? 100.0 * static_cast<double>(dataset) / static_cast<double>(net) : 0.0);
+            ctx._reply.bulk(std::string_view{"dataset.percentage"});
+            return ctx._reply.bulk(std::string{pct});
+        }
+        return ctx._reply.error("ERR unknown MEMORY subcommand");
+    }
+    static void cmdInfo(CommandContext &ctx)
+    {
+        // INFO [section] -> ignore section for now
+        std::string info;
+        info.reserve(512);
+        info += "# Server\r\nredis_version:0.1.0\r\nrole:master\r\n";
+        info += "# Clients\r\nconnected_clients:0\r\n";
+        {
+            MemoryOverhead m = memoryOverhead();
+            size_t peak = peakMemory();
+            size_t maxmemory = gStore.maxmemory();
+            info += "# Memory\r\nused_memory:" + std::to_string(m._used) + "\r\n";
+            info += "used_memory_human:" + bytesToHuman(m._used) + "\r\n";
+            info += "used_memory_peak:" + std::to_string(peak) + "\r\n";
+            info += "used_memory_peak_human:" + bytesToHuman(peak) + "\r\n";
+            info += "used_memory_startup:" + std::to_string(gStartupMemory) + "\r\n";
+            info += "used_memory_overhead:" + std::to_string(m._overhead) + "\r\n";
+            info += "used_memory_dataset:" + std::to_string(m._used > m._overhead ? m._used - m._overhead : 0) + "\r\n";
+            info += "maxmemory:" + std::to_string(maxmemory) + "\r\n";
+            info += "maxmemory_human:" + bytesToHuman(maxmemory) + "\r\n";
+            info += "maxmemory_policy:" + std::string{maxmemoryPolicyName(gStore.maxmemoryPolicy())} + "\r\n";
+            info += "lazyfree_pending_objects:" + std::to_string(gStore.lazyfreePending()) + "\r\n";
+            info += "lazyfreed_objects:" + std::to_string(gStore.lazyfreedObjects()) + "\r\n";
+        }
+        info += "# Stats\r\ntotal_connections_received:0\r\ntotal_commands_processed:0\r\ninstantaneous_ops_per_sec:0\r\n";
+        ExpireStats es = gStore.expireStats();
+        info += "expired_keys:" + std::to_string(es._expiredKeys) + "\r\n";
+        info += "expired_stale_entries:" + std::to_string(es._staleEntries) + "\r\n";
+        info += "expired_time_cap_reached_count:" + std::to_string(es._timeCapReached) + "\r\n";
+        info += "expire_cycle_cpu_milliseconds:" + std::to_string(es._cycleUs / 1000) + "\r\n";
+        info += "evicted_keys:" + std::to_string(gStore.evictedKeys()) + "\r\n";
+        info += "# Persistence\r\naof_enabled:";
+        info += (gAof.isEnabled() ? "1" : "0");
+        info += "\r\naof_rewrite_in_progress:0\r\nrdb_bgsave_in_progress:0\r\n";
+        {
+            std::lock_guard<std::mutex> lock(gReplMutex);
+            info += "# Replication\r\nconnected_slaves:" + std::to_string(gReplicas.size()) + "\r\nmaster_repl_offset:" + std::to_string(gRepliBacklogOffset) + "\r\n";
+        }
+        return ctx._reply.bulk(info);
+    }
+    // 命令表，新增命令只需要在这里加一行
+    static constexpr CommandSpec kCommandSpecs[] = {
+        {"ping", -1, 0, cmdPing},
+        {"echo", 2, 0, cmdEcho},
+        {"set", -3, kCmdWrite | kCmdDenyOom, cmdSet},
+        {"get", 2, 0, cmdGet},
+        {"keys", -1, 0, cmdKeys},
+        {"flushall", -1, kCmdWrite, cmdFlushall},
+        {"del", -2, kCmdWrite, cmdDel},
+        {"unlink", -2, kCmdWrite, cmdDel},
+        {"exists", 2, 0, cmdExists},
+        {"expire", 3, kCmdWrite, cmdExpire},
+        {"ttl", 2, 0, cmdTtl},
+        {"hset", -4, kCmdWrite | kCmdDenyOom, cmdHset},
+        {"hget", 3, 0, cmdHget},
+        {"hdel", -3, kCmdWrite, cmdHdel},
+        {"hexists", 3, 0, cmdHexists},
+        {"hgetall", 2, 0, cmdHgetall},
+        {"hlen", 2, 0, cmdHlen},
+        {"zadd", -4, kCmdWrite | kCmdDenyOom, cmdZadd},
+        {"zincrby", 4, kCmdWrite | kCmdDenyOom, cmdZincrby},
+        {"zrem", -3, kCmdWrite, cmdZrem},
+        {"zrange", 4, 0, cmdZrange},
+        {"zscore", 3, 0, cmdZscore},
+        {"zrank", 3, 0, cmdZrank},
+        {"zrevrank", 3, 0, cmdZrevrank},
+        {"zrangebyscore", -4, 0, cmdZrangebyscore},
+        {"zcount", 4, 0, cmdZcount},
+        {"zremrangebyscore", 4, kCmdWrite, cmdZremrangebyscore},
+        {"bgsave", 1, 0, cmdBgsave},
+        {"save", 1, 0, cmdBgsave},
+        {"bgrewriteaof", 1, 0, cmdBgrewriteaof},
+        {"config", -2, 0, cmdConfig},
+        {"info", -1, 0, cmdInfo},
+        {"memory", -2, 0, cmdMemory},
+    };
+    static constexpr size_t kCommandCount = sizeof(kCommandSpecs) / sizeof(kCommandSpecs[0]);
+    // 开放寻址的哈希槽，槽数取2的幂并且远大于命令数，编译期就把每个命令放进自己的槽里
+    static constexpr size_t kCommandSlotCount = 128;
+    static_assert(kCommandCount < kCommandSlotCount / 2, "command table is too full");
+    struct CommandSlots
+    {
+        int8_t _index[kCommandSlotCount];
+        size_t _maxProbe; // 最坏情况下查找需要探测的槽数
+    };
+    static constexpr CommandSlots buildCommandSlots()
+    {
+        CommandSlots slots{};
+        for (size_t i = 0; i < kCommandSlotCount; i++)
+            slots._index[i] = -1;
+        slots._maxProbe = 0;
+        for (size_t i = 0; i < kCommandCount; i++)
+        {
+            size_t pos = foldHash(kCommandSpecs[i]._name) & (kCommandSlotCount - 1);
+            size_t probe = 1;
+            while (slots._index[pos] != -1)
             {
-                return respError("ERR unsupported CONFIG subcommand");
+                pos = (pos + 1) & (kCommandSlotCount - 1);
+                probe++;
             }
+            slots._index[pos] = static_cast<int8_t>(i);
+            if (probe > slots._maxProbe)
+                slots._maxProbe = probe;
+        }
+        return slots;
+    }
+    static constexpr CommandSlots kCommandSlots = buildCommandSlots();
+    // 冲突很少，保证任何命令最多比较两次就能查到，新增命令导致冲突变多时编译就会失败，换一个槽数即可
+    static_assert(kCommandSlots._maxProbe <= 2, "command table has too many collisions");
+    static const CommandSpec *lookupCommand(std::string_view name)
+    {
+        size_t pos = foldHash(name) & (kCommandSlotCount - 1);
+        for (size_t probe = 0; probe < kCommandSlots._maxProbe; probe++)
+        {
+            int8_t idx = kCommandSlots._index[pos];
+            if (idx < 0)
+                return nullptr;
+            if (equalsIgnoreCase(name, kCommandSpecs[idx]._name))
+                return &kCommandSpecs[idx];
+            pos = (pos + 1) & (kCommandSlotCount - 1);
+        }
+        return nullptr;
+    }
+    // args中的参数都指向连接的输入缓冲区，raw为整条命令的原始字节，为空时按args重新编码
+    // 先查命令表并检查参数个数，写命令修改了数据之后在这里统一记录aof并放入复制队列
+    static constexpr int64_t kEvictBudgetUs = 500; // 每条写命令之前最多花在淘汰上的时间
+    static void handleCommand(const std::vector<std::string_view> &args, std::string_view raw, const ServerConfig &config, RespWriter &reply)
+    {
+        if (args.empty())
+            return reply.error("ERROR protocol");
+        const CommandSpec *spec = lookupCommand(args[0]);
+        if (!spec)
+            return reply.error("ERR unknown command");
+        int argc = static_cast<int>(args.size());
+        if ((spec->_arity > 0 && argc != spec->_arity) || (spec->_arity < 0 && argc < -spec->_arity))
+            return reply.error(std::string{"ERR wrong number of arguments for '"} + std::string{spec->_name} + "' command");
+        std::unique_lock<std::mutex> writeLock(gWriteMutex, std::defer_lock);
+        if (spec->_flags & kCmdWrite)
+            writeLock.lock();
+        // 和redis的performEvictions一样在执行写命令之前淘汰，淘汰不出空间时只拒绝可能增加内存的命令，DEL等照常执行
+        if ((spec->_flags & kCmdWrite) && evictForMaxmemory(config, kEvictBudgetUs) && (spec->_flags & kCmdDenyOom))
+            return reply.error("OOM command not allowed when used memory > 'maxmemory'.");
+        CommandContext ctx{args, config, reply};
+        // 所有类型共用一个键空间，类型不符时存储层抛出WrongTypeError，这时数据没有被修改，也就不需要记录aof
+        try
+        {
+            spec->_handler(ctx);
         }
-        if (cmd == "INFO")
+        catch (const WrongTypeError &e)
         {
-            // INFO [section] -> ignore section for now
-            std::string info;
-            info.reserve(512);
-            info += "# Server\r\nredis_version:0.1.0\r\nrole:master\r\n";
-            info += "# Clients\r\nconnected_clients:0\r\n";
-            info += "# Stats\r\ntotal_connections_received:0\r\ntotal_commands_processed:0\r\ninstantaneous_ops_per_sec:0\r\n";
-            info += "# Persistence\r\naof_enabled:";
-            info += (gAof.isEnabled() ? "1" : "0");
-            info += "\r\naof_rewrite_in_progress:0\r\nrdb_bgsave_in_progress:0\r\n";
-            info += "# Replication\r\nconnected_slaves:0\r\nmaster_repl_offset:" + std::to_string(gRepliBacklogOffset) + "\r\n";
-            return respBulkString(info);
+            return reply.error(e.what());
         }
-        return respError("ERR unknown command");
+        if ((spec->_flags & kCmdWrite) && ctx._dirty)
+            propagateWrite(args, raw);
     }
-    //将字符串入队到conn的outChunks数组中
+    //将字符串追加到conn的发送缓冲区中
     static inline void enqueueOut(NetConnection &conn, std::string s)
     {
         if (!s.empty())
         {
-            conn._outChunks.emplace_back(std::move(s));
+            conn._out.append(std::move(s));
         }
     }
     static const size_t kReplBacklogCap = 1024 * 4 * 1024;
     int64_t gReplBacklogStartOffset = 0;
     
-    static std::string gReplBacklog{};
-    
     //添加原始命令字符串到gReplBacklog中
 
 
@@ -841,15 +1222,476 @@ namespace myredis
         gReplBacklogStartOffset = gRepliBacklogOffset - static_cast<int64_t>(gReplBacklog.size());
     }
     extern std::sig_atomic_t gShouldStop;
-    int Server::loop()
+    Reactor::Reactor(const ServerConfig &config, size_t id, std::vector<std::unique_ptr<Reactor>> &group) : _config{config}, _id{id}, _group{group} {}
+    Reactor::~Reactor()
     {
-        std::unordered_map<int, NetConnection> connsMap;
-        std::vector<epoll_event> events(256);
-        while (1)
+        stop();
+        for (auto &[fd, c] : _connsMap)
+            close(fd);
+        if (_wakeFd >= 0)
+            close(_wakeFd);
+        if (_epollFd >= 0)
+            close(_epollFd);
+    }
+    int Reactor::init()
+    {
+        _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_wakeFd < 0)
         {
-            if(gShouldStop)return 0;
-            int nready = epoll_wait(_epollFd, events.data(), static_cast<int>(events.size()), -1);
-            if (nready < 0)
+            std::perror("failed to create eventfd\n");
+            return -1;
+        }
+        if (_config._net._backend == IoBackend::Uring)
+        {
+#ifdef MYREDIS_WITH_IO_URING
+            auto ring = std::make_unique<IoUring>();
+            if (ring->init(kUringEntries) && ring->setupBufs(0, kUringBufCount, kUringBufSize))
+            {
+                _ring = std::move(ring);
+                _uring = true;
+                armPoll(_wakeFd, kOpWake);
+                return 0;
+            }
+            std::perror("failed to set up io_uring, falling back to epoll\n");
+#else
+            std::cerr << "io_uring backend is not compiled in, falling back to epoll\n";
+#endif
+        }
+        _epollFd = epoll_create(1);
+        if (_epollFd < 0)
+        {
+            std::perror("epoll fd is failed to allocate\n");
+            return -1;
+        }
+        if (addEpoll(_epollFd, _wakeFd, EPOLLIN) == -1)
+        {
+            std::perror("failed to add eventfd to epoll\n");
+            return -1;
+        }
+        return 0;
+    }
+    int Reactor::watchListen(int listenFd)
+    {
+        _listenFd = listenFd;
+#ifdef MYREDIS_WITH_IO_URING
+        if (_uring)
+        {
+            armAccept();
+            return 0;
+        }
+#endif
+        // listenfd设置为边缘触发，那么就是说从条件不满足到条件满足才会触发一次，提高效率
+        // 这样可以配合后续的循环accept
+        if (addEpoll(_epollFd, _listenFd, EPOLLIN | EPOLLET) == -1)
+        {
+            std::perror("failed to add listen fd to epoll\n");
+            return -1;
+        }
+        return 0;
+    }
+    int Reactor::watchTimer(int timerFd)
+    {
+        _timerFd = timerFd;
+        if (_uring)
+        {
+#ifdef MYREDIS_WITH_IO_URING
+            armPoll(_timerFd, kOpTimer);
+#endif
+            return 0;
+        }
+        if (addEpoll(_epollFd, _timerFd, EPOLLIN | EPOLLET) == -1)
+        {
+            std::perror("failed to add timerfd to epoll\n");
+            return -1;
+        }
+        return 0;
+    }
+    // 除了主线程上的reactor，其余reactor各开一个线程跑事件循环
+    void Reactor::start()
+    {
+        // 信号只交给主线程处理，所以先屏蔽掉全部信号再创建线程，新线程会继承这个信号掩码
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+        _thread = std::thread([this]
+                              { loop(); });
+        pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    }
+    void Reactor::stop()
+    {
+        _stop.store(true);
+        if (_wakeFd >= 0)
+        {
+            uint64_t one = 1;
+            ssize_t w = ::write(_wakeFd, &one, sizeof(one));
+            (void)w;
+        }
+        if (_thread.joinable())
+            _thread.join();
+    }
+    void Reactor::adopt(int cfd)
+    {
+        _connCount.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_inboxMutex);
+            _inboxFds.push_back(cfd);
+        }
+        uint64_t one = 1;
+        ssize_t w = ::write(_wakeFd, &one, sizeof(one));
+        (void)w;
+    }
+    void Reactor::post(int fd, uint64_t connId, std::string data)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_inboxMutex);
+            _inboxOut.push_back(Outgoing{fd, connId, std::move(data)});
+        }
+        uint64_t one = 1;
+        ssize_t w = ::write(_wakeFd, &one, sizeof(one));
+        (void)w;
+    }
+    // 按照配置的分发策略选出下一条连接归属的reactor
+    Reactor &Reactor::pick()
+    {
+        if (_config._net._dispatch == IoDispatch::LeastConn)
+        {
+            size_t best = 0;
+            for (size_t i = 1; i < _group.size(); i++)
+            {
+                if (_group[i]->load() < _group[best]->load())
+                    best = i;
+            }
+            return *_group[best];
+        }
+        Reactor &r = *_group[_rrIndex % _group.size()];
+        _rrIndex++;
+        return r;
+    }
+    void Reactor::addConn(int cfd)
+    {
+        if (!_uring)
+            addEpoll(_epollFd, cfd, EPOLLIN);
+        // 根基cfd索引可以直接找到对应的NetConnection
+        NetConnection conn{cfd, std::string{}, OutBuffer{}, RespParser{}, false};
+        conn._id = ++gConnIdGen;
+        auto it = _connsMap.emplace(cfd, std::move(conn)).first;
+#ifdef MYREDIS_WITH_IO_URING
+        if (_uring)
+            armRecv(it->second);
+#else
+        (void)it;
+#endif
+    }
+    void Reactor::closeConn(std::unordered_map<int, NetConnection>::iterator it)
+    {
+        int fd = it->first;
+        if (it->second.isReplica)
+        {
+            // 先从登记表中摘掉，之后其他线程就不会再往这条连接投递复制流
+            std::lock_guard<std::mutex> lock(gReplMutex);
+            uint64_t id = it->second._id;
+            gReplicas.erase(std::remove_if(gReplicas.begin(), gReplicas.end(), [&](const ReplicaLink &l)
+                                           { return l._reactor == this && l._connId == id; }),
+                            gReplicas.end());
+        }
+#ifdef MYREDIS_WITH_IO_URING
+        if (_uring)
+        {
+            // shutdown让挂在这条连接上的multishot recv结束，在途的sendmsg还引用着连接的发送队列，要等它完成后再释放
+            NetConnection &conn = it->second;
+            if (!conn._closing)
+                ::shutdown(fd, SHUT_RDWR);
+            conn._closing = true;
+            conn.isReplica = false;
+            if (conn._sendInFlight)
+                return;
+        }
+        else
+#endif
+            epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        _connsMap.erase(it);
+        _connCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void Reactor::acceptAll()
+    {
+        // 监听fd只会触发EPOLLIN事件接收客户端连接建立请求
+        // 一次listenfd读事件的触发只是告诉程序至少有一个连接等待被处理，所以我们要循环accept直到全连接队列为空发生错误跳出循环
+        // 之前的事件驱动reactor网络模型我理解上有问题，几乎所有的服务器都是使用非阻塞listenfd
+        while (1)
+        {
+            sockaddr_in cliAddr{};
+            socklen_t addrLen = sizeof(sockaddr_in);
+            int cfd = accept(_listenFd, reinterpret_cast<sockaddr *>(&cliAddr), &addrLen);
+            if (cfd == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                std::perror("accept failed\n");
+                break;
+            }
+            //std::cout<<"fd:"<<cfd<<" "<<inet_ntoa(cliAddr.sin_addr)<<'\n';
+            // 设置cfd为非阻塞模式，方便后续的一次性循环读取数据，当内核写缓冲区满时也可以不阻塞返回
+            setNonBlock(cfd);
+            // 同时在高性能场景下，将cfd的tcp层面的Nagle 算法关闭，Nagle 算法是尽量减少小包的频繁发送，尽量凑足一个大包再一起发送，用网络带宽来换取数据传输及时性
+            // 就是说在Nagle算法开启的情况下，当本端发送一个小包时，如果对端没有回ack并且当前仍小于MSS，本端就不再发送新的数据包而是等待对端回应一个ack或者等待本端凑够一个MSS大小再一起发送，这样也是重传了之前未得回应的小包
+            // Nagle算法就是在tcp协议上新增的一个小包层的过滤
+            int on = 1;
+            setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            // SO_REUSEPORT模式下内核已经替我们做了分发，连接直接留在本reactor
+            Reactor &target = _config._net._reusePort ? *this : pick();
+            if (&target == this)
+            {
+                _connCount.fetch_add(1, std::memory_order_relaxed);
+                addConn(cfd);
+            }
+            else
+                target.adopt(cfd);
+        }
+    }
+    void Reactor::drainTimer()
+    {
+        uint64_t count = 0;
+        bool fired = false;
+        // 内核中有一个8字节的字段存储timerfd过期次数，read一次就重置这个字段为0
+        // 在timerfd为阻塞模式下，如果内核过期次数字段为0，那么read会阻塞，如果在非阻塞模式下，read会返回错误
+        while (1)
+        {
+            ssize_t r = read(_timerFd, &count, sizeof(uint64_t));
+            if (r == -1)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    std::perror("failed to read timerfd\n");
+                break;
+            }
+            if (r == 0)
+                break;
+            fired = true;
+        }
+        if (!fired)
+            return;
+        // 事件循环被长命令耽误时可能错过了几个周期，错过的不补跑，每次只跑一个周期的预算
+        int64_t periodUs = 1000000 / _config._hz;
+        // 从节点不自己删过期key，和redis一样等主节点同步过来的DEL；主节点删掉的key作为DEL写进AOF和复制流，
+        // 否则AOF重放或者从节点上这些key会一直留着
+        if (!_config._replica._enabled)
+        {
+            std::lock_guard<std::mutex> writeLock(gWriteMutex);
+            std::vector<std::string> expired;
+            gStore.activeExpireCycle(periodUs * _config._store._activeExpireCpuPercent / 100, expired);
+            for (const std::string &key : expired)
+                propagateWrite({"DEL", key}, {});
+        }
+        // 每个周期最多花1ms推进字典搬迁，键空间扩容时的搬迁不会全部压在客户端命令上
+        gStore.rehashStep(1000);
+        // 没有写命令进来时也把内存降到maxmemory以下，淘汰产生的DEL在这里直接放进复制流
+        {
+            std::lock_guard<std::mutex> writeLock(gWriteMutex);
+            evictForMaxmemory(_config, 1000);
+        }
+        propagateRepl();
+        updatePeakMemory();
+    }
+    // 取出收件箱中其他线程投递过来的新连接和待发送数据
+    void Reactor::drainInbox()
+    {
+        uint64_t cnt = 0;
+        while (::read(_wakeFd, &cnt, sizeof(cnt)) > 0)
+        {
+        }
+        std::vector<int> fds;
+        std::vector<Outgoing> outs;
+        {
+            std::lock_guard<std::mutex> lock(_inboxMutex);
+            fds.swap(_inboxFds);
+            outs.swap(_inboxOut);
+        }
+        for (int cfd : fds)
+            addConn(cfd);
+        for (auto &o : outs)
+            deliver(o._fd, o._connId, std::move(o._data));
+    }
+    void Reactor::deliver(int fd, uint64_t connId, std::string data)
+    {
+        auto it = _connsMap.find(fd);
+        // fd可能已经关闭并被新连接复用，序号对不上就丢弃
+        if (it == _connsMap.end() || it->second._id != connId)
+            return;
+        enqueueOut(it->second, std::move(data));
+#ifdef MYREDIS_WITH_IO_URING
+        if (_uring)
+        {
+            queueSend(it->second);
+            return;
+        }
+#endif
+        if (hasPending(it->second))
+            modEpoll(_epollFd, fd, EPOLLIN | EPOLLET | EPOLLOUT | EPOLLRDHUP);
+    }
+    //这是在读操作执行后的操作，也就是说读事件触发时说明可能有对redis的写操作，那么必须将这个写操作同步到所有从节点上
+    // 在执行完写操作后会将这个复制队列的内容放入复制积压缓冲区中
+    // 复制队列是全局的，哪个线程先来就把队列里所有线程的命令按执行顺序一起推送，投递也在锁里完成，各从节点收到的顺序不会乱
+    void Reactor::propagateRepl()
+    {
+        if (!gReplPending)
+            return;
+        gReplPending = false;
+        std::lock_guard<std::mutex> lock(gReplMutex);
+        flushReplQueue();
+    }
+    // 把复制队列里的命令写进积压缓冲区并发给已登记的从节点，调用方必须持有gReplMutex
+    void Reactor::flushReplQueue()
+    {
+        if (gReplQueue.empty())
+            return;
+        if (!gReplicas.empty())
+        {
+            std::string payload;
+            for (const auto &v : gReplQueue)
+            {
+                //先将命令转为原始命令格式
+                std::string cmd = toRespArray(v);
+                int64_t next_off = gRepliBacklogOffset + static_cast<int64_t>(cmd.size());
+                //组织一条offset命令准备回发
+                std::string off = "+OFFSET " + std::to_string(next_off) + "\r\n";
+                appendToBacklog(off);
+                appendToBacklog(cmd);
+                gRepliBacklogOffset = next_off;
+                payload += off;
+                payload += cmd;
+            }
+            // 同一份复制流发给每一个从节点，从节点不在本线程上的就投递到它所在reactor的收件箱
+            for (const auto &link : gReplicas)
+            {
+                if (link._reactor == this)
+                    deliver(link._fd, link._connId, payload);
+                else
+                    link._reactor->post(link._fd, link._connId, payload);
+            }
+        }
+        gReplQueue.clear();
+    }
+    // 解析conn接收缓冲区中所有完整的命令并执行，回复放入conn的发送队列
+    // 命令参数是指向parser缓冲区的string_view，整批命令处理完之前不会再append，所以这些view一直有效
+    void Reactor::processInput(NetConnection &conn, uint32_t &ev)
+    {
+        RespCommand command;
+        while (1)
+        {
+            // 解析客户端发来的命令，同时得到原始字符串命令
+            RespParser::Status status = conn._parser.tryParseCommand(command);
+            if (status == RespParser::Status::Incomplete)
+                break;
+            if (status == RespParser::Status::ProtocolError)
+            {
+                enqueueOut(conn, respError("protocol error"));
+                continue;
+            }
+            const std::vector<std::string_view> &args = command._args;
+            {
+                if (!args.empty())
+                {
+                    // redis不区分命令的大小写，这里直接做忽略大小写的比较，不再先转成大写字符串
+                    // 在这里PSYNC是实现成判断增量同步的依据，实际上在新版的redis中，PSYNC是唯一的同步命令，不管从节点需要全量还是增量同步，都是发送PSYNC命令，然后从节点通过主节点的回复来判断具体是增量还是全量同步
+                    if (equalsIgnoreCase(args[0], "psync"))
+                    {
+                        //std::cout<<"repli psync\n";
+                        if (args.size() == 2)
+                        {
+                            int64_t offset = 0;
+                            auto [p, e] = std::from_chars(args[1].data(), args[1].data() + args[1].size(), offset);
+                            if (e != std::errc{} || p != args[1].data() + args[1].size())
+                            {
+                                offset == -1;
+                            }
+                            std::lock_guard<std::mutex> lock(gReplMutex);
+                            if (offset >= gReplBacklogStartOffset && offset <= gRepliBacklogOffset)
+                            {
+                                // 从节点的offset落在[gReplBacklogStartOffset,gRepliBacklogOffset],那么可以增量同步
+                                //[gReplBacklogStartOffset,gRepliBacklogOffset]就像是一个容错窗口，如果从节点的offset还在这个窗口中，那么可以增量同步
+                                size_t start = static_cast<size_t>(offset - gReplBacklogStartOffset); // start就是offset相对于gReplBacklogStartOffset的偏移
+                                if (start < gReplBacklog.size())
+                                {
+                                    // 如果这个偏移量没有越界
+                                    conn.isReplica = true; // 标志conn为从节点
+                                    gReplicas.push_back(ReplicaLink{this, conn._fd, conn._id});
+                                    // 回复一个"+offset number",这个回复是自定义的，只要我在myredis这个程序中约定好这个回复的收发就能解析
+                                    std::string reply = std::string{"+OFFSET "} + std::to_string(gRepliBacklogOffset) + std::string{"\r\n"};
+                                    enqueueOut(conn, reply);
+                                    // 将偏移量后面的内容塞进发送队列中
+                                    enqueueOut(conn, gReplBacklog.substr(start));
+                                    continue;
+                                }
+                            }
+                        }
+                    }
+                    // 在这里是判断从节点需要全量同步
+                    if (equalsIgnoreCase(args[0], "sync"))
+                    {
+                        // 快照期间挡住所有写命令，直到从节点登记完、偏移量读出来才放开，
+                        // 这样快照里的数据和之后发给它的复制流正好在同一个位置分开，写命令既不会重放两次也不会丢
+                        std::unique_lock<std::mutex> writeLock(gWriteMutex);
+                        std::string err{};
+                        RdbOptions rdbOptionTmp = _config._rdb;
+                        if (!rdbOptionTmp._enabled)
+                            rdbOptionTmp._enabled = true;
+                        Rdb rdb{rdbOptionTmp};
+                        if (!rdb.save(gStore, err))
+                            enqueueOut(conn, respError("error with rdb save\n"));
+                        else
+                        {
+                            std::string path = rdb.path();
+                            int fd = ::open(path.c_str(), O_RDONLY);
+                            if (fd == -1)
+                                enqueueOut(conn, respError("can not open file"));
+                            
+                            else
+                            {   
+                                char buf[8192] = {'\0'};
+                                std::string content{};
+                                size_t rlen = 0;
+                                while ((rlen = ::read(fd, buf, sizeof(buf)))>0){
+                                    content.append(buf, rlen);
+                                }
+                                close(fd);
+                                RespWriter{conn._out}.bulk(std::move(content));
+                                conn.isReplica = true;
+                                std::lock_guard<std::mutex> lock(gReplMutex);
+                                // 队列里还没推送的命令已经包含在快照里了，先发给原有的从节点，不能让新从节点再收一遍
+                                flushReplQueue();
+                                gReplicas.push_back(ReplicaLink{this, conn._fd, conn._id});
+                                std::string off = "+OFFSET" + std::to_string(gRepliBacklogOffset) + "\r\n";
+                                enqueueOut(conn, std::move(off));
+                            }
+                        }
+                        //如果是repli_client，接下来就是执行continue,此举会导致不会执行tryFlushNow，也就是说不会直接发送回复，而是走EPOLLOUT路线
+                        //那么就会发生在EPOLLOUT那里将发送缓冲区中数据完全发送之后发现hasPending(cfd)为false,然后就close(cfd),断开了这条连接
+                        continue;
+                    }
+                }
+                // 处理命令
+                RespWriter reply{conn._out};
+                handleCommand(args, command._raw, _config, reply);
+                // 非pipeline模式下处理完之后立马将conn积攒的消息发送出去
+                // pipeline模式由调用方在整批命令执行完后统一发送，io_uring后端则留到本轮循环末尾统一提交
+                if (!_uring && !_config._net._pipeline)
+                    tryFlushNow(conn._fd, conn, ev);
+            }
+        }
+    }
+    int Reactor::loop()
+    {
+#ifdef MYREDIS_WITH_IO_URING
+        if (_uring)
+            return loopUring();
+#endif
+        std::vector<epoll_event> events(256);
+        while (1)
+        {
+            if (gShouldStop || _stop.load())
+                return 0;
+            int nready = epoll_wait(_epollFd, events.data(), static_cast<int>(events.size()), -1);
+            if (nready < 0)
             {
                 // 被信号打断直接忽视再次恢复正常
                 if (errno == EINTR)
@@ -865,78 +1707,34 @@ namespace myredis
                 uint32_t ev = events[i].events;
                 if (fd == _listenFd)
                 {
-                    // 监听fd只会触发EPOLLIN事件接收客户端连接建立请求
-                    // 一次listenfd读事件的触发只是告诉程序至少有一个连接等待被处理，所以我们要循环accept直到全连接队列为空发生错误跳出循环
-                    // 之前的事件驱动reactor网络模型我理解上有问题，几乎所有的服务器都是使用非阻塞listenfd
-                    while (1)
-                    {
-                        sockaddr_in cliAddr{};
-                        socklen_t addrLen = sizeof(sockaddr_in);
-                        int cfd = accept(_listenFd, reinterpret_cast<sockaddr *>(&cliAddr), &addrLen);
-                        if (cfd == -1)
-                        {
-                            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                                break;
-                            std::perror("accept failed\n");
-                            break;
-                        }
-                        //std::cout<<"fd:"<<cfd<<" "<<inet_ntoa(cliAddr.sin_addr)<<'\n';
-                        // 设置cfd为非阻塞模式，方便后续的一次性循环读取数据，当内核写缓冲区满时也可以不阻塞返回
-                        setNonBlock(cfd);
-                        // 同时在高性能场景下，将cfd的tcp层面的Nagle 算法关闭，Nagle 算法是尽量减少小包的频繁发送，尽量凑足一个大包再一起发送，用网络带宽来换取数据传输及时性
-                        // 就是说在Nagle算法开启的情况下，当本端发送一个小包时，如果对端没有回ack并且当前仍小于MSS，本端就不再发送新的数据包而是等待对端回应一个ack或者等待本端凑够一个MSS大小再一起发送，这样也是重传了之前未得回应的小包
-                        // Nagle算法就是在tcp协议上新增的一个小包层的过滤
-                        int on = 1;
-                        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
-                        addEpoll(_epollFd, cfd, EPOLLIN);
-                        // 根基cfd索引可以直接找到对应的NetConnection
-                        connsMap.emplace(cfd, NetConnection{cfd, std::string{}, std::vector<std::string>{}, 0, 0, RespParser{}, false});
-                        //std::cout<<"listen connsMap cnt:"<<connsMap.size()<<'\n';
-                    }
+                    acceptAll();
                     continue;
                 }
                 if (fd == _timerFd)
                 {
-                    while (1)
-                    {
-                        uint64_t count;
-                        // 内核中有一个8字节的字段存储timerfd过期次数，read一次就重置这个字段为0
-                        // 在timerfd为阻塞模式下，如果内核过期次数字段为0，那么read会阻塞，如果在非阻塞模式下，read会返回错误
-                        ssize_t r = read(_timerFd, &count, sizeof(uint64_t));
-                        if (r == -1)
-                        {
-                            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                                break;
-                            std::perror("failed to read timerfd\n");
-                            break;
-                        }
-                        if (r == 0)
-                            break;
-                        while(count--){
-                            gStore.expireScanStep(64);
-                        }
-                    }
+                    drainTimer();
+                    continue;
+                }
+                if (fd == _wakeFd)
+                {
+                    drainInbox();
                     continue;
                 }
                 // 以下只有fd为clientfd才会执行
                 // 先找到connsMap中fd对应的这个pair,然后拿到NetConnection
-                auto it = connsMap.find(fd);
-                if (it == connsMap.end())
+                auto it = _connsMap.find(fd);
+                if (it == _connsMap.end())
                     continue;
                 NetConnection &conn = it->second;
                 // clientfd出现通道不可用或者严重错误，这里的EPOLLHUP不需要用户手动注册，如果fd被挂起，那么内核会自动将EPOLLHUP塞进epoll_wait返回的事件集中
                 if ((ev & EPOLLHUP) || (ev & EPOLLERR))
                 {
-                    epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
-                    //std::cout<<"epoll DEL fd:"<<fd<<'\n';
-                    close(fd);
-                    connsMap.erase(it);
+                    closeConn(it);
                     continue;
                 }
                 // clientfd出现EPOLLIN事件
                 if (ev & EPOLLIN)
                 {
-                    //std::cout<<"EPOLLIN connsMap cnt:"<<connsMap.size()<<'\n';
                     char buf[4096];
                     // 循环读
                     while (1)
@@ -965,141 +1763,11 @@ namespace myredis
                         }
                     }
 
-                    while (1)
-                    {
-                        // 解析客户端发来的命令并且返回原始字符串命令
-                        auto maybe = conn._parser.tryParseOneWithRaw();
-                        if (!maybe.has_value())
-                            break;
-                        const RespValue &v = maybe->first;
-                        const std::string &raw = maybe->second;
-                        if (v._type == RespType::Error)
-                        {
-                            enqueueOut(conn, respError(v._bulk));
-                        }
-                        else
-                        {
-                            if (v._type == RespType::Array && !v._array.empty() && (v._array[0]._type == RespType::SimpleString || v._array[0]._type == RespType::BulkString))
-                            {
-                                std::string cmd{};
-                                cmd.reserve(v._array[0]._bulk.size());
-                                // 将v._array[0]中的字符串转为大写再放入cmd中
-                                // 其实redis是不区分这个命令大小写的，只不过为了代码的一致性，我们不管传来的命令是大写还是小写或者大小写结合，我们先将其全部转为大写再进行比较
-                                for (auto ch : v._array[0]._bulk)
-                                {
-                                    cmd.push_back(static_cast<char>(::toupper(ch)));
-                                }
-                                // 在这里PSYNC是实现成判断增量同步的依据，实际上在新版的redis中，PSYNC是唯一的同步命令，不管从节点需要全量还是增量同步，都是发送PSYNC命令，然后从节点通过主节点的回复来判断具体是增量还是全量同步
-                                if (cmd == "PSYNC")
-                                {
-                                    //std::cout<<"repli psync\n";
-                                    if (v._array.size() == 2 && v._array[1]._type == RespType::BulkString)
-                                    {
-                                        int64_t offset = 0;
-                                        auto [p, e] = std::from_chars(v._array[1]._bulk.data(), v._array[1]._bulk.data() + v._array[1]._bulk.size(), offset);
-                                        if (e != std::errc{} || p != v._array[1]._bulk.data() + v._array[1]._bulk.size())
-                                        {
-                                            offset == -1;
-                                        }
-                                        if (offset >= gReplBacklogStartOffset && offset <= gRepliBacklogOffset)
-                                        {
-                                            // 从节点的offset落在[gReplBacklogStartOffset,gRepliBacklogOffset],那么可以增量同步
-                                            //[gReplBacklogStartOffset,gRepliBacklogOffset]就像是一个容错窗口，如果从节点的offset还在这个窗口中，那么可以增量同步
-                                            size_t start = static_cast<size_t>(offset - gReplBacklogStartOffset); // start就是offset相对于gReplBacklogStartOffset的偏移
-                                            if (start < gReplBacklog.size())
-                                            {
-                                                // 如果这个偏移量没有越界
-                                                conn.isReplica = true; // 标志conn为从节点
-                                                // 回复一个"+offset number",这个回复是自定义的，只要我在myredis这个程序中约定好这个回复的收发就能解析
-                                                std::string reply = std::string{"+OFFSET "} + std::to_string(gRepliBacklogOffset) + std::string{"\r\n"};
-                                                enqueueOut(conn, reply);
-                                                // 将偏移量后面的内容塞进发送队列中
-                                                enqueueOut(conn, gReplBacklog.substr(start));
-                                                continue;
-                                            }
-                                        }
-                                    }
-                                }
-                                // 在这里是判断从节点需要全量同步
-                                if (cmd == "SYNC")
-                                {
-                                    std::string err{};
-                                    RdbOptions rdbOptionTmp = _config._rdb;
-                                    if (!rdbOptionTmp._enabled)
-                                        rdbOptionTmp._enabled = true;
-                                    Rdb rdb{rdbOptionTmp};
-                                    if (!rdb.save(gStore, err))
-                                        enqueueOut(conn, respError("error with rdb save\n"));
-                                    else
-                                    {
-                                        std::string path = rdb.path();
-                                        int fd = ::open(path.c_str(), O_RDONLY);
-                                        if (fd == -1)
-                                            enqueueOut(conn, respError("can not open file"));
-                                        
-                                        else
-                                        {   
-                                            char buf[8192] = {'\0'};
-                                            std::string content{};
-                                            size_t rlen = 0;
-                                            while ((rlen = ::read(fd, buf, sizeof(buf)))>0){
-                                                content.append(buf, rlen);
-                                            }
-                                            close(fd);
-                                            enqueueOut(conn, respBulkString(content));
-                                            conn.isReplica = true;
-                                            std::string off = "+OFFSET" + std::to_string(gRepliBacklogOffset) + "\r\n";
-                                            enqueueOut(conn, std::move(off));
-                                        }
-                                    }
-                                    //如果是repli_client，接下来就是执行continue,此举会导致不会执行tryFlushNow，也就是说不会直接发送回复，而是走EPOLLOUT路线
-                                    //那么就会发生在EPOLLOUT那里将outChunks中数据完全发送之后发现hasPending(cfd)为false,然后就close(cfd),断开了这条连接
-                                    continue;
-                                }
-                            }
-                            // 处理命令
-                            enqueueOut(conn, handleCommand(v, &raw,_config));
-                            // 处理完之后立马将conn积攒的消息发送出去
-                            tryFlushNow(fd, conn, ev);
-                        }
-                    }
-                    //这是在读操作执行后的操作，也就是说读事件触发时说明可能有对redis的写操作，那么必须将这个写操作同步到所有从节点上
-                    // 在执行完写操作后会将这个复制队列的内容放入复制积压缓冲区中
-                    if (!gReplQueue.empty())
-                    {
-                        //std::cout<<"EPOLLIN and gReplQueue unempty\n";
-                        //<<"conns cnt:"<<connsMap.size()<<'\n';
-                        for (auto &[k, c] : connsMap)
-                        {
-                            //std::cout<<"coonsMap loop fd:"<<c._fd<<'\n';
-                            if (!c.isReplica)
-                                continue;
-                            //std::cout<<"block1\n";
-                            //std::cout<<"one is replica\n";
-                            for (const auto &v : gReplQueue)
-                            {
-                                //先将命令转为原始命令格式
-                                std::string cmd = toRespArray(v);
-                                int64_t next_off = gRepliBacklogOffset + static_cast<int64_t>(cmd.size());
-                                //组织一条offset命令准备回发
-                                std::string off = "+OFFSET " + std::to_string(next_off) + "\r\n";
-                                appendToBacklog(off);
-                                appendToBacklog(cmd);
-                                gRepliBacklogOffset = next_off;
-                                //std::cout<<"data enter outChunks\n";
-                                enqueueOut(c, off);
-                                enqueueOut(c, cmd);
-                            }
-                            //std::cout<<"block2\n";
-                            if (hasPending(c))
-                            {
-                                //std::cout<<"!gReplQueue.empty() and mod EPOLLOUT\n";
-                                modEpoll(_epollFd, c._fd, EPOLLIN | EPOLLET | EPOLLOUT | EPOLLRDHUP);
-                            }
-                            //std::cout<<"block3\n";
-                        }
-                        gReplQueue.clear();
-                    }
+                    processInput(conn, ev);
+                    propagateRepl();
+                    // pipeline模式下这次读到的所有命令的回复合在一起，用一次writev发送
+                    if (_config._net._pipeline)
+                        tryFlushNow(fd, conn, ev);
                     if (hasPending(conn))
                     {
                         //std::cout<<"repli conn mod EPOLLOUT\n";
@@ -1107,94 +1775,21 @@ namespace myredis
                     }
                     if ((ev & EPOLLRDHUP) && !hasPending(conn))
                     {
-                        epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
-                        //std::cout<<"epoll del fd:"<<fd<<'\n';
-                        close(fd);
-                        connsMap.erase(it);
+                        closeConn(it);
                         continue;
                     }
                 }
                 if (ev & EPOLLOUT)
                 {
                     //std::cout<<"repli conn enter EPOLLOUT\n";
-                    while (hasPending(conn))
-                    {
-                        const size_t maxIov = 64;
-                        struct iovec iov[maxIov];
-                        int iovcnt = 0;
-                        size_t idx = conn._outIndex;
-                        size_t off = conn._outOffset;
-                        // 将_outChunks中的数据块全部送入iov中
-                        while (idx < conn._outChunks.size() && iovcnt < (int)maxIov)
-                        {
-                            const std::string &s = conn._outChunks[idx];
-                            const char *base = s.data();
-                            size_t len = s.size();
-                            if (off >= len)
-                            {
-                                ++idx;
-                                off = 0;
-                                continue;
-                            }
-                            iov[iovcnt].iov_base = (void *)(base + off);
-                            iov[iovcnt].iov_len = len - off;
-                            ++iovcnt;
-                            ++idx;
-                            off = 0;
-                        }
-                        if (iovcnt == 0)
-                            break;
-                        ssize_t w = ::writev(fd, iov, iovcnt);
-                        //std::cout<<"conn write size:"<<w<<'\n';
-                        if (w > 0)
-                        {
-                            size_t len = (size_t)w;
-                            while (len > 0 && conn._outIndex < conn._outChunks.size())
-                            {
-                                std::string &str = conn._outChunks[conn._outIndex];
-                                size_t avail = str.size() - conn._outOffset;
-                                if (len < avail)
-                                {
-                                    conn._outOffset += len;
-                                    len = 0;
-                                }
-                                else if (len >= avail)
-                                {
-                                    len -= avail;
-                                    conn._outOffset = 0;
-                                    conn._outIndex++;
-                                }
-                            }
-                            if (conn._outIndex >= conn._outChunks.size())
-                            {
-                                // 说明_outChunks全部塞进iov中了，需要清楚资源
-                                //std::cout<<"clear outChunks\n";
-                                conn._outChunks.clear();
-                                conn._outIndex = 0;
-                                conn._outOffset = 0;
-                            }
-                        }
-                        else if (w < 0 && (errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK))
-                        {
-                            break;
-                        }
-                        else
-                        {
-                            std::perror("writev");
-                            ev |= EPOLLRDHUP;
-                            break;
-                        }
-                    }
-                    //在检测到EPOLLOUT事件后，如果发现conn的outChunks发送完毕了，也就是没有数据可以写入内核发送缓冲区，那么说明该连接暂时处于非活跃的状态，可以关闭连接了
+                    tryFlushNow(fd, conn, ev);
+                    //在检测到EPOLLOUT事件后，如果发现conn的发送缓冲区发送完毕了，也就是没有数据可以写入内核发送缓冲区，那么说明该连接暂时处于非活跃的状态，可以关闭连接了
                     if (!hasPending(conn))
                     {
                         //如果conn没有数据可以发送，那么说明可能出问题了,可以考虑关闭连接
                         modEpoll(_epollFd,fd,EPOLLIN|EPOLLRDHUP|EPOLLHUP);
                         if(ev&EPOLLRDHUP){
-                            epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
-                            //std::cout<<"epoll delllll fd:"<<fd<<'\n';
-                            close(fd);
-                            connsMap.erase(it);
+                            closeConn(it);
                             continue;
                         }
                         
@@ -1203,6 +1798,251 @@ namespace myredis
             }
         }
     }
+#ifdef MYREDIS_WITH_IO_URING
+    // 监听fd上挂一个multishot accept，一次提交持续产出新连接
+    void Reactor::armAccept()
+    {
+        io_uring_sqe *sqe = _ring->getSqe();
+        if (!sqe)
+        {
+            std::perror("io_uring sq is full\n");
+            return;
+        }
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = _listenFd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = packUserData(kOpAccept, _listenFd, 0);
+    }
+    // 连接上挂一个multishot recv，数据由内核从provided buffers中挑一块缓冲区写入
+    void Reactor::armRecv(const NetConnection &conn)
+    {
+        io_uring_sqe *sqe = _ring->getSqe();
+        if (!sqe)
+        {
+            std::perror("io_uring sq is full\n");
+            return;
+        }
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn._fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = _ring->bufGroup();
+        sqe->user_data = packUserData(kOpRecv, conn._fd, conn._id);
+    }
+    void Reactor::armPoll(int fd, uint64_t op)
+    {
+        io_uring_sqe *sqe = _ring->getSqe();
+        if (!sqe)
+        {
+            std::perror("io_uring sq is full\n");
+            return;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = packUserData(op, fd, 0);
+    }
+    void Reactor::queueSend(NetConnection &conn)
+    {
+        if (conn._sendQueued || conn._sendInFlight || !hasPending(conn))
+            return;
+        conn._sendQueued = true;
+        _sendQueue.push_back(SendRef{conn._fd, conn._id});
+    }
+    // 为本轮所有有待发送数据的连接各准备一个sendmsg，随后和等待完成事件一起用一次io_uring_enter提交
+    void Reactor::flushSends()
+    {
+        for (const auto &ref : _sendQueue)
+        {
+            auto it = _connsMap.find(ref._fd);
+            if (it == _connsMap.end() || it->second._id != ref._connId)
+                continue;
+            NetConnection &conn = it->second;
+            conn._sendQueued = false;
+            if (conn._sendInFlight || !hasPending(conn))
+                continue;
+            const size_t maxIov = IOV_MAX;
+            conn._iov.resize(maxIov);
+            conn._iov.resize(conn._out.fillIov(conn._iov.data(), maxIov));
+            if (conn._iov.empty())
+                continue;
+            io_uring_sqe *sqe = _ring->getSqe();
+            if (!sqe)
+            {
+                std::perror("io_uring sq is full\n");
+                break;
+            }
+            conn._msg = msghdr{};
+            conn._msg.msg_iov = conn._iov.data();
+            conn._msg.msg_iovlen = conn._iov.size();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = conn._fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&conn._msg);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = packUserData(kOpSend, conn._fd, conn._id);
+            conn._sendInFlight = true;
+        }
+        _sendQueue.clear();
+    }
+    void Reactor::onRecv(int fd, uint64_t idBits, int res, uint32_t flags)
+    {
+        bool hasBuf = flags & IORING_CQE_F_BUFFER;
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        auto it = _connsMap.find(fd);
+        if (it == _connsMap.end() || (it->second._id & 0xffffff) != idBits || it->second._closing)
+        {
+            // 连接已经关闭(或者fd被新连接复用)，缓冲区照样要还给内核
+            if (hasBuf)
+                _ring->recycleBuf(bid);
+            return;
+        }
+        NetConnection &conn = it->second;
+        if (res > 0 && hasBuf)
+        {
+            // 正常读取到数据就追加到conn的parser对象的string中准备解析
+            conn._parser.append(std::string_view{_ring->bufAddr(bid), static_cast<size_t>(res)});
+            _ring->recycleBuf(bid);
+            uint32_t ev = 0;
+            processInput(conn, ev);
+            propagateRepl();
+            queueSend(conn);
+            if (!(flags & IORING_CQE_F_MORE))
+                armRecv(conn);
+            return;
+        }
+        if (hasBuf)
+            _ring->recycleBuf(bid);
+        if (res == -ENOBUFS)
+        {
+            // 缓冲区暂时被用完，multishot recv已经终止，重新挂上即可
+            armRecv(conn);
+            return;
+        }
+        // 对端关闭(res==0)或者出错，发送完剩余数据后关闭
+        conn._closing = true;
+        if (!hasPending(conn) && !conn._sendInFlight)
+        {
+            conn._closing = false;
+            closeConn(it);
+        }
+        else
+            ::shutdown(fd, SHUT_RD);
+    }
+    void Reactor::onSend(int fd, uint64_t idBits, int res)
+    {
+        auto it = _connsMap.find(fd);
+        if (it == _connsMap.end() || (it->second._id & 0xffffff) != idBits)
+            return;
+        NetConnection &conn = it->second;
+        conn._sendInFlight = false;
+        if (res > 0)
+        {
+            conn._out.consume(static_cast<size_t>(res));
+        }
+        else if (res < 0 && res != -EAGAIN && res != -EINTR)
+        {
+            errno = -res;
+            std::perror("sendmsg");
+            conn._out.clear();
+            conn._closing = true;
+        }
+        if (conn._closing && (!hasPending(conn) || res <= 0))
+        {
+            // closeConn遇到已经是_closing的连接不会再次shutdown
+            conn._sendInFlight = false;
+            closeConn(it);
+            return;
+        }
+        queueSend(conn);
+    }
+    // io_uring版本的事件循环：先把本轮积攒的发送请求放进提交队列，再用一次io_uring_enter提交并等待完成事件
+    int Reactor::loopUring()
+    {
+        while (1)
+        {
+            if (gShouldStop || _stop.load())
+                return 0;
+            flushSends();
+            int ret = _ring->submitAndWait(1);
+            if (ret < 0)
+            {
+                // 被信号打断直接忽视再次恢复正常
+                if (ret == -EINTR)
+                    continue;
+                errno = -ret;
+                std::perror("io_uring_enter error\n");
+                return -1;
+            }
+            while (io_uring_cqe *cqe = _ring->peekCqe())
+            {
+                uint64_t ud = cqe->user_data;
+                int res = cqe->res;
+                uint32_t flags = cqe->flags;
+                _ring->cqeSeen();
+                uint64_t op = ud >> 56;
+                int fd = static_cast<int>(static_cast<uint32_t>(ud));
+                uint64_t idBits = (ud >> 32) & 0xffffff;
+                switch (op)
+                {
+                case kOpAccept:
+                    if (res >= 0)
+                    {
+                        int cfd = res;
+                        setNonBlock(cfd);
+                        int on = 1;
+                        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                        Reactor &target = _config._net._reusePort ? *this : pick();
+                        if (&target == this)
+                        {
+                            _connCount.fetch_add(1, std::memory_order_relaxed);
+                            addConn(cfd);
+                        }
+                        else
+                            target.adopt(cfd);
+                    }
+                    else
+                    {
+                        errno = -res;
+                        std::perror("accept failed\n");
+                    }
+                    if (!(flags & IORING_CQE_F_MORE))
+                        armAccept();
+                    break;
+                case kOpRecv:
+                    onRecv(fd, idBits, res, flags);
+                    break;
+                case kOpSend:
+                    onSend(fd, idBits, res);
+                    break;
+                case kOpWake:
+                    drainInbox();
+                    if (!(flags & IORING_CQE_F_MORE))
+                        armPoll(_wakeFd, kOpWake);
+                    break;
+                case kOpTimer:
+                    drainTimer();
+                    if (!(flags & IORING_CQE_F_MORE))
+                        armPoll(_timerFd, kOpTimer);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+#endif
+    // 其余reactor各自在线程上跑，主线程跑_reactors[0]，主线程的循环因为信号退出后再依次停掉其他reactor
+    int Server::loop()
+    {
+        for (size_t i = 1; i < _reactors.size(); i++)
+            _reactors[i]->start();
+        int rc = _reactors[0]->loop();
+        for (size_t i = 1; i < _reactors.size(); i++)
+            _reactors[i]->stop();
+        return rc;
+    }
 
     int Server::run()
     {
@@ -1212,6 +2052,9 @@ namespace myredis
         //设置epoll I/O多路复用
         if (setupEpoll() == -1)
             return -1;
+        //编码阈值要在载入rdb、aof之前设置好
+        gStartupMemory = usedMemory();
+        gStore.setOptions(_config._store);
         //如果配置文件中rdb的enabled是真，那么开启rdb持久化
         if(_config._rdb._enabled){
             //给rdb设置rdb选项配置
@@ -0,0 +1,176 @@
+#include "../include/uring.h"
+#ifdef MYREDIS_WITH_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+namespace myredis
+{
+    static int sysSetup(unsigned entries, io_uring_params *p)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+    }
+    static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+    IoUring::~IoUring()
+    {
+        std::free(_bufBase);
+        if (_sqes)
+            ::munmap(_sqes, _sqesMapSize);
+        if (_cqPtr && _cqPtr != _sqPtr)
+            ::munmap(_cqPtr, _cqMapSize);
+        if (_sqPtr)
+            ::munmap(_sqPtr, _sqMapSize);
+        if (_ringFd >= 0)
+            ::close(_ringFd);
+    }
+    bool IoUring::init(unsigned entries)
+    {
+        io_uring_params p{};
+        _ringFd = sysSetup(entries, &p);
+        if (_ringFd < 0)
+            return false;
+        // 提交队列和完成队列的环形缓冲区需要mmap到用户态，较新的内核两者共用一次mmap
+        _sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single && _cqMapSize > _sqMapSize)
+            _sqMapSize = _cqMapSize;
+        _sqPtr = ::mmap(nullptr, _sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+        if (_sqPtr == MAP_FAILED)
+        {
+            _sqPtr = nullptr;
+            return false;
+        }
+        if (single)
+            _cqPtr = _sqPtr;
+        else
+        {
+            _cqPtr = ::mmap(nullptr, _cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+            if (_cqPtr == MAP_FAILED)
+            {
+                _cqPtr = nullptr;
+                return false;
+            }
+        }
+        char *sq = static_cast<char *>(_sqPtr);
+        _sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        _sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        _sqMask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        _sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        _sqEntries = p.sq_entries;
+        _sqesMapSize = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = ::mmap(nullptr, _sqesMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        _sqes = static_cast<io_uring_sqe *>(sqes);
+        char *cq = static_cast<char *>(_cqPtr);
+        _cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        _cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        _cqMask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        _sqeHead = _sqeTail = *_sqTail;
+        return true;
+    }
+    io_uring_sqe *IoUring::getSqe()
+    {
+        unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+        if (_sqeTail - head >= _sqEntries)
+        {
+            // 提交队列满了，先把已经填好的sqe交给内核腾出位置
+            submitAndWait(0);
+            head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+            if (_sqeTail - head >= _sqEntries)
+                return nullptr;
+        }
+        io_uring_sqe *sqe = &_sqes[_sqeTail & *_sqMask];
+        ++_sqeTail;
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+    int IoUring::submitAndWait(unsigned waitNr)
+    {
+        // 把本地填好的sqe下标写进sq的array并推进内核可见的tail
+        unsigned tail = *_sqTail;
+        while (_sqeHead != _sqeTail)
+        {
+            _sqArray[tail & *_sqMask] = _sqeHead & *_sqMask;
+            ++tail;
+            ++_sqeHead;
+        }
+        __atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+        // 上一次io_uring_enter被信号打断时可能还有没被内核取走的sqe，这里按内核的head重新计算一次
+        unsigned toSubmit = tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+        if (toSubmit == 0 && waitNr == 0)
+            return 0;
+        unsigned flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int ret = sysEnter(_ringFd, toSubmit, waitNr, flags);
+        if (ret < 0)
+            return -errno;
+        return ret;
+    }
+    io_uring_cqe *IoUring::peekCqe()
+    {
+        unsigned head = *_cqHead;
+        if (head == __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE))
+            return nullptr;
+        return &_cqes[head & *_cqMask];
+    }
+    void IoUring::cqeSeen()
+    {
+        __atomic_store_n(_cqHead, *_cqHead + 1, __ATOMIC_RELEASE);
+    }
+    bool IoUring::setupBufs(uint16_t groupId, unsigned count, size_t bufSize)
+    {
+        if (count == 0 || count > 0xffff)
+            return false;
+        _bufBase = static_cast<char *>(std::malloc(count * bufSize));
+        if (!_bufBase)
+            return false;
+        _bufSize = bufSize;
+        _bufCount = count;
+        _bufGroup = groupId;
+        // 一条PROVIDE_BUFFERS一次性把count块连续的缓冲区交给内核，bid从0开始编号
+        io_uring_sqe *sqe = getSqe();
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = static_cast<int>(count);
+        sqe->addr = reinterpret_cast<uint64_t>(_bufBase);
+        sqe->len = static_cast<uint32_t>(bufSize);
+        sqe->off = 0;
+        sqe->buf_group = groupId;
+        sqe->user_data = 0;
+        if (submitAndWait(1) < 0)
+            return false;
+        io_uring_cqe *cqe = peekCqe();
+        int res = cqe ? cqe->res : -EAGAIN;
+        if (cqe)
+            cqeSeen();
+        if (res < 0)
+        {
+            errno = -res;
+            return false;
+        }
+        return true;
+    }
+    void IoUring::recycleBuf(uint16_t bid)
+    {
+        // 归还的sqe和之后的recv在同一批里按顺序提交，内核先处理归还再处理recv
+        io_uring_sqe *sqe = getSqe();
+        if (!sqe)
+            return;
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = reinterpret_cast<uint64_t>(bufAddr(bid));
+        sqe->len = static_cast<uint32_t>(_bufSize);
+        sqe->off = bid;
+        sqe->buf_group = _bufGroup;
+        sqe->user_data = 0;
+    }
+}
+#endif